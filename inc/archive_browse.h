@@ -0,0 +1,19 @@
+#include "fm.h"
+
+/*
+ * Template of the dir where members opened from browsed archives are extracted
+ */
+#define ARCH_TMP_TEMPLATE "/tmp/ncursesFM-XXXXXX"
+
+int archive_browse_init(void);
+void show_archive(const char *path);
+void archive_jobs_done(void);
+int cancel_archive_job(int win);
+void archive_enter_press(void);
+void archive_go_up(void);
+void leave_archive_mode(int win);
+void free_archive_browse(int win);
+void remove_archive_tmp(void);
+int archive_member_offset(const char *path);
+int archive_row_color(int win, int i);
+int archive_row_stat(int win, int i, struct stat *st);
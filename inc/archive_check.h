@@ -0,0 +1,12 @@
+#pragma once
+
+#include "archiver.h"
+
+/*
+ * Min interval between two progress refreshes of archive check jobs
+ */
+#define CHECK_PROGRESS_MS 250
+
+int test_archives(void);
+int size_archives(void);
+void get_check_progress(char *str, size_t len);
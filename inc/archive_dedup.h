@@ -0,0 +1,106 @@
+#pragma once
+
+#include "archiver.h"
+#include "sha256.h"
+
+/*
+ * Extension of deduplicated archives, and name of the chunk store shared
+ * by every deduplicated archive in the same dir.
+ */
+#define DEDUP_EXT ".ncdup"
+#define DEDUP_STORE "ncursesFM.chunks"
+
+#define DEDUP_MAGIC "NCFMDUP1"
+#define DEDUP_STORE_MAGIC "NCFMCHK1"
+#define DEDUP_MAGIC_LEN 8
+
+/*
+ * Content defined chunking: a cut point is searched between min and max chunk size,
+ * with a harder mask before avg size and an easier one after it (normalized chunking),
+ * so that chunk sizes stay close to avg. Masks test the highest bits of gear hash,
+ * the ones that depend on the last 64 bytes read.
+ */
+#define DEDUP_MIN_CHUNK (16 * 1024)
+#define DEDUP_AVG_CHUNK (64 * 1024)
+#define DEDUP_MAX_CHUNK (256 * 1024)
+#define DEDUP_MASK_HARD 0xFFFF800000000000ull
+#define DEDUP_MASK_EASY 0xFFFE000000000000ull
+
+/*
+ * Files are read DEDUP_READ_LEN bytes at a time
+ */
+#define DEDUP_READ_LEN (4 * DEDUP_MAX_CHUNK)
+
+/*
+ * Sizes of on-disk records: chunk header in store (hash, stored len, raw len),
+ * entry header in archive (mode, name len, link len, num chunks, mtime, size),
+ * chunk reference in archive (hash, offset of the chunk in store).
+ * A chunk whose stored len is smaller than its raw len is deflated.
+ */
+#define DEDUP_CHUNK_HDR (SHA256_LEN + 8)
+#define DEDUP_ENTRY_HDR 32
+#define DEDUP_REF_LEN (SHA256_LEN + 8)
+
+/*
+ * Open addressing hash table from chunk hash to its offset in store
+ * (0 marks an empty slot: no chunk can start before store's magic ends).
+ */
+struct dedup_slot {
+    unsigned char hash[SHA256_LEN];
+    uint64_t offset;
+};
+
+struct dedup_index {
+    struct dedup_slot *slots;
+    size_t cap;
+    size_t num;
+};
+
+/*
+ * State of a job creating a deduplicated archive: store is locked for the whole job.
+ */
+struct dedup {
+    int store_fd;
+    off_t store_size;
+    struct dedup_index idx;
+    struct stat store_sb;
+    FILE *out;
+    struct stat archive_sb;
+    int distance_from_root;
+    int num_entries;
+    unsigned char *buf;
+    unsigned char *zbuf;
+    size_t zbuf_len;
+    struct byte_buf refs;
+    unsigned long new_chunks;
+    unsigned long old_chunks;
+    off_t new_bytes;
+};
+
+/*
+ * Entry read from a deduplicated archive: its num_chunks references follow it.
+ */
+struct dedup_entry {
+    mode_t mode;
+    uint32_t num_chunks;
+    time_t mtime;
+    uint64_t size;
+    char name[PATH_MAX + 1];
+    char link[PATH_MAX + 1];
+};
+
+/*
+ * State of a job extracting a deduplicated archive: raw holds current chunk,
+ * stored its deflated data.
+ */
+struct dedup_reader {
+    FILE *in;
+    int store_fd;
+    int dir_fd;
+    struct extract_ctx *ctx;
+    unsigned char *raw;
+    unsigned char *stored;
+};
+
+int create_dedup_archive(void);
+int extract_dedup_archive(const char *path, const atomic_int *cancel);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "utils.h"
+
+/*
+ * Max number of archive indexes kept in cache: it is exceeded only while
+ * every cached index is in use, until one of them is released.
+ */
+#define MAX_CACHED_ARCHIVES 64
+
+/*
+ * Single member of an archive; name points inside its index name pool.
+ * Members of nested archives are named "inner.tar/member".
+ */
+struct arch_entry {
+    char *name;
+    int64_t size;
+    time_t mtime;
+    mode_t mode;
+    int depth;
+};
+
+/*
+ * Header-only listing of an archive, keyed by (path, size, mtime).
+ * depth is the max nesting level that was descended while building it.
+ */
+struct arch_index {
+    char path[PATH_MAX + 1];
+    off_t size;
+    time_t mtime;
+    int depth;
+    int num_entries;
+    struct arch_entry *entries;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+    int entries_cap;
+    int refs;
+    struct arch_index *next;
+};
+
+struct arch_index *arch_index_get(const char *path, int depth, const atomic_int *cancel);
+struct arch_index *arch_index_get_progress(const char *path, int depth, const atomic_int *cancel,
+                                           void (*progress)(int64_t, void *), void *data);
+struct arch_index *arch_index_cached(const char *path);
+void arch_index_put(struct arch_index *idx);
+void free_arch_index_cache(void);
+void arch_norm_name(const char *name, char *out);
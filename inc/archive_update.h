@@ -0,0 +1,93 @@
+#pragma once
+
+#include "archiver.h"
+
+/*
+ * Zip records signatures
+ */
+#define ZIP_CD_SIG 0x02014b50
+#define ZIP_EOCD_SIG 0x06054b50
+#define ZIP64_EOCD_SIG 0x06064b50
+#define ZIP64_LOCATOR_SIG 0x07064b50
+
+/*
+ * Fixed sizes of zip records
+ */
+#define ZIP_CD_LEN 46
+#define ZIP_EOCD_LEN 22
+#define ZIP64_EOCD_LEN 56
+#define ZIP64_LOCATOR_LEN 20
+
+/*
+ * Max value of 16/32 bits zip fields: bigger values are stored in zip64 records
+ */
+#define ZIP_MAX16 0xFFFF
+#define ZIP_MAX32 0xFFFFFFFFu
+
+/*
+ * New offset of a zip member that is not copied
+ */
+#define ZIP_REMOVED UINT64_MAX
+
+/*
+ * Output of an update: libarchive's bytes are written to fd (pos counts them),
+ * or kept in capture_buf while capture is set (eg: zip central directory).
+ */
+struct upd_out {
+    int fd;
+    off_t pos;
+    int capture;
+    struct byte_buf capture_buf;
+};
+
+/*
+ * Zip central directory record: p points to its fixed part;
+ * sizes and offset are the real ones, even when stored in zip64 extra field.
+ */
+struct zip_rec {
+    const unsigned char *p;
+    int name_len;
+    int extra_len;
+    int comment_len;
+    uint64_t usize;
+    uint64_t csize;
+    uint64_t offset;
+};
+
+/*
+ * Position of a zip member inside the archive: rec is its central directory record.
+ */
+struct zip_member {
+    uint64_t offset;
+    int rec;
+};
+
+/*
+ * Zip central directory, found through end of central directory records
+ * (comment is the archive comment stored there).
+ */
+struct zip_cd {
+    unsigned char *data;
+    uint64_t offset;
+    uint64_t size;
+    struct zip_rec *recs;
+    int num_recs;
+    unsigned char *comment;
+    int comment_len;
+};
+
+/*
+ * State of an update job: files that are new or changed since they were archived,
+ * and archive's names they replace.
+ */
+struct update {
+    struct stat archive_sb;
+    struct strmap *old_names;
+    struct strmap *replaced;
+    struct pipe_file **changed;
+    int num_changed;
+    int changed_cap;
+    int distance_from_root;
+};
+
+int update_archive(void);
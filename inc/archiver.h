@@ -1,6 +1,116 @@
+#pragma once
+
 #include <ftw.h>
 #include <sys/file.h>
 #include "ui.h"
+#include "thpool.h"
+#include "bqueue.h"
+#include "strmap.h"
+#include "archive_index.h"
+
+#include <zlib.h>
+
+/*
+ * Extension used when new archive's name has no known one
+ */
+#define DEFAULT_ARCHIVE_EXT ".tgz"
+
+/*
+ * Uncompressed size of each member written by parallel gzip
+ */
+#define PGZ_BLOCK (1024 * 1024)
+
+/*
+ * Bounds of archive creation pipeline's queues: files waiting to be read,
+ * bytes read ahead waiting to be compressed, bytes waiting to be written.
+ */
+#define FILES_Q_MAX 1024
+#define CHUNKS_Q_MAX (32 * 1024 * 1024)
+#define OUT_Q_MAX (16 * 1024 * 1024)
+
+/*
+ * Queue cost of an entry header, roughly its size in memory
+ */
+#define ENTRY_COST 1024
+
+/*
+ * Size of the blocks libarchive hands to the writer stage
+ */
+#define OUT_BLOCK (64 * 1024)
+
+/*
+ * Dirs extracted before disk writer applies their (owner-only) mode and forgets them
+ * (a few hundred bytes each)
+ */
+#define EXTRACT_MAX_DIRS (256 * 1024)
+
+/*
+ * Disk writer options, for dirs too (see save_dir_fixup())
+ */
+#define EXTRACT_FLAGS (ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_FFLAGS | ARCHIVE_EXTRACT_SPARSE)
+#define EXTRACT_DIR_FLAGS (ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_SPARSE)
+
+/*
+ * File found by the tree walk: its entry name is path + name_offset.
+ */
+struct pipe_file {
+    struct stat sb;
+    int name_offset;
+    char path[];
+};
+
+/*
+ * If entry is not NULL, header of a new archive entry;
+ * else len bytes of data (of current entry, or of the new archive).
+ */
+struct pipe_chunk {
+    struct archive_entry *entry;
+    char *data;
+    size_t len;
+};
+
+/*
+ * Shared by the threads extracting an archive: top_names maps each
+ * top level entry name to the one it is extracted as.
+ * members (if not NULL) are the only entries to be extracted, with whatever is below them;
+ * last_header is the position of the last header to be read, or -1 if unknown.
+ * cancel is the cancel flag of the job.
+ */
+struct extract_ctx {
+    const char *archive_path;
+    const char *current_dir;
+    struct strmap *top_names;
+    const char **members;
+    int num_members;
+    int last_header;
+    const atomic_int *cancel;
+    FILE *dirs;
+    pthread_mutex_t dirs_lck;
+};
+
+/*
+ * Perms and times of an extracted dir, restored once every entry was written
+ * (see save_dir_fixup()). Stored in ctx->dirs right after the dir's path.
+ */
+struct dir_fixup {
+    mode_t mode;
+    struct timespec times[2];
+    size_t len;
+};
+
+/*
+ * Extracts members first, first + stride, first + 2 * stride...
+ */
+struct extract_job {
+    struct extract_ctx *ctx;
+    int first;
+    int stride;
+    int ret;
+};
 
 int create_archive(void);
+const char *get_archive_ext(const char *name);
+int set_archive_format(struct archive *a, const char *ext, int threads);
 int extract_file(void);
+struct archive *open_extract_archive(const char *path);
+const char *map_entry_name(struct extract_ctx *ctx, const char *name, char *fullpath);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct bqueue;
+
+struct bqueue *bq_new(size_t max_cost);
+int bq_push(struct bqueue *q, void *item, size_t cost);
+void *bq_pop(struct bqueue *q);
+void bq_close(struct bqueue *q);
+void bq_abort(struct bqueue *q);
+void bq_free(struct bqueue *q, void (*free_item)(void *));
@@ -4,6 +4,7 @@
 #include <libgen.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <poll.h>
 #include <signal.h>
 #include <sys/signalfd.h>
@@ -39,6 +40,9 @@
 #define RM_TH 2
 #define ARCHIVER_TH 3
 #define EXTRACTOR_TH 4
+#define UPDATE_TH 5
+#define TEST_TH 6
+#define SIZE_TH 7
 
 /*
  * Short (fast) operations that do not require spawning a separate thread
@@ -90,6 +94,11 @@
 #else
 #define DEVMON_IX 6
 #endif
+#define DU_IX (DEVMON_IX + 1)
+#define TYPE_IX (DU_IX + 1)
+#define PREVIEW_IX (TYPE_IX + 1)
+#define FUZZY_IX (PREVIEW_IX + 1)
+#define ARCH_BROWSE_IX (FUZZY_IX + 1)
 
 /*
  * Useful macro to know number of elements in arrays
@@ -111,6 +120,14 @@ struct conf {
     int persistent_log;
     int bat_low_level;
     int safe;
+    int archive_search_depth;
+    int archive_threads;
+    int archive_level;
+    int parallel_gzip;
+    int dir_sizes;
+    int type_colors;
+    int dir_cache_size;
+    int dir_cache_mb;
 #ifdef LIBNOTIFY_PRESENT
     int silent;
 #endif
@@ -138,7 +155,7 @@ struct scrstr {
     char tot_size[30];
 };
 
-enum working_mode {normal, fast_browse_, bookmarks_, search_, device_, selected_};
+enum working_mode {normal, fast_browse_, filter_, bookmarks_, search_, device_, selected_, fuzzy_, archive_, du_};
 
 /*
  * Struct used to store tab's information
@@ -147,6 +164,7 @@ struct tab {
     int curr_pos;
     char my_cwd[PATH_MAX + 1];
     char (*nl)[PATH_MAX + 1];
+    int *view;
     int number_of_files;
     char title[PATH_MAX + 1];
     struct inotify inot;
@@ -161,12 +179,23 @@ struct tab {
  * Struct used to store searches information
  */
 struct search_vars {
-    char searched_string[20];
+    char searched_string[100];
     char found_searched[MAX_NUMBER_OF_FOUND][PATH_MAX + 1];
     int searching;
     int search_archive;
     int search_lazy;
+    int search_pred;
     int found_cont;
+    int found_sort;
+};
+
+/*
+ * Growable byte buffer
+ */
+struct byte_buf {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
 };
 
 /*
@@ -174,7 +203,7 @@ struct search_vars {
  */
 typedef struct thread_list {
     // list of file selected for this job
-    char (*selected_files)[PATH_MAX + 1];
+    char **selected_files;
     // number of files selected for this job
     int num_selected;
     // function associated to this job
@@ -188,6 +217,10 @@ typedef struct thread_list {
     int num;
     // type of this job (needed to associate it with its function)
     int type;
+    // when set by its function: message shown when this job succeeds, instead of thread_str
+    char result[200];
+    // set to stop this job as soon as possible
+    atomic_int cancel;
 } thread_job_list;
 
 /*
@@ -204,7 +237,6 @@ int archive_cb_fd[2];
 char passphrase[100];
 #endif
 thread_job_list *thread_h;
-char (*selected)[PATH_MAX + 1];
 struct conf config;
 struct tab ps[MAX_TABS];
 struct search_vars sv;
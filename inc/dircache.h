@@ -0,0 +1,42 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "utils.h"
+#include "thpool.h"
+
+/*
+ * Listing of a dir: names of its entries (hidden ones too, "." excluded), sorted,
+ * packed one after the other. It is valid while dir's mtime does not change,
+ * and until an inotify event in it invalidates it (see dircache_invalidate()).
+ * At most config.dir_cache_size listings are kept, using at most
+ * config.dir_cache_mb MB: least recently used ones are dropped first.
+ */
+struct dir_listing {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    int (*cmp)(const struct dirent **, const struct dirent **);
+    int num;
+    char *names;
+    size_t size;
+    unsigned long used;
+};
+
+/*
+ * Dirs asked to be prefetched: last asked ones are read first;
+ * when more than PREFETCH_QUEUE_SIZE are waiting, the oldest is forgotten.
+ */
+#define PREFETCH_QUEUE_SIZE 4
+
+struct prefetch_req {
+    char path[PATH_MAX + 1];
+    int (*cmp)(const struct dirent **, const struct dirent **);
+};
+
+int dircache_list(const char *path, int (*cmp)(const struct dirent **, const struct dirent **),
+                  int hidden, char (**nl)[PATH_MAX + 1]);
+void dircache_prefetch(const char *path, int (*cmp)(const struct dirent **, const struct dirent **));
+void dircache_invalidate(const char *path);
+void free_dircache(void);
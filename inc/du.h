@@ -0,0 +1,45 @@
+#pragma once
+
+#include "utils.h"
+#include "thpool.h"
+#include "strmap.h"
+
+/*
+ * Recursive size of a dir, cached by inode. A node is valid while its dir's mtime
+ * is the one it was summed with, until an event in a watched dir invalidates it
+ * (see du_invalidate()). A change deep inside a tree does not touch its mtime,
+ * and only listed dirs are watched: dirs shown in a listing whose size was stored
+ * more than DU_TTL seconds ago are summed again in background, showing the old size
+ * meanwhile. Their subdirs are only summed again if their mtime changed.
+ */
+#define DU_TTL 60
+
+struct du_node {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    time_t stored;
+    off_t size;
+    struct du_node *next;
+};
+
+/*
+ * Invalidated dir: sizes summed before epoch are not cached.
+ * Only the last DU_INVALS ones are remembered.
+ */
+#define DU_INVALS 256
+
+struct du_inval {
+    dev_t dev;
+    ino_t ino;
+    unsigned long epoch;
+};
+
+int du_init(void);
+int du_size(const char *path, const struct stat *sb, off_t *size);
+int du_cached(const struct stat *sb, off_t *size);
+void du_store(const struct stat *sb, off_t size, unsigned long since);
+unsigned long du_epoch(void);
+void du_notify(void);
+void du_invalidate(const char *path);
+void du_free(void);
@@ -0,0 +1,15 @@
+#include "fm.h"
+
+/*
+ * Live updates of analyzer tab are asked at most once every DU_REFRESH_MS
+ */
+#define DU_REFRESH_MS 250
+#define DU_BAR_LEN 10
+
+void show_du_analyzer(const char *path);
+void refresh_du_analyzer(void);
+char *du_label(int i);
+void du_enter_press(struct stat s);
+void du_go_up(void);
+void leave_du_mode(const char *str);
+void free_du_analyzer(void);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "mimetype.h"
+
+/*
+ * Categories of regular files, used to color listings (see config.type_colors).
+ */
+enum file_type { TYPE_OTHER, TYPE_IMAGE, TYPE_ARCHIVE, TYPE_VIDEO, TYPE_SOURCE, TYPE_DOCUMENT };
+
+/*
+ * Files whose extension does not tell their type are queued to a low priority thread,
+ * that probes their mimetype. Last queued ones are probed first (they are the visible ones):
+ * when more than TYPE_QUEUE_SIZE files are waiting, the oldest is forgotten.
+ * Listings are redrawn at most once every TYPE_REFRESH_MS while classifying.
+ */
+#define TYPE_QUEUE_SIZE 256
+#define TYPE_REFRESH_MS 100
+
+int filetype_init(void);
+int file_type(const char *path, const struct stat *sb);
+void free_filetypes(void);
@@ -0,0 +1,9 @@
+#include "fm.h"
+
+#include <fnmatch.h>
+
+void show_filter(void);
+void filter_input(wint_t c);
+void update_filter(int win);
+void leave_filter_mode(int win);
+void free_filter(int win);
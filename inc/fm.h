@@ -4,6 +4,19 @@
 #include "search.h"
 #include "archiver.h"
 #include "worker_thread.h"
+#include "fuzzy.h"
+#include "filter.h"
+#include "archive_browse.h"
+#include "archive_update.h"
+#include "archive_check.h"
+#include "archive_dedup.h"
+#include "du.h"
+#include "du_analyzer.h"
+#include "mimetype.h"
+#include "filetype.h"
+#include "preview.h"
+#include "dircache.h"
+#include "latency.h"
 
 #include <wchar.h>
 #include <linux/version.h>
@@ -21,10 +34,15 @@ void manage_file(const char *str);
 void fast_file_operations(const int index);
 int remove_file(void);
 void manage_space_press(const char *str);
+int selected_index(const char *str);
+const char *selected_file(int i);
+int selected_members(void);
 void manage_all_space_press(void);
+void select_matching(int select);
 void remove_selected(void);
 void remove_all_selected(void);
 void show_selected(void);
+char **detach_selected(void);
 void free_selected(void);
 int paste_file(void);
 int move_file(void);
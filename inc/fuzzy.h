@@ -0,0 +1,21 @@
+#include "fm.h"
+
+#include <limits.h>
+
+/*
+ * Max number of ranked results shown in fuzzy finder tab
+ */
+#define MAX_FUZZY_RESULTS 200
+
+/*
+ * While current dir is walked, results are updated at most once every FUZZY_REFRESH_MS
+ */
+#define FUZZY_REFRESH_MS 200
+
+int fuzzy_init(void);
+void show_fuzzy_finder(void);
+void refresh_fuzzy_finder(void);
+void fuzzy_input(wint_t c);
+void fuzzy_enter_press(struct stat s);
+void leave_fuzzy_mode(const char *str);
+void free_fuzzy_finder(void);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "utils.h"
+
+#ifdef LATENCY_STATS
+/*
+ * Key to paint latencies (from a key being read, until it was handled and
+ * its effects drawn) are counted in LATENCY_BUCKETS buckets: bucket i counts
+ * the ones under 2^i us, last one every slower one.
+ */
+#define LATENCY_BUCKETS 24
+
+void latency_key(void);
+void latency_painted(void);
+void latency_discard(void);
+void latency_dump(void);
+#else
+#define latency_key()
+#define latency_painted()
+#define latency_discard()
+#define latency_dump()
+#endif
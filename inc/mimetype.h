@@ -0,0 +1,35 @@
+#pragma once
+
+#include <magic.h>
+#include "utils.h"
+#include "strmap.h"
+
+/*
+ * Mimetypes of the last MIME_CACHE_SIZE probed files are kept, by inode;
+ * a cached mimetype is valid while file's mtime and size do not change.
+ */
+#define MIME_CACHE_SIZE 4096
+#define MIME_LEN 128
+
+struct mime_entry {
+    struct mime_entry *prev;
+    struct mime_entry *next;
+    struct timespec mtime;
+    off_t size;
+    char key[48];
+    char mime[MIME_LEN];
+};
+
+/*
+ * libmagic handles cannot be shared between threads: each probe takes one
+ * from a pool, only loading a new one when every other one is busy.
+ */
+struct magic_handle {
+    magic_t magic;
+    struct magic_handle *next;
+};
+
+int get_mimetype(const char *path, const char *test);
+int get_mimetype_str(const char *path, char *mime, size_t len);
+int cached_mimetype(const struct stat *sb, char *mime, size_t len);
+void free_mimetypes(void);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "fm.h"
+
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <pwd.h>
+
+#define MAX_PREDICATES 16
+
+enum pred_key {PRED_NAME, PRED_SIZE, PRED_MTIME, PRED_TYPE, PRED_OWNER, PRED_PERM};
+
+/*
+ * Single "key op value" term, eg: "size>1G".
+ * alt is the index of the "or" alternative this term belongs to.
+ */
+struct predicate {
+    enum pred_key key;
+    char op;
+    int negate;
+    int alt;
+    int64_t value;
+    int64_t unit;
+    char glob[NAME_MAX + 1];
+};
+
+/*
+ * Compiled expression: terms of the same alternative are and'ed,
+ * alternatives are or'ed. mask holds the statx fields needed to evaluate it
+ * (0 if only names are checked).
+ */
+struct pred_expr {
+    struct predicate preds[MAX_PREDICATES];
+    int num_preds;
+    int num_alts;
+    unsigned int mask;
+    time_t now;
+};
+
+int compile_predicates(const char *str, struct pred_expr *e);
+int eval_predicates(const struct pred_expr *e, const char *name, unsigned char d_type, const struct statx *stx);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdarg.h>
+#include "utils.h"
+#include "thpool.h"
+#include "mimetype.h"
+#include "archive_index.h"
+
+/*
+ * Previews show up to PREVIEW_BYTES of the head of text files,
+ * and up to PREVIEW_LINES entries of dirs or members of archives.
+ * Last PREVIEW_CACHE_SIZE previews are kept: each is shown at once, and
+ * produced again in background if file's mtime or size changed.
+ */
+#define PREVIEW_BYTES (16 * 1024)
+#define PREVIEW_LINES 256
+#define PREVIEW_CACHE_SIZE 32
+#define PREVIEW_TAB_LEN 4
+
+struct preview {
+    char *path;
+    struct timespec mtime;
+    off_t size;
+    unsigned long used;
+    char *text;
+};
+
+/*
+ * A job is cancelled as soon as a newer preview is asked (see get_preview()).
+ */
+struct preview_job {
+    char path[PATH_MAX + 1];
+    atomic_int cancel;
+};
+
+int preview_init(void);
+char *get_preview(const char *path);
+void free_previews(void);
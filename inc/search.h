@@ -1,8 +1,16 @@
 #include "fm.h"
+#include "archive_index.h"
+#include "thpool.h"
+#include "predicate.h"
 
 #define SEARCH_LINE 2
+#define SEARCH_PROGRESS_MS 250
 
 void search(void);
+void pred_search(void);
+void change_found_sort(void);
 void list_found(void);
 int search_enter_press(const char *str);
 void leave_search_mode(const char *str);
+void get_search_progress(char *str, size_t len);
+void cancel_search(void);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define SHA256_LEN 32
+
+struct sha256 {
+    uint32_t state[8];
+    uint64_t len;
+    unsigned char buf[64];
+    size_t buf_len;
+};
+
+void sha256_init(struct sha256 *s);
+void sha256_update(struct sha256 *s, const void *data, size_t len);
+void sha256_final(struct sha256 *s, unsigned char *digest);
+void sha256(const void *data, size_t len, unsigned char *digest);
@@ -1,7 +1,7 @@
-#define LONG_FILE_OPERATIONS 5
+#define LONG_FILE_OPERATIONS 8
 #define SHORT_FILE_OPERATIONS 3
 
-#define MODES 6
+#define MODES 10
 
 extern const char yes[];
 extern const char no[];
@@ -14,9 +14,10 @@ extern const char generic_error[];
 
 extern const char *info_win_str[3];
 
-extern const char *arch_ext[6];
+extern const char *arch_ext[12];
 
 extern const char *sorting_str[4];
+extern const char *found_sorting_str[3];
 
 extern const char bookmarks_add_quest[];
 extern const char bookmarks_rm_quest[];
@@ -33,14 +34,21 @@ extern const char bookmarks_cleared[];
 extern const char no_selected_files[];
 extern const char *file_sel[6];
 extern const char selected_cleared[];
+extern const char *pred_sel[2];
+extern const char *pred_sel_result[2];
 
 extern const char sure[];
 
-extern const char already_searching[];
+extern const char search_running_quest[];
+extern const char search_cancel[];
+extern const char search_restart[];
+extern const char search_cancelled[];
 extern const char search_insert_name[];
 extern const char search_archives[];
 extern const char lazy_search[];
 extern const char searched_string_minimum[];
+extern const char pred_search_insert[];
+extern const char pred_wrong_expr[];
 extern const char too_many_found[];
 extern const char no_found[];
 extern const char already_search_mode[];
@@ -60,6 +68,13 @@ extern const char extr_question[];
 
 extern const char pwd_archive[];
 
+extern const char check_quest[];
+extern const char check_test[];
+extern const char check_size[];
+extern const char test_result[];
+extern const char size_result[];
+extern const char dedup_result[];
+
 extern const char *thread_job_mesg[LONG_FILE_OPERATIONS];
 extern const char *thread_str[LONG_FILE_OPERATIONS];
 extern const char *thread_fail_str[LONG_FILE_OPERATIONS];
@@ -68,6 +83,8 @@ extern const char selected_mess[];
 
 extern const char thread_running[];
 extern const char quit_with_running_thread[];
+extern const char cancel_jobs_quest[];
+extern const char job_cancelled[];
 
 extern const char pkg_quest[];
 extern const char install_th_wait[];
@@ -88,6 +105,16 @@ extern const char monitor_err[];
 extern const char bookmarks_mode_str[];
 extern const char search_mode_str[];
 extern const char selected_mode_str[];
+extern const char fuzzy_mode_str[];
+extern const char fuzzy_already_active[];
+extern const char du_mode_str[];
+extern const char du_already_active[];
+extern const char filter_mode_str[];
+
+extern const char arch_reading[];
+extern const char arch_member_err[];
+extern const char arch_members_only[];
+extern const char not_updatable[];
 
 extern const char ac_online[];
 extern const char power_fail[];
@@ -96,5 +123,9 @@ extern const char *insert_string[];
 
 extern const char win_too_small[];
 
+extern const char preview_no_space[];
+extern const char preview_loading[];
+extern const char preview_dir_str[];
+
 extern const char helper_title[];
 extern const char helper_string[MODES][16][150];
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+struct strmap;
+
+uint32_t strmap_hash(const char *key);
+struct strmap *strmap_new(size_t size_hint);
+void *strmap_get(const struct strmap *m, const char *key);
+int strmap_put(struct strmap *m, const char *key, void *value);
+int strmap_reserve(struct strmap *m, size_t num_keys);
+void *strmap_del(struct strmap *m, const char *key);
+void strmap_free(struct strmap *m, void (*free_value)(void *));
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+struct thpool;
+
+struct thpool *thpool_new(int num_threads);
+int thpool_add(struct thpool *pool, void (*f)(void *), void *arg);
+void thpool_wait(struct thpool *pool);
+int thpool_timedwait(struct thpool *pool, int ms);
+void thpool_free(struct thpool *pool);
+int thpool_default_size(void);
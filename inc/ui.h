@@ -5,6 +5,7 @@
 #include "string_constants.h"
 #include "quit.h"
 #include "utils.h"
+#include "latency.h"
 
 #include <locale.h>
 #include <stdlib.h>
@@ -51,9 +52,13 @@ void ask_user(const char *str, char *input, int d);
 void resize_win(void);
 void change_sort(void);
 void highlight_selected(const char *str, const char c, int win);
+void mark_row(int win, int line, const char c);
+void refresh_selected_marks(int win);
 void erase_selected_highlight(void);
 void update_colors(void);
 void update_time(int where);
 void update_sysinfo(int where);
 void update_batt(int online, int perc[], int num_of_batt, char name[][10], int where);
 void trigger_fullname_win(void);
+void trigger_preview(void);
+void close_preview(void);
@@ -1,16 +1,33 @@
 #pragma once
 
-#include <magic.h>
 #include <stdlib.h>
 #include "log.h"
 #include "ui.h"
 
+/*
+ * Bounds and alignment of buffers used to read/write files' data
+ */
+#define IO_BUF_MIN (64 * 1024)
+#define IO_BUF_MAX (1024 * 1024)
+#define IO_BUF_ALIGN 4096
+
 void *remove_from_list(int *num, char (*str)[PATH_MAX + 1], int i);
 void *safe_realloc(const size_t size, char (*str)[PATH_MAX + 1]);
 int is_ext(const char *filename, const char *ext[], int size);
-int get_mimetype(const char *path, const char *test);
 int move_cursor_to_file(int start_idx, const char *filename, int win);
 void save_old_pos(int win);
 int is_present(const char *name, char (*str)[PATH_MAX + 1], int num, int len, int start_idx);
+int find_row(const char *name, int win, int len, int start_idx);
+char *tab_entry(int win, int i);
 void change_unit(float size, char *str);
+size_t io_block_size(off_t size);
+int read_all(int fd, void *buf, size_t len, off_t off);
+int write_all(int fd, const void *buf, size_t len);
+int buf_add(struct byte_buf *b, const void *data, size_t len);
+uint16_t get16(const unsigned char *p);
+uint32_t get32(const unsigned char *p);
+uint64_t get64(const unsigned char *p);
+void put16(unsigned char *p, uint16_t v);
+void put32(unsigned char *p, uint32_t v);
+void put64(unsigned char *p, uint64_t v);
 void leave_mode_helper(struct stat s);
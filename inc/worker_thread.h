@@ -13,3 +13,4 @@ struct thread_mesg {
 void init_job_queue(void);
 void destroy_job_queue(void);
 void init_thread(int type, int (* const f)(void));
+void cancel_jobs(void);
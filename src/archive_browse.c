@@ -0,0 +1,521 @@
+#include "../inc/archive_browse.h"
+
+/*
+ * Row of a browsed dir: entry is its index inside archive's index,
+ * or -1 for ".." and for dirs only implied by their members' names.
+ */
+struct arch_row {
+    char name[NAME_MAX + 1];
+    int entry;
+    int is_dir;
+};
+
+/*
+ * Archive browsed by a tab: dir is current dir inside the archive ("" for its root).
+ * names holds rows' fullpaths ("archive/dir/name"), as shown by the tab.
+ */
+struct arch_browse {
+    struct arch_index *idx;
+    char archive[PATH_MAX + 1];
+    char dir[PATH_MAX + 1];
+    struct arch_row *rows;
+    int num_rows;
+    int rows_cap;
+    char (*names)[PATH_MAX + 1];
+};
+
+/*
+ * Reading of an archive (to be shown by win) or extraction of one of its members,
+ * made by a background thread. name is the member to extract, as stored in archive's
+ * headers, and ordinal its position between top level ones ("" and 0 to read archive).
+ * Results are idx (read archive) or out and ret (extracted member).
+ */
+struct browse_job {
+    char archive[PATH_MAX + 1];
+    char name[PATH_MAX + 1];
+    char out[PATH_MAX + 1];
+    int ordinal;
+    int win;
+    int ret;
+    struct arch_index *idx;
+    atomic_int cancel;
+    struct browse_job *next;
+};
+
+static int list_dir(int win);
+static int add_row(struct arch_browse *b, const char *name, int entry, int is_dir);
+static int cmp_rows(const void *a, const void *b);
+static void refresh_archive_tab(int win, const char *old_name);
+static void queue_job(struct browse_job *job);
+static void browse_job(void *x);
+static void enter_archive(struct browse_job *job);
+static int extract_member(struct browse_job *job);
+static int remove_tmp_file(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf);
+
+/*
+ * jobs[win] is the job still running for win (only used by main thread):
+ * ESC, or leaving archive mode, cancels it (see cancel_archive_job()).
+ * Ended jobs are pushed to done, then browse_fd is written:
+ * main thread only uses results of jobs that were not cancelled meanwhile.
+ * lck protects done. tmp_dir and num_extracted are only used by background thread.
+ */
+static struct arch_browse browse[MAX_TABS];
+static struct browse_job *jobs[MAX_TABS];
+static struct browse_job *done;
+static struct thpool *pool;
+static pthread_mutex_t lck = PTHREAD_MUTEX_INITIALIZER;
+static int browse_fd = -1;
+static char tmp_dir[PATH_MAX + 1];
+static int num_extracted;
+
+/*
+ * Returns the fd polled by main loop to know that an archive was read, or a member extracted.
+ */
+int archive_browse_init(void) {
+    browse_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return browse_fd;
+}
+
+/*
+ * Asks background thread to read path's headers (see arch_index_get(): index is
+ * cached by path, size and mtime); its root dir is listed in active tab once read.
+ */
+void show_archive(const char *path) {
+    struct browse_job *job = calloc(1, sizeof(struct browse_job));
+    
+    if (!job) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        return;
+    }
+    strncpy(job->archive, path, PATH_MAX);
+    queue_job(job);
+}
+
+/*
+ * Cancels any job still running for active tab, then queues job for it.
+ */
+static void queue_job(struct browse_job *job) {
+    job->win = active;
+    atomic_init(&job->cancel, 0);
+    cancel_archive_job(active);
+    if (browse_fd == -1 || (!pool && !(pool = thpool_new(1))) || thpool_add(pool, browse_job, job) == -1) {
+        free(job);
+        print_info(_(generic_error), ERR_LINE);
+        return;
+    }
+    jobs[active] = job;
+    print_info(_(arch_reading), INFO_LINE);
+}
+
+static void browse_job(void *x) {
+    struct browse_job *job = (struct browse_job *)x;
+    
+    if (!strlen(job->name)) {
+        job->idx = arch_index_get(job->archive, 0, &job->cancel);
+    } else {
+        job->ret = extract_member(job);
+    }
+    pthread_mutex_lock(&lck);
+    job->next = done;
+    done = job;
+    pthread_mutex_unlock(&lck);
+    eventfd_write(browse_fd, 1);
+}
+
+/*
+ * Called by main loop when some jobs ended: an archive that could not be read
+ * (eg: a compressed single file) is just opened, as is an extracted member.
+ * A read archive is shown only if its tab is still active, and not in a special mode.
+ */
+void archive_jobs_done(void) {
+    struct browse_job *job, *next;
+    
+    pthread_mutex_lock(&lck);
+    job = done;
+    done = NULL;
+    pthread_mutex_unlock(&lck);
+    for (; job; job = next) {
+        next = job->next;
+        if (job == jobs[job->win]) {
+            jobs[job->win] = NULL;
+            print_info("", INFO_LINE);
+            if (strlen(job->name)) {
+                if (job->ret == 0) {
+                    manage_file(job->out);
+                } else {
+                    print_info(_(arch_member_err), ERR_LINE);
+                }
+            } else if (!job->idx) {
+                manage_file(job->archive);
+            } else if (job->win == active && ps[active].mode <= filter_) {
+                enter_archive(job);
+            }
+        }
+        arch_index_put(job->idx);
+        free(job);
+    }
+}
+
+/*
+ * Cancels job still running for win, if any. Returns 1 if there was one.
+ */
+int cancel_archive_job(int win) {
+    if (!jobs[win]) {
+        return 0;
+    }
+    atomic_store(&jobs[win]->cancel, 1);
+    jobs[win] = NULL;
+    print_info("", INFO_LINE);
+    return 1;
+}
+
+/*
+ * Lists root dir of the archive read by job in active tab (taking its index).
+ */
+static void enter_archive(struct browse_job *job) {
+    struct arch_browse *b = &browse[active];
+    
+    b->idx = job->idx;
+    job->idx = NULL;
+    strncpy(b->archive, job->archive, PATH_MAX);
+    b->dir[0] = '\0';
+    if (list_dir(active) == -1) {
+        free_archive_browse(active);
+        return;
+    }
+    if (ps[active].mode == filter_) {
+        free_filter(active);
+    }
+    show_special_tab(b->num_rows, b->names, b->archive, archive_);
+}
+
+/*
+ * Collects the names found right below current dir: members of nested archives are skipped,
+ * dirs that have no entry of their own are implied by their members' names.
+ */
+static int list_dir(int win) {
+    struct arch_browse *b = &browse[win];
+    struct strmap *seen;
+    char name[PATH_MAX + 1];
+    int dir_len = strlen(b->dir);
+    
+    b->num_rows = 0;
+    if (!(seen = strmap_new(0)) || add_row(b, "..", -1, 1) == -1) {
+        goto fail;
+    }
+    for (int i = 0; i < b->idx->num_entries; i++) {
+        const struct arch_entry *e = &b->idx->entries[i];
+        char *rest, *slash;
+        intptr_t row;
+        
+        if (e->depth) {
+            continue;
+        }
+        arch_norm_name(e->name, name);
+        if (dir_len && (strncmp(name, b->dir, dir_len) || name[dir_len] != '/')) {
+            continue;
+        }
+        rest = dir_len ? name + dir_len + 1 : name;
+        if (!*rest || (rest[0] == '.' && !ps[win].show_hidden)) {
+            continue;
+        }
+        if ((slash = strchr(rest, '/'))) {
+            *slash = '\0';
+        }
+        if ((row = (intptr_t)strmap_get(seen, rest))) {
+            // an entry of its own (or a later duplicate) replaces the implied one
+            if (!slash) {
+                b->rows[row - 1].entry = i;
+                b->rows[row - 1].is_dir = S_ISDIR(e->mode);
+            }
+        } else if (add_row(b, rest, slash ? -1 : i, slash || S_ISDIR(e->mode)) == -1 ||
+                   strmap_put(seen, rest, (void *)(intptr_t)b->num_rows) == -1) {
+            goto fail;
+        }
+    }
+    strmap_free(seen, NULL);
+    seen = NULL;
+    // ".." stays first
+    qsort(b->rows + 1, b->num_rows - 1, sizeof(struct arch_row), cmp_rows);
+    free(b->names);
+    if (!(b->names = calloc(b->num_rows, PATH_MAX + 1))) {
+        goto fail;
+    }
+    for (int i = 0; i < b->num_rows; i++) {
+        snprintf(b->names[i], PATH_MAX, "%s%s%s/%s", b->archive, dir_len ? "/" : "", b->dir, b->rows[i].name);
+    }
+    return 0;
+
+fail:
+    if (seen) {
+        strmap_free(seen, NULL);
+    }
+    quit = MEM_ERR_QUIT;
+    ERROR("could not malloc. Leaving.");
+    return -1;
+}
+
+static int add_row(struct arch_browse *b, const char *name, int entry, int is_dir) {
+    if (b->num_rows == b->rows_cap) {
+        int cap = b->rows_cap ? b->rows_cap * 2 : 64;
+        struct arch_row *tmp = realloc(b->rows, cap * sizeof(struct arch_row));
+        
+        if (!tmp) {
+            return -1;
+        }
+        b->rows = tmp;
+        b->rows_cap = cap;
+    }
+    strncpy(b->rows[b->num_rows].name, name, NAME_MAX);
+    b->rows[b->num_rows].name[NAME_MAX] = '\0';
+    b->rows[b->num_rows].entry = entry;
+    b->rows[b->num_rows].is_dir = is_dir;
+    b->num_rows++;
+    return 0;
+}
+
+static int cmp_rows(const void *a, const void *b) {
+    return strcoll(((const struct arch_row *)a)->name, ((const struct arch_row *)b)->name);
+}
+
+/*
+ * Shows current dir's rows, moving cursor to old_name if not NULL.
+ */
+static void refresh_archive_tab(int win, const char *old_name) {
+    struct arch_browse *b = &browse[win];
+    
+    ps[win].number_of_files = b->num_rows;
+    str_ptr[win] = b->names;
+    snprintf(ps[win].title, PATH_MAX, "%s%s%s", b->archive, strlen(b->dir) ? "/" : "", b->dir);
+    reset_win(win);
+    for (int i = 1; old_name && i < b->num_rows; i++) {
+        if (!strcmp(b->rows[i].name, old_name)) {
+            scroll_down(win, i);
+            break;
+        }
+    }
+}
+
+/*
+ * Enters a dir of the archive, or extracts current file to open it.
+ */
+void archive_enter_press(void) {
+    struct arch_browse *b = &browse[active];
+    const struct arch_row *r = &b->rows[ps[active].curr_pos];
+    struct browse_job *job;
+    int len = strlen(b->dir);
+    
+    if (!ps[active].curr_pos) {
+        archive_go_up();
+    } else if (r->is_dir) {
+        snprintf(b->dir + len, PATH_MAX - len, "%s%s", len ? "/" : "", r->name);
+        if (list_dir(active) == 0) {
+            refresh_archive_tab(active, NULL);
+        }
+    } else if (r->entry == -1 || !S_ISREG(b->idx->entries[r->entry].mode)) {
+        // only regular files can be extracted
+        print_info(_(arch_member_err), ERR_LINE);
+    } else if (!(job = calloc(1, sizeof(struct browse_job)))) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+    } else {
+        // position of the member between top level ones: that's the header to look for
+        for (int i = 0; i < r->entry; i++) {
+            if (!b->idx->entries[i].depth) {
+                job->ordinal++;
+            }
+        }
+        strncpy(job->archive, b->archive, PATH_MAX);
+        strncpy(job->name, b->idx->entries[r->entry].name, PATH_MAX);
+        queue_job(job);
+    }
+}
+
+/*
+ * Goes to parent dir inside the archive, or leaves archive mode from its root.
+ */
+void archive_go_up(void) {
+    struct arch_browse *b = &browse[active];
+    char old_name[NAME_MAX + 1] = {0};
+    char *slash;
+    
+    if (!strlen(b->dir)) {
+        leave_archive_mode(active);
+        return;
+    }
+    slash = strrchr(b->dir, '/');
+    strncpy(old_name, slash ? slash + 1 : b->dir, NAME_MAX);
+    if (slash) {
+        *slash = '\0';
+    } else {
+        b->dir[0] = '\0';
+    }
+    if (list_dir(active) == 0) {
+        refresh_archive_tab(active, old_name);
+    }
+}
+
+/*
+ * Goes back to archive's dir, with cursor over the archive.
+ */
+void leave_archive_mode(int win) {
+    char dir[PATH_MAX + 1] = {0}, name[PATH_MAX + 1] = {0};
+    
+    strncpy(dir, browse[win].archive, PATH_MAX);
+    strncpy(name, browse[win].archive, PATH_MAX);
+    strncpy(ps[win].old_file, basename(name), NAME_MAX);
+    free_archive_browse(win);
+    leave_special_mode(dirname(dir), win);
+}
+
+void free_archive_browse(int win) {
+    struct arch_browse *b = &browse[win];
+    
+    cancel_archive_job(win);
+    arch_index_put(b->idx);
+    free(b->rows);
+    free(b->names);
+    memset(b, 0, sizeof(struct arch_browse));
+}
+
+/*
+ * Extracts job's member inside its own subdir of tmp_dir, to keep its name
+ * (so that it is opened by the right program). Headers following it are not read,
+ * and zip members are reached by seeking. Stops as soon as job is cancelled.
+ */
+static int extract_member(struct browse_job *job) {
+    struct archive *a;
+    struct archive_entry *ae;
+    char name[PATH_MAX + 1], sub_dir[PATH_MAX + 1], buf[BUFF_SIZE];
+    int fd, r, ret = -1;
+    la_ssize_t n = -1;
+    
+    if (!strlen(tmp_dir)) {
+        strncpy(tmp_dir, ARCH_TMP_TEMPLATE, PATH_MAX);
+        if (!mkdtemp(tmp_dir)) {
+            tmp_dir[0] = '\0';
+            return -1;
+        }
+    }
+    arch_norm_name(job->name, name);
+    snprintf(sub_dir, PATH_MAX, "%s/%d", tmp_dir, num_extracted++);
+    snprintf(job->out, PATH_MAX, "%s/%s", sub_dir, strrchr(name, '/') ? strrchr(name, '/') + 1 : name);
+    if (mkdir(sub_dir, 0700) == -1 || !(a = archive_read_new())) {
+        return -1;
+    }
+    archive_read_support_filter_all(a);
+    archive_read_support_format_all(a);
+    if (archive_read_open_filename(a, job->archive, IO_BUF_MIN) == ARCHIVE_OK) {
+        for (int i = 0; !atomic_load(&job->cancel) &&
+             ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK || r == ARCHIVE_WARN); i++) {
+            if (i < job->ordinal) {
+                continue;
+            }
+            // archive changed since it was indexed
+            if (!archive_entry_pathname(ae) || strcmp(archive_entry_pathname(ae), job->name)) {
+                break;
+            }
+            if ((fd = open(job->out, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, (archive_entry_perm(ae) & 0777) | S_IRUSR)) != -1) {
+                while (!atomic_load(&job->cancel) && (n = archive_read_data(a, buf, sizeof(buf))) > 0 &&
+                       write_all(fd, buf, n) == 0);
+                ret = !atomic_load(&job->cancel) && n == 0 ? 0 : -1;
+                close(fd);
+            }
+            break;
+        }
+    }
+    archive_read_free(a);
+    return ret;
+}
+
+/*
+ * Called at exit: cancels running jobs and waits for background thread,
+ * then removes every member extracted while browsing archives.
+ */
+void remove_archive_tmp(void) {
+    for (int i = 0; i < MAX_TABS; i++) {
+        cancel_archive_job(i);
+    }
+    if (pool) {
+        thpool_free(pool);
+        pool = NULL;
+    }
+    for (struct browse_job *next; done; done = next) {
+        next = done->next;
+        arch_index_put(done->idx);
+        free(done);
+    }
+    if (browse_fd != -1) {
+        close(browse_fd);
+    }
+    if (strlen(tmp_dir)) {
+        nftw(tmp_dir, remove_tmp_file, 64, FTW_DEPTH | FTW_PHYS);
+    }
+}
+
+static int remove_tmp_file(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    remove(path);
+    return 0;
+}
+
+/*
+ * Returns length of the archive part of path if path is a member listed
+ * while browsing an archive (eg: "/home/a.tgz/dir/file"), 0 otherwise.
+ */
+int archive_member_offset(const char *path) {
+    char prefix[PATH_MAX + 1] = {0};
+    const char *slash = path;
+    struct stat sb;
+    
+    if (!stat(path, &sb)) {
+        return 0;
+    }
+    while ((slash = strchr(slash + 1, '/'))) {
+        strncpy(prefix, path, slash - path);
+        prefix[slash - path] = '\0';
+        if (stat(prefix, &sb) == -1) {
+            return 0;
+        }
+        if (!S_ISDIR(sb.st_mode)) {
+            return S_ISREG(sb.st_mode) && is_ext(prefix, arch_ext, NUM(arch_ext)) ? slash - path : 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Same colors used for files on disk (see colored_folders()).
+ */
+int archive_row_color(int win, int i) {
+    const struct arch_row *r = &browse[win].rows[i];
+    mode_t mode = r->entry != -1 ? browse[win].idx->entries[r->entry].mode : 0;
+    
+    if (r->is_dir) {
+        return 1;
+    }
+    if (S_ISLNK(mode)) {
+        return 2;
+    }
+    if (S_ISREG(mode) && (mode & S_IXUSR)) {
+        return 3;
+    }
+    return 4;
+}
+
+/*
+ * Fills st with i-th row's size, mode and mtime, as stored in archive headers.
+ * Returns -1 for rows without an entry of their own.
+ */
+int archive_row_stat(int win, int i, struct stat *st) {
+    const struct arch_row *r = &browse[win].rows[i];
+    
+    if (r->entry == -1) {
+        return -1;
+    }
+    memset(st, 0, sizeof(struct stat));
+    st->st_size = browse[win].idx->entries[r->entry].size;
+    st->st_mode = browse[win].idx->entries[r->entry].mode;
+    st->st_mtime = browse[win].idx->entries[r->entry].mtime;
+    return 0;
+}
@@ -0,0 +1,232 @@
+#include "../inc/archive_check.h"
+
+static int check_archives(void (*f)(void *));
+static void test_job(void *x);
+static void size_job(void *x);
+static int check_gzip(const char *path);
+static void size_progress(int64_t size, void *data);
+static void add_progress(unsigned long members, unsigned long bytes);
+
+/*
+ * Progress of current check job, updated by the threads checking each selected archive:
+ * read by main thread (through get_check_progress()) while refreshing INFO_LINE.
+ */
+static atomic_int archives_done, archives_failed;
+static atomic_ulong members_done, bytes_done;
+static struct timespec last_report;
+static pthread_mutex_t report_lck = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Decompresses every member of selected archives without writing it anywhere:
+ * libarchive checks headers and CRCs of each format (and of its compression filter) while reading,
+ * except for gzip trailers, that are checked by check_gzip().
+ */
+int test_archives(void) {
+    char size[20];
+    
+    if (check_archives(test_job) == -1) {
+        return -1;
+    }
+    change_unit(atomic_load(&bytes_done), size);
+    snprintf(thread_h->result, sizeof(thread_h->result), _(test_result),
+             atomic_load(&archives_done), atomic_load(&members_done), size);
+    return 0;
+}
+
+/*
+ * Sums members count and uncompressed size of selected archives, reading only their headers.
+ * Indexes are shared with archive browsing: an archive already listed is not read again.
+ */
+int size_archives(void) {
+    char size[20];
+    
+    if (check_archives(size_job) == -1) {
+        return -1;
+    }
+    change_unit(atomic_load(&bytes_done), size);
+    snprintf(thread_h->result, sizeof(thread_h->result), _(size_result),
+             atomic_load(&archives_done), atomic_load(&members_done), size);
+    return 0;
+}
+
+/*
+ * Runs f on each selected archive, concurrently on a pool of up to config.archive_threads threads.
+ * Returns -1 if any archive could not be read.
+ */
+static int check_archives(void (*f)(void *)) {
+    int threads = config.archive_threads > 0 ? config.archive_threads : thpool_default_size();
+    struct thpool *pool = NULL;
+    
+    atomic_store(&archives_done, 0);
+    atomic_store(&archives_failed, 0);
+    atomic_store(&members_done, 0);
+    atomic_store(&bytes_done, 0);
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+    if (threads > thread_h->num_selected) {
+        threads = thread_h->num_selected;
+    }
+    if (threads > 1) {
+        pool = thpool_new(threads);
+    }
+    for (int i = 0; i < thread_h->num_selected && !atomic_load(&thread_h->cancel); i++) {
+        if (!pool || thpool_add(pool, f, thread_h->selected_files[i]) == -1) {
+            f(thread_h->selected_files[i]);
+        }
+    }
+    if (pool) {
+        thpool_wait(pool);
+        thpool_free(pool);
+    }
+    return atomic_load(&archives_failed) || atomic_load(&thread_h->cancel) ? -1 : 0;
+}
+
+static void test_job(void *x) {
+    const char *path = (const char *)x;
+    struct archive *a;
+    struct archive_entry *entry;
+    const void *buff;
+    size_t len;
+    la_int64_t offset;
+    int r = ARCHIVE_FATAL;
+    
+    if ((a = open_extract_archive(path))) {
+        while (!atomic_load(&thread_h->cancel) && ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN)) {
+            while (!atomic_load(&thread_h->cancel) && (r = archive_read_data_block(a, &buff, &len, &offset)) == ARCHIVE_OK) {
+                add_progress(0, len);
+            }
+            if (r != ARCHIVE_EOF) {
+                break;
+            }
+            add_progress(1, 0);
+        }
+    }
+    // a cancelled archive is neither a failure nor a tested one
+    if (atomic_load(&thread_h->cancel)) {
+        archive_read_free(a);
+        return;
+    }
+    if (r == ARCHIVE_EOF && archive_filter_code(a, 0) == ARCHIVE_FILTER_GZIP && check_gzip(path) == -1) {
+        ERROR(path);
+        ERROR("wrong gzip CRC or size.");
+        atomic_fetch_add(&archives_failed, 1);
+    } else if (r != ARCHIVE_EOF) {
+        ERROR(path);
+        ERROR(a ? archive_error_string(a) : "could not open archive.");
+        atomic_fetch_add(&archives_failed, 1);
+    } else {
+        atomic_fetch_add(&archives_done, 1);
+    }
+    archive_read_free(a);
+}
+
+/*
+ * Members are counted while their headers are read (see size_progress()):
+ * only an index already cached is counted once it is returned.
+ */
+static void size_job(void *x) {
+    const char *path = (const char *)x;
+    struct arch_index *idx;
+    unsigned long bytes = 0, reported[2] = {0};
+    int members = 0;
+    
+    if (!(idx = arch_index_get_progress(path, 0, &thread_h->cancel, size_progress, reported))) {
+        // a cancelled archive is neither a failure nor a sized one
+        if (atomic_load(&thread_h->cancel)) {
+            return;
+        }
+        ERROR(path);
+        ERROR("could not read archive.");
+        atomic_fetch_add(&archives_failed, 1);
+        return;
+    }
+    for (int i = 0; i < idx->num_entries; i++) {
+        if (idx->entries[i].depth == 0) {
+            bytes += idx->entries[i].size;
+            members++;
+        }
+    }
+    arch_index_put(idx);
+    atomic_fetch_add(&archives_done, 1);
+    add_progress(members - reported[0], bytes - reported[1]);
+}
+
+/*
+ * data holds members and bytes already reported for current archive.
+ */
+static void size_progress(int64_t size, void *data) {
+    unsigned long *reported = (unsigned long *)data;
+    
+    reported[0]++;
+    reported[1] += size;
+    add_progress(1, size);
+}
+
+/*
+ * Inflates every member of gzip file at path through zlib, that checks
+ * CRC and size stored in each member's trailer (parallel gzip writes many members).
+ */
+static int check_gzip(const char *path) {
+    z_stream zs = {0};
+    struct stat sb;
+    unsigned char *in = NULL, *out = NULL;
+    size_t size;
+    ssize_t len;
+    int fd, r = Z_OK;
+    
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return -1;
+    }
+    size = io_block_size(fstat(fd, &sb) == -1 ? 0 : sb.st_size);
+    if (!(in = malloc(size)) || !(out = malloc(size)) || inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+        free(in);
+        free(out);
+        close(fd);
+        return -1;
+    }
+    while (!atomic_load(&thread_h->cancel) && (r == Z_OK || r == Z_STREAM_END) && (len = read(fd, in, size)) > 0) {
+        zs.next_in = in;
+        zs.avail_in = len;
+        while (zs.avail_in && (r == Z_OK || r == Z_STREAM_END)) {
+            // a new member follows the one that just ended
+            if (r == Z_STREAM_END) {
+                inflateReset(&zs);
+            }
+            zs.next_out = out;
+            zs.avail_out = size;
+            r = inflate(&zs, Z_NO_FLUSH);
+        }
+    }
+    inflateEnd(&zs);
+    free(in);
+    free(out);
+    close(fd);
+    return r == Z_STREAM_END ? 0 : -1;
+}
+
+/*
+ * Adds to current progress; INFO_LINE is refreshed at most once every CHECK_PROGRESS_MS.
+ */
+static void add_progress(unsigned long members, unsigned long bytes) {
+    struct timespec now;
+    
+    atomic_fetch_add(&members_done, members);
+    atomic_fetch_add(&bytes_done, bytes);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&report_lck);
+    if ((now.tv_sec - last_report.tv_sec) * 1000 + (now.tv_nsec - last_report.tv_nsec) / 1000000 >= CHECK_PROGRESS_MS) {
+        last_report = now;
+        print_info(NULL, INFO_LINE);
+    }
+    pthread_mutex_unlock(&report_lck);
+}
+
+/*
+ * Fixed width fields, as INFO_LINE is only cleared when a new message is printed.
+ */
+void get_check_progress(char *str, size_t len) {
+    char size[20];
+    
+    change_unit(atomic_load(&bytes_done), size);
+    snprintf(str, len, " %d/%d, %8lu members, %10s", atomic_load(&archives_done) + atomic_load(&archives_failed),
+             thread_h->num_selected, atomic_load(&members_done), size);
+}
@@ -0,0 +1,647 @@
+#include "../inc/archive_dedup.h"
+
+static int open_store(const char *archive_path, int write);
+static int load_store(void);
+static int dedup_walk(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf);
+static int store_file(const char *path, uint64_t *size);
+static size_t find_cut(const unsigned char *p, size_t len);
+static int store_chunk(const unsigned char *data, size_t len);
+static int write_entry(const char *name, const struct stat *sb, uint64_t size, const char *link);
+static void free_dedup(void);
+static int restore_entries(struct dedup_reader *r, int dirs_pass);
+static int read_entry(struct dedup_reader *r, struct dedup_entry *e);
+static int has_dotdot(const char *name);
+static int open_parent(int dir_fd, char *path, const char **base);
+static int restore_dir(int dir_fd, const char *base, const struct dedup_entry *e);
+static int restore_file(struct dedup_reader *r, const struct dedup_entry *e, int dir_fd, const char *base);
+static int read_chunk(struct dedup_reader *r, const unsigned char *ref, size_t *len);
+static uint64_t index_get(const struct dedup_index *idx, const unsigned char *hash);
+static int index_put(struct dedup_index *idx, const unsigned char *hash, uint64_t offset);
+static void init_gear(void);
+
+static struct dedup dd;
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Deduplicated archive: files are cut in chunks at content defined boundaries, so that
+ * an insertion only changes the chunks around it; each chunk is identified by its sha256.
+ * New chunks are deflated and appended to the store shared by every deduplicated archive
+ * in the same dir: archiving the same tree again only stores what changed.
+ * Archive itself only lists entries and the chunks they are made of.
+ */
+int create_dedup_archive(void) {
+    char path[PATH_MAX + 1] = {0}, size[20];
+    unsigned char end[DEDUP_ENTRY_HDR] = {0};
+    int ret = -1;
+    
+    memset(&dd, 0, sizeof(struct dedup));
+    dd.store_fd = -1;
+    pthread_once(&gear_once, init_gear);
+    dd.zbuf_len = compressBound(DEDUP_MAX_CHUNK);
+    if (!(dd.buf = malloc(DEDUP_READ_LEN)) || !(dd.zbuf = malloc(dd.zbuf_len))) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        goto end;
+    }
+    if ((dd.store_fd = open_store(thread_h->full_path, 1)) == -1 || load_store() == -1) {
+        goto end;
+    }
+    if (!(dd.out = fopen(thread_h->full_path, "wxe")) || fstat(fileno(dd.out), &dd.archive_sb) == -1 ||
+        fwrite(DEDUP_MAGIC, DEDUP_MAGIC_LEN, 1, dd.out) != 1) {
+        goto end;
+    }
+    for (int i = 0; i < thread_h->num_selected; i++) {
+        strncpy(path, thread_h->selected_files[i], PATH_MAX);
+        dd.distance_from_root = strlen(dirname(path));
+        if (nftw(thread_h->selected_files[i], dedup_walk, 64, FTW_MOUNT | FTW_PHYS) != 0) {
+            goto end;
+        }
+    }
+    // end record: an entry with mode 0, whose size is the number of entries
+    put64(end + 24, dd.num_entries);
+    if (fwrite(end, DEDUP_ENTRY_HDR, 1, dd.out) != 1) {
+        goto end;
+    }
+    // chunks must be on disk before the archive pointing to them
+    if (fdatasync(dd.store_fd) == 0 && fflush(dd.out) == 0) {
+        ret = 0;
+    }
+
+end:
+    if (dd.out) {
+        if (fclose(dd.out) == EOF) {
+            ret = -1;
+        }
+        if (ret) {
+            unlink(thread_h->full_path);
+        }
+    }
+    if (!ret) {
+        change_unit(dd.new_bytes, size);
+        snprintf(thread_h->result, sizeof(thread_h->result), _(dedup_result),
+                 dd.new_chunks, dd.new_chunks + dd.old_chunks, size);
+    }
+    free_dedup();
+    return ret;
+}
+
+/*
+ * Opens the chunk store in the same dir of archive_path, locked:
+ * shared to read, exclusive to write. It is created only to write.
+ */
+static int open_store(const char *archive_path, int write) {
+    char dir[PATH_MAX + 1] = {0}, store[PATH_MAX + 1] = {0};
+    int fd;
+    
+    strncpy(dir, archive_path, PATH_MAX);
+    snprintf(store, PATH_MAX, "%s/%s", dirname(dir), DEDUP_STORE);
+    if ((fd = open(store, write ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644)) == -1) {
+        ERROR("could not open chunk store.");
+        return -1;
+    }
+    if (flock(fd, write ? LOCK_EX : LOCK_SH) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Indexes every chunk in store reading only chunk headers;
+ * a chunk left incomplete by an interrupted job is cut away.
+ */
+static int load_store(void) {
+    unsigned char hdr[DEDUP_CHUNK_HDR];
+    off_t off = DEDUP_MAGIC_LEN;
+    
+    if (fstat(dd.store_fd, &dd.store_sb) == -1) {
+        return -1;
+    }
+    if (dd.store_sb.st_size == 0) {
+        dd.store_size = DEDUP_MAGIC_LEN;
+        return write_all(dd.store_fd, DEDUP_STORE_MAGIC, DEDUP_MAGIC_LEN);
+    }
+    if (dd.store_sb.st_size < DEDUP_MAGIC_LEN || read_all(dd.store_fd, hdr, DEDUP_MAGIC_LEN, 0) == -1 ||
+        memcmp(hdr, DEDUP_STORE_MAGIC, DEDUP_MAGIC_LEN)) {
+        ERROR("wrong chunk store.");
+        return -1;
+    }
+    while (off + DEDUP_CHUNK_HDR <= dd.store_sb.st_size && read_all(dd.store_fd, hdr, DEDUP_CHUNK_HDR, off) == 0) {
+        off_t next = off + DEDUP_CHUNK_HDR + get32(hdr + SHA256_LEN);
+        
+        if (next > dd.store_sb.st_size) {
+            break;
+        }
+        if (index_put(&dd.idx, hdr, off) == -1) {
+            return -1;
+        }
+        off = next;
+    }
+    if (off < dd.store_sb.st_size && ftruncate(dd.store_fd, off) == -1) {
+        return -1;
+    }
+    dd.store_size = off;
+    return lseek(dd.store_fd, off, SEEK_SET) == -1 ? -1 : 0;
+}
+
+/*
+ * Entry name is path + distance_from_root + 1, as for other archives (see archiver_func()).
+ * Special files (fifos, devices, sockets) are not archived.
+ */
+static int dedup_walk(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    char link[PATH_MAX + 1] = {0};
+    uint64_t size = 0;
+    
+    if (atomic_load(&thread_h->cancel)) {
+        return 1;
+    }
+    // archive and store may be below a selected dir
+    if ((sb->st_dev == dd.archive_sb.st_dev && sb->st_ino == dd.archive_sb.st_ino) ||
+        (sb->st_dev == dd.store_sb.st_dev && sb->st_ino == dd.store_sb.st_ino)) {
+        return 0;
+    }
+    dd.refs.len = 0;
+    if (S_ISREG(sb->st_mode)) {
+        if (store_file(path, &size) == -1) {
+            ERROR(path);
+            return 1;
+        }
+    } else if (S_ISLNK(sb->st_mode)) {
+        if (readlink(path, link, PATH_MAX) == -1) {
+            ERROR(path);
+            return 1;
+        }
+    } else if (!S_ISDIR(sb->st_mode)) {
+        WARN(path);
+        return 0;
+    }
+    return write_entry(path + dd.distance_from_root + 1, sb, size, link) == -1;
+}
+
+/*
+ * File is read DEDUP_READ_LEN bytes at a time: a chunk is cut only while at least
+ * DEDUP_MAX_CHUNK bytes are buffered (or the file is over), so that cut points
+ * only depend on file's content.
+ */
+static int store_file(const char *path, uint64_t *size) {
+    size_t len = 0, pos, cut;
+    ssize_t n;
+    int fd, eof = 0, ret = 0;
+    
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (!ret && (len || !eof)) {
+        while (!eof && len < DEDUP_READ_LEN) {
+            if ((n = read(fd, dd.buf + len, DEDUP_READ_LEN - len)) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ret = -1;
+                break;
+            }
+            eof = n == 0;
+            len += n;
+        }
+        for (pos = 0; !ret && pos < len && (eof || len - pos >= DEDUP_MAX_CHUNK); pos += cut) {
+            cut = find_cut(dd.buf + pos, len - pos);
+            ret = store_chunk(dd.buf + pos, cut);
+            *size += cut;
+        }
+        memmove(dd.buf, dd.buf + pos, len - pos);
+        len -= pos;
+        if (atomic_load(&thread_h->cancel)) {
+            ret = -1;
+        }
+    }
+    close(fd);
+    return ret;
+}
+
+/*
+ * FastCDC-like cut point search with a gear rolling hash: one shift and one add per byte.
+ * Nothing is hashed below DEDUP_MIN_CHUNK.
+ */
+static size_t find_cut(const unsigned char *p, size_t len) {
+    uint64_t fp = 0;
+    size_t i = DEDUP_MIN_CHUNK, normal;
+    
+    if (len <= DEDUP_MIN_CHUNK) {
+        return len;
+    }
+    if (len > DEDUP_MAX_CHUNK) {
+        len = DEDUP_MAX_CHUNK;
+    }
+    normal = len < DEDUP_AVG_CHUNK ? len : DEDUP_AVG_CHUNK;
+    for (; i < normal; i++) {
+        fp = (fp << 1) + gear[p[i]];
+        if (!(fp & DEDUP_MASK_HARD)) {
+            return i + 1;
+        }
+    }
+    for (; i < len; i++) {
+        fp = (fp << 1) + gear[p[i]];
+        if (!(fp & DEDUP_MASK_EASY)) {
+            return i + 1;
+        }
+    }
+    return len;
+}
+
+/*
+ * Appends chunk to store unless it is already there; then adds its reference
+ * to current entry's ones. Incompressible chunks are stored as they are.
+ */
+static int store_chunk(const unsigned char *data, size_t len) {
+    unsigned char ref[DEDUP_REF_LEN], hdr[DEDUP_CHUNK_HDR];
+    int level = config.archive_level >= 0 ? config.archive_level : Z_DEFAULT_COMPRESSION;
+    uLongf zlen = dd.zbuf_len;
+    uint64_t off;
+    
+    sha256(data, len, ref);
+    if ((off = index_get(&dd.idx, ref))) {
+        dd.old_chunks++;
+    } else {
+        const unsigned char *stored = data;
+        size_t stored_len = len;
+        
+        if (compress2(dd.zbuf, &zlen, data, len, level) == Z_OK && zlen < len) {
+            stored = dd.zbuf;
+            stored_len = zlen;
+        }
+        memcpy(hdr, ref, SHA256_LEN);
+        put32(hdr + SHA256_LEN, stored_len);
+        put32(hdr + SHA256_LEN + 4, len);
+        if (write_all(dd.store_fd, hdr, DEDUP_CHUNK_HDR) == -1 || write_all(dd.store_fd, stored, stored_len) == -1 ||
+            index_put(&dd.idx, ref, dd.store_size) == -1) {
+            return -1;
+        }
+        off = dd.store_size;
+        dd.store_size += DEDUP_CHUNK_HDR + stored_len;
+        dd.new_bytes += DEDUP_CHUNK_HDR + stored_len;
+        dd.new_chunks++;
+    }
+    put64(ref + SHA256_LEN, off);
+    return buf_add(&dd.refs, ref, DEDUP_REF_LEN);
+}
+
+static int write_entry(const char *name, const struct stat *sb, uint64_t size, const char *link) {
+    unsigned char hdr[DEDUP_ENTRY_HDR];
+    size_t name_len = strlen(name), link_len = strlen(link);
+    
+    put32(hdr, sb->st_mode);
+    put32(hdr + 4, name_len);
+    put32(hdr + 8, link_len);
+    put32(hdr + 12, dd.refs.len / DEDUP_REF_LEN);
+    put64(hdr + 16, sb->st_mtime);
+    put64(hdr + 24, size);
+    dd.num_entries++;
+    if (fwrite(hdr, DEDUP_ENTRY_HDR, 1, dd.out) != 1 || fwrite(name, 1, name_len, dd.out) != name_len ||
+        fwrite(link, 1, link_len, dd.out) != link_len ||
+        (dd.refs.len && fwrite(dd.refs.data, 1, dd.refs.len, dd.out) != dd.refs.len)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void free_dedup(void) {
+    if (dd.store_fd != -1) {
+        // releases store lock too
+        close(dd.store_fd);
+    }
+    free(dd.idx.slots);
+    free(dd.buf);
+    free(dd.zbuf);
+    free(dd.refs.data);
+}
+
+/*
+ * Extracts a deduplicated archive in its own dir, reading its chunks from the store there;
+ * every chunk is checked against its sha256. Top level names that already exist
+ * are renamed as for other archives (see map_entry_name()).
+ * Entries are only created below that dir (see restore_entries()).
+ * Entries are extracted in a first pass; dirs get their perms and times in a second one,
+ * once nothing else has to be written inside them.
+ */
+int extract_dedup_archive(const char *path, const atomic_int *cancel) {
+    char dir[PATH_MAX + 1] = {0}, magic[DEDUP_MAGIC_LEN];
+    struct extract_ctx ctx = {0};
+    struct dedup_reader r = {0};
+    int ret = -1;
+    
+    strncpy(dir, path, PATH_MAX);
+    ctx.archive_path = path;
+    ctx.current_dir = dirname(dir);
+    ctx.last_header = -1;
+    ctx.cancel = cancel;
+    r.ctx = &ctx;
+    r.store_fd = -1;
+    r.dir_fd = -1;
+    if (!(ctx.top_names = strmap_new(0)) || !(r.raw = malloc(DEDUP_MAX_CHUNK)) || !(r.stored = malloc(DEDUP_MAX_CHUNK))) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        goto end;
+    }
+    if (!(r.in = fopen(path, "re")) || fread(magic, DEDUP_MAGIC_LEN, 1, r.in) != 1 ||
+        memcmp(magic, DEDUP_MAGIC, DEDUP_MAGIC_LEN) || (r.store_fd = open_store(path, 0)) == -1 ||
+        (r.dir_fd = open(ctx.current_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        goto end;
+    }
+    ret = restore_entries(&r, 0);
+    if (!atomic_load(cancel) && fseek(r.in, DEDUP_MAGIC_LEN, SEEK_SET) == 0 && restore_entries(&r, 1) == -1) {
+        ret = -1;
+    }
+
+end:
+    if (r.in) {
+        fclose(r.in);
+    }
+    if (r.store_fd != -1) {
+        close(r.store_fd);
+    }
+    if (r.dir_fd != -1) {
+        close(r.dir_fd);
+    }
+    free(r.raw);
+    free(r.stored);
+    strmap_free(ctx.top_names, free);
+    return ret;
+}
+
+/*
+ * Reads every entry of the archive. In first pass, entries are extracted; an entry
+ * that cannot be extracted is reported and removed, then next ones are extracted anyway.
+ * In dirs pass, only perms and times of dirs are restored.
+ * Entries are created relative to r->dir_fd without following any symlink,
+ * not even one extracted before (see open_parent()): names with a ".." component are refused.
+ */
+static int restore_entries(struct dedup_reader *r, int dirs_pass) {
+    char fullpath[PATH_MAX + 1] = {0};
+    const char *base = NULL;
+    struct dedup_entry e;
+    struct timespec times[2] = {{0}};
+    size_t dir_len = strlen(r->ctx->current_dir);
+    int ret = 0, res = -1, num = 0, fd;
+    
+    if (atomic_load(r->ctx->cancel)) {
+        return -1;
+    }
+    while (!atomic_load(r->ctx->cancel) && (res = read_entry(r, &e)) == 0) {
+        num++;
+        if (has_dotdot(e.name)) {
+            // reported as it is
+            strncpy(fullpath, e.name, PATH_MAX);
+            fd = -1;
+        } else if (!map_entry_name(r->ctx, e.name, fullpath)) {
+            return -1;
+        } else {
+            // fullpath is current_dir itself or something below it
+            fd = open_parent(r->dir_fd, fullpath + dir_len, &base);
+        }
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1].tv_sec = e.mtime;
+        if (S_ISREG(e.mode) && !dirs_pass) {
+            res = restore_file(r, &e, fd, base);
+        } else {
+            if (fseek(r->in, (long)e.num_chunks * DEDUP_REF_LEN, SEEK_CUR) == -1) {
+                if (fd != -1) {
+                    close(fd);
+                }
+                return -1;
+            }
+            if (fd == -1) {
+                // already reported in first pass
+                res = !dirs_pass;
+            } else if (dirs_pass) {
+                res = S_ISDIR(e.mode) && restore_dir(fd, base, &e) == -1;
+            } else if (S_ISDIR(e.mode)) {
+                res = mkdirat(fd, base, 0700) == -1 && errno != EEXIST;
+            } else if (S_ISLNK(e.mode)) {
+                res = symlinkat(e.link, fd, base) == -1 || utimensat(fd, base, times, AT_SYMLINK_NOFOLLOW) == -1;
+            }
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+        if (res) {
+            ERROR(fullpath);
+            ret = -1;
+        }
+    }
+    if (atomic_load(r->ctx->cancel)) {
+        return -1;
+    }
+    // end record holds the number of entries: a truncated archive has none
+    if (res != 1 || e.size != num) {
+        if (!dirs_pass) {
+            ERROR("archive is truncated or corrupted.");
+        }
+        return -1;
+    }
+    return ret;
+}
+
+static int has_dotdot(const char *name) {
+    for (const char *s = name; (s = strstr(s, "..")); s += 2) {
+        if ((s == name || s[-1] == '/') && (s[2] == '\0' || s[2] == '/')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Opens every dir of path (relative to dir_fd) but its last component, whose name
+ * is returned in base, with O_NOFOLLOW: a symlink inside path makes it fail.
+ * Returns an fd of the parent dir of base, or -1.
+ */
+static int open_parent(int dir_fd, char *path, const char **base) {
+    char *slash;
+    int fd = fcntl(dir_fd, F_DUPFD_CLOEXEC, 0), next;
+    
+    while (*path == '/') {
+        path++;
+    }
+    while (fd != -1 && (slash = strchr(path, '/'))) {
+        *slash = '\0';
+        next = openat(fd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        *slash = '/';
+        close(fd);
+        fd = next;
+        for (path = slash; *path == '/'; path++);
+    }
+    *base = *path ? path : ".";
+    return fd;
+}
+
+static int restore_dir(int dir_fd, const char *base, const struct dedup_entry *e) {
+    struct timespec times[2] = {{0, UTIME_OMIT}, {e->mtime, 0}};
+    int fd, ret = -1;
+    
+    if ((fd = openat(dir_fd, base, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) != -1) {
+        if (!fchmod(fd, e->mode & 07777) && !futimens(fd, times)) {
+            ret = 0;
+        }
+        close(fd);
+    }
+    return ret;
+}
+
+/*
+ * Returns 1 when end record is read, -1 if entry is not valid.
+ */
+static int read_entry(struct dedup_reader *r, struct dedup_entry *e) {
+    unsigned char hdr[DEDUP_ENTRY_HDR];
+    uint32_t name_len, link_len;
+    
+    if (fread(hdr, DEDUP_ENTRY_HDR, 1, r->in) != 1) {
+        return -1;
+    }
+    e->mode = get32(hdr);
+    name_len = get32(hdr + 4);
+    link_len = get32(hdr + 8);
+    e->num_chunks = get32(hdr + 12);
+    e->mtime = get64(hdr + 16);
+    e->size = get64(hdr + 24);
+    if (!e->mode) {
+        return 1;
+    }
+    if (!name_len || name_len > PATH_MAX || link_len > PATH_MAX ||
+        fread(e->name, 1, name_len, r->in) != name_len || fread(e->link, 1, link_len, r->in) != link_len) {
+        return -1;
+    }
+    e->name[name_len] = '\0';
+    e->link[link_len] = '\0';
+    return 0;
+}
+
+/*
+ * Job's cancel flag is checked for every chunk. A file that is not fully
+ * written is removed; its remaining chunk references are skipped.
+ */
+static int restore_file(struct dedup_reader *r, const struct dedup_entry *e, int dir_fd, const char *base) {
+    unsigned char ref[DEDUP_REF_LEN];
+    struct timespec times[2] = {{0, UTIME_OMIT}, {e->mtime, 0}};
+    uint32_t i = 0;
+    size_t len;
+    int fd, ret = -1;
+    
+    if (dir_fd != -1 && (fd = openat(dir_fd, base, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600)) != -1) {
+        for (; i < e->num_chunks && !atomic_load(r->ctx->cancel); i++) {
+            if (fread(ref, DEDUP_REF_LEN, 1, r->in) != 1 || read_chunk(r, ref, &len) == -1 ||
+                write_all(fd, r->raw, len) == -1) {
+                i++;
+                break;
+            }
+        }
+        if (i == e->num_chunks && !atomic_load(r->ctx->cancel) && !fchmod(fd, e->mode & 07777) && !futimens(fd, times)) {
+            ret = 0;
+        }
+        if (close(fd) == -1 || ret) {
+            unlinkat(dir_fd, base, 0);
+            ret = -1;
+        }
+    }
+    if (i < e->num_chunks && fseek(r->in, (long)(e->num_chunks - i) * DEDUP_REF_LEN, SEEK_CUR) == -1) {
+        return -1;
+    }
+    // cancel is not an error of this file
+    return atomic_load(r->ctx->cancel) ? 0 : ret;
+}
+
+/*
+ * Reads chunk ref points to into r->raw, checking that it is really that chunk.
+ */
+static int read_chunk(struct dedup_reader *r, const unsigned char *ref, size_t *len) {
+    unsigned char hdr[DEDUP_CHUNK_HDR], hash[SHA256_LEN];
+    uint32_t stored_len, raw_len;
+    uLongf out_len;
+    
+    if (read_all(r->store_fd, hdr, DEDUP_CHUNK_HDR, get64(ref + SHA256_LEN)) == -1 || memcmp(hdr, ref, SHA256_LEN)) {
+        return -1;
+    }
+    stored_len = get32(hdr + SHA256_LEN);
+    raw_len = get32(hdr + SHA256_LEN + 4);
+    if (raw_len > DEDUP_MAX_CHUNK || stored_len > raw_len) {
+        return -1;
+    }
+    if (stored_len == raw_len) {
+        if (read_all(r->store_fd, r->raw, raw_len, get64(ref + SHA256_LEN) + DEDUP_CHUNK_HDR) == -1) {
+            return -1;
+        }
+    } else {
+        out_len = raw_len;
+        if (read_all(r->store_fd, r->stored, stored_len, get64(ref + SHA256_LEN) + DEDUP_CHUNK_HDR) == -1 ||
+            uncompress(r->raw, &out_len, r->stored, stored_len) != Z_OK || out_len != raw_len) {
+            return -1;
+        }
+    }
+    sha256(r->raw, raw_len, hash);
+    if (memcmp(hash, ref, SHA256_LEN)) {
+        return -1;
+    }
+    *len = raw_len;
+    return 0;
+}
+
+/*
+ * Hashes are already uniformly distributed: their first 8 bytes are the slot.
+ * Returns 0 if hash is not in idx.
+ */
+static uint64_t index_get(const struct dedup_index *idx, const unsigned char *hash) {
+    if (!idx->cap) {
+        return 0;
+    }
+    for (size_t i = get64(hash) & (idx->cap - 1); idx->slots[i].offset; i = (i + 1) & (idx->cap - 1)) {
+        if (!memcmp(idx->slots[i].hash, hash, SHA256_LEN)) {
+            return idx->slots[i].offset;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Table is doubled whenever it gets 3/4 full.
+ */
+static int index_put(struct dedup_index *idx, const unsigned char *hash, uint64_t offset) {
+    size_t i;
+    
+    if (4 * (idx->num + 1) > 3 * idx->cap) {
+        struct dedup_index bigger = {0};
+        
+        bigger.cap = idx->cap ? idx->cap * 2 : 4096;
+        if (!(bigger.slots = calloc(bigger.cap, sizeof(struct dedup_slot)))) {
+            return -1;
+        }
+        for (i = 0; i < idx->cap; i++) {
+            if (idx->slots[i].offset) {
+                index_put(&bigger, idx->slots[i].hash, idx->slots[i].offset);
+            }
+        }
+        free(idx->slots);
+        *idx = bigger;
+    }
+    for (i = get64(hash) & (idx->cap - 1); idx->slots[i].offset; i = (i + 1) & (idx->cap - 1));
+    memcpy(idx->slots[i].hash, hash, SHA256_LEN);
+    idx->slots[i].offset = offset;
+    idx->num++;
+    return 0;
+}
+
+/*
+ * Gear table must be the same for every archive, or no chunk would ever match:
+ * it is generated with splitmix64 from a fixed seed.
+ */
+static void init_gear(void) {
+    uint64_t x = 0x6e637572736573ull;
+    
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+        
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        gear[i] = z ^ (z >> 31);
+    }
+}
@@ -0,0 +1,386 @@
+#include "../inc/archive_index.h"
+
+static struct arch_index *lookup_index(const char *path, const struct stat *sb, int depth);
+static void evict_lru(void);
+static struct arch_index *build_index(const char *path, const struct stat *sb, int depth, const atomic_int *cancel,
+                                      void (*progress)(int64_t, void *), void *data);
+static int index_archive(struct archive *a, const char *prefix, int depth, int max_depth, struct arch_index *idx,
+                         const atomic_int *cancel, void (*progress)(int64_t, void *), void *data);
+static size_t index_block_size(const char *path, off_t size);
+static int is_cancelled(const atomic_int *cancel);
+static int add_entry(struct arch_index *idx, const char *name, struct archive_entry *entry, int depth);
+static la_ssize_t nested_read(struct archive *a, void *client_data, const void **buff);
+static void free_index(struct arch_index *idx);
+
+/*
+ * Source for nested archives: blocks of the outer archive's current member are handed
+ * to the inner archive as they are, without copying them.
+ * pos is the offset inside the member already returned: a block starting after it
+ * follows a hole of a sparse member.
+ */
+struct nested_src {
+    struct archive *outer;
+    const atomic_int *cancel;
+    const void *block;
+    size_t block_len;
+    la_int64_t block_off;
+    la_int64_t pos;
+};
+
+static struct arch_index *cache;
+static int num_cached;
+static pthread_mutex_t cache_lck = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Returns an index for path, built descending up to depth nested archives.
+ * A cached index is reused when path, size and mtime still match and it was built with
+ * at least the requested depth; otherwise archive headers are read (no data is decompressed
+ * except for nested archives) and the new index replaces the old one in cache.
+ * If cancel is not NULL and it gets set while building, the index is dropped and NULL is returned.
+ * Caller must release the returned index with arch_index_put().
+ */
+struct arch_index *arch_index_get(const char *path, int depth, const atomic_int *cancel) {
+    return arch_index_get_progress(path, depth, cancel, NULL, NULL);
+}
+
+/*
+ * Same as arch_index_get(), but if the index is built, progress (if not NULL) is called
+ * with data for each top level member, with its size, as soon as its header is read.
+ */
+struct arch_index *arch_index_get_progress(const char *path, int depth, const atomic_int *cancel,
+                                           void (*progress)(int64_t, void *), void *data) {
+    struct stat sb;
+    struct arch_index *idx;
+    
+    if (stat(path, &sb) == -1) {
+        return NULL;
+    }
+    if ((idx = lookup_index(path, &sb, depth))) {
+        return idx;
+    }
+    if (!(idx = build_index(path, &sb, depth, cancel, progress, data))) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&cache_lck);
+    // drop any stale index for same path, and least recently used one if cache is full
+    struct arch_index **tmp = &cache;
+    while (*tmp) {
+        struct arch_index *old = *tmp;
+        if (!strcmp(old->path, path)) {
+            *tmp = old->next;
+            num_cached--;
+            if (--old->refs == 0) {
+                free_index(old);
+            }
+            continue;
+        }
+        tmp = &old->next;
+    }
+    if (num_cached >= MAX_CACHED_ARCHIVES) {
+        evict_lru();
+    }
+    // one ref is owned by the cache itself, the other one by caller
+    idx->refs = 2;
+    idx->next = cache;
+    cache = idx;
+    num_cached++;
+    pthread_mutex_unlock(&cache_lck);
+    return idx;
+}
+
+/*
+ * Same as arch_index_get(), but an index is never built: NULL is returned
+ * if path has no up to date index in cache.
+ */
+struct arch_index *arch_index_cached(const char *path) {
+    struct stat sb;
+    
+    if (stat(path, &sb) == -1) {
+        return NULL;
+    }
+    return lookup_index(path, &sb, 0);
+}
+
+static struct arch_index *lookup_index(const char *path, const struct stat *sb, int depth) {
+    struct arch_index *idx, *prev = NULL;
+    
+    pthread_mutex_lock(&cache_lck);
+    for (idx = cache; idx; prev = idx, idx = idx->next) {
+        if (!strcmp(idx->path, path)) {
+            if (idx->size == sb->st_size && idx->mtime == sb->st_mtime && idx->depth >= depth) {
+                // move it to the head of the list: the tail is the least recently used index
+                if (prev) {
+                    prev->next = idx->next;
+                    idx->next = cache;
+                    cache = idx;
+                }
+                idx->refs++;
+                pthread_mutex_unlock(&cache_lck);
+                return idx;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_lck);
+    return NULL;
+}
+
+/*
+ * Cache may have grown past its limit while all of its indexes were in use:
+ * it shrinks back as soon as one of them is released.
+ */
+void arch_index_put(struct arch_index *idx) {
+    if (!idx) {
+        return;
+    }
+    pthread_mutex_lock(&cache_lck);
+    if (--idx->refs == 0) {
+        free_index(idx);
+    } else if (num_cached > MAX_CACHED_ARCHIVES) {
+        evict_lru();
+    }
+    pthread_mutex_unlock(&cache_lck);
+}
+
+/*
+ * Drops least recently used index among the ones only referenced by cache, if any.
+ * Must be called with cache_lck held.
+ */
+static void evict_lru(void) {
+    struct arch_index **lru_ptr = NULL;
+    
+    for (struct arch_index **tmp = &cache; *tmp; tmp = &(*tmp)->next) {
+        if ((*tmp)->refs == 1) {
+            lru_ptr = tmp;
+        }
+    }
+    if (lru_ptr) {
+        struct arch_index *lru = *lru_ptr;
+        
+        *lru_ptr = lru->next;
+        num_cached--;
+        free_index(lru);
+    }
+}
+
+void free_arch_index_cache(void) {
+    pthread_mutex_lock(&cache_lck);
+    while (cache) {
+        struct arch_index *tmp = cache;
+        
+        cache = cache->next;
+        if (--tmp->refs == 0) {
+            free_index(tmp);
+        }
+    }
+    num_cached = 0;
+    pthread_mutex_unlock(&cache_lck);
+}
+
+/*
+ * Writes in out (PATH_MAX + 1 chars) name without leading "./" and "/",
+ * and without trailing "/" of dir entries, so that names of same file compare equal.
+ */
+void arch_norm_name(const char *name, char *out) {
+    int len;
+    
+    while (*name == '/' || !strncmp(name, "./", 2)) {
+        name += *name == '/' ? 1 : 2;
+    }
+    strncpy(out, name, PATH_MAX);
+    out[PATH_MAX] = '\0';
+    len = strlen(out);
+    while (len && out[len - 1] == '/') {
+        out[--len] = '\0';
+    }
+}
+
+static struct arch_index *build_index(const char *path, const struct stat *sb, int depth, const atomic_int *cancel,
+                                      void (*progress)(int64_t, void *), void *data) {
+    struct arch_index *idx;
+    struct archive *a;
+    
+    if (!(idx = calloc(1, sizeof(struct arch_index)))) {
+        ERROR("could not malloc.");
+        return NULL;
+    }
+    strncpy(idx->path, path, PATH_MAX);
+    idx->size = sb->st_size;
+    idx->mtime = sb->st_mtime;
+    idx->depth = depth;
+    a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_all(a);
+    if (archive_read_open_filename(a, path, index_block_size(path, sb->st_size)) != ARCHIVE_OK ||
+        index_archive(a, "", 0, depth, idx, cancel, progress, data) == -1) {
+        archive_read_free(a);
+        free_index(idx);
+        return NULL;
+    }
+    archive_read_free(a);
+    // names pool won't be reallocated anymore: fix entries' name pointers
+    for (int i = 0; i < idx->num_entries; i++) {
+        idx->entries[i].name = idx->names + (size_t)idx->entries[i].name;
+    }
+    return idx;
+}
+
+/*
+ * Zip and 7z headers are found through the central directory at archive's end:
+ * libarchive seeks to each of them, so only a page is read each time
+ * instead of a big block (a 2GB zip is listed reading only its headers).
+ * Other formats are read sequentially.
+ */
+static size_t index_block_size(const char *path, off_t size) {
+    const unsigned char zip_magic[] = {'P', 'K', 3, 4}, sz_magic[] = {'7', 'z', 0xBC, 0xAF};
+    unsigned char magic[4] = {0};
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) != -1) {
+        int len = read(fd, magic, sizeof(magic));
+
+        close(fd);
+        if (len == sizeof(magic) && (!memcmp(magic, zip_magic, len) || !memcmp(magic, sz_magic, len))) {
+            return IO_BUF_ALIGN;
+        }
+    }
+    return io_block_size(size);
+}
+
+/*
+ * Reads every header of a, adding an entry for each of them.
+ * If a member is an archive itself and max_depth is not reached yet,
+ * it is opened straight from a's data stream and indexed with "member/" prefix;
+ * if it cannot be fully read, its members are dropped and it is listed as a plain file.
+ * Returns -1 on error, if archive's end was not reached or if it was cancelled,
+ * as the index would be incomplete. Members of nested archives are not reported to progress.
+ */
+static int index_archive(struct archive *a, const char *prefix, int depth, int max_depth, struct arch_index *idx,
+                         const atomic_int *cancel, void (*progress)(int64_t, void *), void *data) {
+    struct archive_entry *entry;
+    char name[PATH_MAX + 1] = {0};
+    int r;
+    
+    while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN) {
+        if (is_cancelled(cancel)) {
+            return -1;
+        }
+        snprintf(name, PATH_MAX, "%s%s", prefix, archive_entry_pathname(entry));
+        if (add_entry(idx, name, entry, depth) == -1) {
+            return -1;
+        }
+        if (progress) {
+            progress(archive_entry_size(entry), data);
+        }
+        if (depth < max_depth && S_ISREG(archive_entry_mode(entry)) && is_ext(name, arch_ext, NUM(arch_ext))) {
+            struct nested_src *src = malloc(sizeof(struct nested_src));
+            struct archive *inner = archive_read_new();
+            
+            if (!src) {
+                archive_read_free(inner);
+                return -1;
+            }
+            memset(src, 0, sizeof(struct nested_src));
+            src->outer = a;
+            src->cancel = cancel;
+            archive_read_support_filter_all(inner);
+            archive_read_support_format_all(inner);
+            if (archive_read_open(inner, src, NULL, nested_read, NULL) == ARCHIVE_OK) {
+                char nested_prefix[PATH_MAX + 1] = {0};
+                int num_entries = idx->num_entries;
+                size_t names_len = idx->names_len;
+                
+                snprintf(nested_prefix, PATH_MAX, "%s/", name);
+                if (index_archive(inner, nested_prefix, depth + 1, max_depth, idx, cancel, NULL, NULL) == -1) {
+                    idx->num_entries = num_entries;
+                    idx->names_len = names_len;
+                }
+            }
+            archive_read_free(inner);
+            free(src);
+        }
+    }
+    return is_cancelled(cancel) || r != ARCHIVE_EOF ? -1 : 0;
+}
+
+static int is_cancelled(const atomic_int *cancel) {
+    return quit || (cancel && atomic_load(cancel));
+}
+
+/*
+ * Appends an entry to idx. Names are stored as offsets inside names pool
+ * until the index is complete, as the pool can be reallocated.
+ */
+static int add_entry(struct arch_index *idx, const char *name, struct archive_entry *entry, int depth) {
+    size_t len = strlen(name) + 1;
+    
+    if (idx->num_entries == idx->entries_cap) {
+        int cap = idx->entries_cap ? idx->entries_cap * 2 : 64;
+        void *tmp = realloc(idx->entries, cap * sizeof(struct arch_entry));
+        if (!tmp) {
+            ERROR("could not realloc.");
+            return -1;
+        }
+        idx->entries = tmp;
+        idx->entries_cap = cap;
+    }
+    if (idx->names_len + len > idx->names_cap) {
+        size_t cap = (idx->names_len + len) * 2;
+        char *tmp = realloc(idx->names, cap);
+        if (!tmp) {
+            ERROR("could not realloc.");
+            return -1;
+        }
+        idx->names = tmp;
+        idx->names_cap = cap;
+    }
+    memcpy(idx->names + idx->names_len, name, len);
+    idx->entries[idx->num_entries] = (struct arch_entry) {
+        .name = (char *)idx->names_len,
+        .size = archive_entry_size(entry),
+        .mtime = archive_entry_mtime(entry),
+        .mode = archive_entry_mode(entry),
+        .depth = depth,
+    };
+    idx->names_len += len;
+    idx->num_entries++;
+    return 0;
+}
+
+static la_ssize_t nested_read(struct archive *a, void *client_data, const void **buff) {
+    static const char zeroes[BUFF_SIZE];
+    struct nested_src *src = (struct nested_src *)client_data;
+    size_t len;
+    
+    if (is_cancelled(src->cancel)) {
+        return -1;
+    }
+    while (!src->block_len) {
+        int ret = archive_read_data_block(src->outer, &src->block, &src->block_len, &src->block_off);
+        
+        if (ret == ARCHIVE_EOF) {
+            return 0;
+        }
+        if (ret != ARCHIVE_OK && ret != ARCHIVE_WARN) {
+            return -1;
+        }
+    }
+    // holes of sparse members are not returned as blocks: fill them with zeroes
+    if (src->block_off > src->pos) {
+        len = src->block_off - src->pos < (la_int64_t)sizeof(zeroes) ? src->block_off - src->pos : sizeof(zeroes);
+        *buff = zeroes;
+    } else {
+        len = src->block_len;
+        *buff = src->block;
+        src->block_len = 0;
+    }
+    src->pos += len;
+    return len;
+}
+
+static void free_index(struct arch_index *idx) {
+    free(idx->entries);
+    free(idx->names);
+    free(idx);
+}
@@ -0,0 +1,830 @@
+#include "../inc/archive_update.h"
+
+static int find_changes(const struct arch_index *idx);
+static int collect_file(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf);
+static int is_unchanged(const struct arch_entry *e, const struct stat *sb);
+static int is_replaced(const char *name);
+static int is_replaced_rec(const struct zip_rec *r);
+static int raw_format(const char *path);
+static int update_tar(int in_fd, int out_fd);
+static int update_zip(int in_fd, int out_fd);
+static int rewrite_archive(int out_fd);
+static struct archive *open_new_entries(struct upd_out *o, int fd, off_t pos, const char *ext, int block);
+static int write_new_entries(struct archive *w);
+static int write_file_entry(struct archive *w, const struct pipe_file *f);
+static la_ssize_t upd_write(struct archive *a, void *client_data, const void *buff, size_t len);
+static int read_zip_cd(int fd, off_t size, struct zip_cd *cd);
+static int parse_zip_recs(const unsigned char *data, uint64_t len, struct zip_rec **recs, int *num);
+static void read_zip64_extra(struct zip_rec *r);
+static struct zip_member *sort_zip_members(const struct zip_cd *cd);
+static int cmp_members(const void *a, const void *b);
+static int add_zip_rec(struct byte_buf *b, const struct zip_rec *r, uint64_t offset);
+static int add_zip_eocd(struct byte_buf *b, uint64_t num, uint64_t cd_offset, uint64_t cd_size, const struct zip_cd *old);
+static void free_zip_cd(struct zip_cd *cd);
+static int copy_range(int in_fd, off_t off, off_t len, int out_fd);
+static int replace_archive(int out_fd, const char *tmp);
+
+static struct update upd;
+
+/*
+ * Adds selected files to the archive at thread_h->full_path, replacing its members
+ * whose size or mtime changed; unchanged ones are left alone.
+ * A new archive is written next to the old one, then renamed over it (see replace_archive()).
+ * Members of uncompressed tars and zips are copied as they are, with copy_file_range:
+ * nothing is decompressed nor recompressed, and filesystems supporting reflinks just share blocks.
+ * Compressed tars are a single compressed stream: they are rewritten whole.
+ */
+int update_archive(void) {
+    char tmp[PATH_MAX + 1] = {0};
+    struct arch_index *idx;
+    int in_fd = -1, out_fd = -1, ret = -1;
+    
+    memset(&upd, 0, sizeof(struct update));
+    if (stat(thread_h->full_path, &upd.archive_sb) == -1 || !(idx = arch_index_get(thread_h->full_path, 0, NULL))) {
+        return -1;
+    }
+    if (!(upd.replaced = strmap_new(0)) || find_changes(idx) == -1) {
+        goto end;
+    }
+    if (!upd.num_changed) {
+        INFO("archive is already up to date.");
+        ret = 0;
+        goto end;
+    }
+    snprintf(tmp, PATH_MAX, "%s.XXXXXX", thread_h->full_path);
+    if ((in_fd = open(thread_h->full_path, O_RDONLY | O_CLOEXEC)) == -1 || (out_fd = mkostemp(tmp, O_CLOEXEC)) == -1) {
+        goto end;
+    }
+    switch (raw_format(thread_h->full_path)) {
+    case ARCHIVE_FORMAT_TAR:
+        ret = update_tar(in_fd, out_fd);
+        break;
+    case ARCHIVE_FORMAT_ZIP:
+        // 1 means that its members cannot be copied one by one
+        if ((ret = update_zip(in_fd, out_fd)) != 1) {
+            break;
+        }
+        // fall through
+    default:
+        ret = rewrite_archive(out_fd);
+        break;
+    }
+    if (!ret) {
+        ret = replace_archive(out_fd, tmp);
+    }
+
+end:
+    if (out_fd != -1) {
+        if (close(out_fd) == -1) {
+            ret = -1;
+        }
+        if (ret) {
+            unlink(tmp);
+        }
+    }
+    if (in_fd != -1) {
+        close(in_fd);
+    }
+    arch_index_put(idx);
+    if (upd.replaced) {
+        strmap_free(upd.replaced, NULL);
+    }
+    for (int i = 0; i < upd.num_changed; i++) {
+        free(upd.changed[i]);
+    }
+    free(upd.changed);
+    return ret ? -1 : 0;
+}
+
+/*
+ * Walks selected files (named inside the archive as create_archive() would name them)
+ * comparing them with archive's members. If more members have the same name,
+ * the last one counts, as it is the one that gets extracted.
+ */
+static int find_changes(const struct arch_index *idx) {
+    char path[PATH_MAX + 1] = {0}, name[PATH_MAX + 1];
+    int ret = 0;
+    
+    if (!(upd.old_names = strmap_new(idx->num_entries))) {
+        return -1;
+    }
+    for (int i = 0; i < idx->num_entries && !ret; i++) {
+        // a cached index may list members of nested archives too
+        if (!idx->entries[i].depth) {
+            arch_norm_name(idx->entries[i].name, name);
+            ret = strmap_put(upd.old_names, name, &idx->entries[i]);
+        }
+    }
+    for (int i = 0; i < thread_h->num_selected && !ret; i++) {
+        strncpy(path, thread_h->selected_files[i], PATH_MAX);
+        upd.distance_from_root = strlen(dirname(path));
+        if (nftw(thread_h->selected_files[i], collect_file, 64, FTW_MOUNT | FTW_PHYS) != 0) {
+            ret = -1;
+        }
+    }
+    strmap_free(upd.old_names, NULL);
+    upd.old_names = NULL;
+    return ret;
+}
+
+static int collect_file(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    const char *name = path + upd.distance_from_root + 1;
+    const struct arch_entry *e;
+    struct pipe_file *f;
+    size_t len = strlen(path) + 1;
+    
+    // archive itself may be below a selected dir
+    if (sb->st_dev == upd.archive_sb.st_dev && sb->st_ino == upd.archive_sb.st_ino) {
+        return 0;
+    }
+    if ((e = strmap_get(upd.old_names, name))) {
+        if (is_unchanged(e, sb)) {
+            return 0;
+        }
+        if (strmap_put(upd.replaced, name, (void *)1) == -1) {
+            return 1;
+        }
+    }
+    if (upd.num_changed == upd.changed_cap) {
+        int cap = upd.changed_cap ? upd.changed_cap * 2 : 64;
+        struct pipe_file **tmp = realloc(upd.changed, cap * sizeof(struct pipe_file *));
+        
+        if (!tmp) {
+            return 1;
+        }
+        upd.changed = tmp;
+        upd.changed_cap = cap;
+    }
+    if (!(f = malloc(sizeof(struct pipe_file) + len))) {
+        return 1;
+    }
+    memcpy(f->path, path, len);
+    memcpy(&f->sb, sb, sizeof(struct stat));
+    f->name_offset = upd.distance_from_root + 1;
+    upd.changed[upd.num_changed++] = f;
+    return 0;
+}
+
+/*
+ * Archives store mtime in seconds: that's what is compared.
+ * Size is only meaningful for regular files (eg: symlinks are stored without one).
+ */
+static int is_unchanged(const struct arch_entry *e, const struct stat *sb) {
+    if ((e->mode & S_IFMT) != (sb->st_mode & S_IFMT)) {
+        return 0;
+    }
+    if (S_ISDIR(sb->st_mode)) {
+        return 1;
+    }
+    return e->mtime == sb->st_mtime && (!S_ISREG(sb->st_mode) || e->size == sb->st_size);
+}
+
+static int is_replaced(const char *name) {
+    char norm[PATH_MAX + 1];
+    
+    arch_norm_name(name, norm);
+    return strmap_get(upd.replaced, norm) != NULL;
+}
+
+static int is_replaced_rec(const struct zip_rec *r) {
+    char name[PATH_MAX + 1] = {0};
+    
+    memcpy(name, r->p + ZIP_CD_LEN, r->name_len < PATH_MAX ? r->name_len : PATH_MAX);
+    return is_replaced(name);
+}
+
+/*
+ * Returns ARCHIVE_FORMAT_TAR or ARCHIVE_FORMAT_ZIP if path is an uncompressed tar
+ * or a zip, whose members can be copied as they are; 0 otherwise.
+ */
+static int raw_format(const char *path) {
+    struct archive *a;
+    struct archive_entry *entry;
+    int fmt = 0, r;
+    
+    if (!(a = archive_read_new())) {
+        return 0;
+    }
+    archive_read_support_filter_all(a);
+    archive_read_support_format_all(a);
+    if (archive_read_open_filename(a, path, IO_BUF_ALIGN) == ARCHIVE_OK &&
+        ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN) &&
+        archive_filter_code(a, 0) == ARCHIVE_FILTER_NONE) {
+        fmt = archive_format(a) & ARCHIVE_FORMAT_BASE_MASK;
+        if (fmt != ARCHIVE_FORMAT_TAR && fmt != ARCHIVE_FORMAT_ZIP) {
+            fmt = 0;
+        }
+    }
+    archive_read_free(a);
+    return fmt;
+}
+
+/*
+ * Each member spans from the end of previous one (its extended headers included)
+ * to the end of its padded data: runs of kept members are copied at once,
+ * then new entries and end of archive are appended.
+ * Headers are read by seeking over members' data.
+ */
+static int update_tar(int in_fd, int out_fd) {
+    struct archive *a, *w;
+    struct archive_entry *entry;
+    struct upd_out o = {0};
+    off_t start = 0, end, run_start = 0;
+    int r, ret = 0;
+    
+    if (!(a = archive_read_new())) {
+        return -1;
+    }
+    archive_read_support_format_tar(a);
+    if (archive_read_open_filename(a, thread_h->full_path, IO_BUF_ALIGN) != ARCHIVE_OK) {
+        archive_read_free(a);
+        return -1;
+    }
+    while (!ret && ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN)) {
+        if (archive_read_data_skip(a) != ARCHIVE_OK) {
+            ret = -1;
+            break;
+        }
+        end = archive_filter_bytes(a, -1);
+        if (is_replaced(archive_entry_pathname(entry))) {
+            ret = copy_range(in_fd, run_start, start - run_start, out_fd);
+            run_start = end;
+        }
+        start = end;
+    }
+    archive_read_free(a);
+    if (ret || r != ARCHIVE_EOF || copy_range(in_fd, run_start, start - run_start, out_fd) == -1 ||
+        !(w = open_new_entries(&o, out_fd, 0, ".tar", OUT_BLOCK))) {
+        return -1;
+    }
+    ret = write_new_entries(w);
+    if (archive_write_close(w) != ARCHIVE_OK) {
+        ret = -1;
+    }
+    archive_write_free(w);
+    return ret;
+}
+
+/*
+ * Kept members (local header, data and data descriptor) are copied as they are,
+ * in the order they are stored: their offsets can only decrease.
+ * New entries are compressed by libarchive right after them; the central directory
+ * it writes is captured, and its records are merged with the kept ones.
+ * Returns 1, before writing anything, if members cannot be copied one by one.
+ */
+static int update_zip(int in_fd, int out_fd) {
+    struct zip_cd cd = {0};
+    struct zip_member *members = NULL;
+    struct zip_rec *new_recs = NULL;
+    struct upd_out o = {0};
+    struct byte_buf out_cd = {0};
+    struct archive *w = NULL;
+    uint64_t *new_offsets = NULL, run_start = 0, run_end, out_pos = 0, num = 0;
+    int num_new = 0, ret = -1;
+    
+    if (read_zip_cd(in_fd, upd.archive_sb.st_size, &cd) == -1 || !(members = sort_zip_members(&cd))) {
+        free_zip_cd(&cd);
+        return 1;
+    }
+    if (!(new_offsets = malloc(sizeof(uint64_t) * (cd.num_recs + 1)))) {
+        goto end;
+    }
+    // bytes before first member (eg: a self extracting stub) are kept
+    run_end = cd.num_recs ? members[0].offset : 0;
+    for (int i = 0; i < cd.num_recs; i++) {
+        uint64_t end = i + 1 < cd.num_recs ? members[i + 1].offset : cd.offset;
+        
+        if (is_replaced_rec(&cd.recs[members[i].rec])) {
+            if (copy_range(in_fd, run_start, run_end - run_start, out_fd) == -1) {
+                goto end;
+            }
+            out_pos += run_end - run_start;
+            run_start = end;
+            new_offsets[members[i].rec] = ZIP_REMOVED;
+        } else {
+            new_offsets[members[i].rec] = out_pos + (members[i].offset - run_start);
+            num++;
+        }
+        run_end = end;
+    }
+    if (copy_range(in_fd, run_start, run_end - run_start, out_fd) == -1) {
+        goto end;
+    }
+    out_pos += run_end - run_start;
+    
+    // libarchive's output is not buffered, so that its central directory is captured whole
+    if (!(w = open_new_entries(&o, out_fd, out_pos, ".zip", 0)) || write_new_entries(w) == -1 ||
+        archive_write_finish_entry(w) != ARCHIVE_OK) {
+        goto end;
+    }
+    o.capture = 1;
+    if (archive_write_close(w) != ARCHIVE_OK ||
+        parse_zip_recs(o.capture_buf.data, o.capture_buf.len, &new_recs, &num_new) == -1) {
+        goto end;
+    }
+    for (int i = 0; i < cd.num_recs; i++) {
+        if (new_offsets[i] != ZIP_REMOVED && add_zip_rec(&out_cd, &cd.recs[i], new_offsets[i]) == -1) {
+            goto end;
+        }
+    }
+    // their offsets are relative to where libarchive started writing
+    for (int i = 0; i < num_new; i++) {
+        if (add_zip_rec(&out_cd, &new_recs[i], out_pos + new_recs[i].offset) == -1) {
+            goto end;
+        }
+    }
+    if (add_zip_eocd(&out_cd, num + num_new, o.pos, out_cd.len, &cd) == 0 &&
+        write_all(out_fd, out_cd.data, out_cd.len) == 0) {
+        ret = 0;
+    }
+
+end:
+    if (w) {
+        archive_write_free(w);
+    }
+    free(o.capture_buf.data);
+    free(out_cd.data);
+    free(new_recs);
+    free(new_offsets);
+    free(members);
+    free_zip_cd(&cd);
+    return ret;
+}
+
+/*
+ * Compressed archives: kept members are decompressed and compressed again
+ * in a new archive with same format, then new entries are added.
+ */
+static int rewrite_archive(int out_fd) {
+    const char *ext = get_archive_ext(thread_h->full_path);
+    struct archive *a, *w;
+    struct archive_entry *entry;
+    struct upd_out o = {0};
+    size_t len = io_block_size(upd.archive_sb.st_size);
+    char *buf;
+    ssize_t n;
+    int r, ret = 0;
+    
+    if (!ext || !(buf = malloc(len))) {
+        return -1;
+    }
+    if (!(w = open_new_entries(&o, out_fd, 0, ext, OUT_BLOCK))) {
+        free(buf);
+        return -1;
+    }
+    a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_all(a);
+    if (archive_read_open_filename(a, thread_h->full_path, len) != ARCHIVE_OK) {
+        ret = -1;
+    }
+    while (!ret && ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN)) {
+        if (is_replaced(archive_entry_pathname(entry))) {
+            continue;
+        }
+        // a kept member that cannot be written would be lost once archive is replaced
+        if ((r = archive_write_header(w, entry)) < ARCHIVE_WARN) {
+            ERROR(archive_entry_pathname(entry));
+            ERROR(archive_error_string(w));
+            ret = -1;
+        } else {
+            while ((n = archive_read_data(a, buf, len)) > 0) {
+                if (archive_write_data(w, buf, n) < 0) {
+                    ret = -1;
+                    break;
+                }
+            }
+            if (n < 0) {
+                ret = -1;
+            }
+        }
+    }
+    if (ret || r != ARCHIVE_EOF || write_new_entries(w) == -1) {
+        ret = -1;
+    }
+    if (archive_write_close(w) != ARCHIVE_OK) {
+        ret = -1;
+    }
+    archive_read_free(a);
+    archive_write_free(w);
+    free(buf);
+    return ret;
+}
+
+/*
+ * Opens the archive new entries are written to, at pos of fd: its format
+ * (and filter) is chosen by ext (see set_archive_format()); block is libarchive's output block size.
+ */
+static struct archive *open_new_entries(struct upd_out *o, int fd, off_t pos, const char *ext, int block) {
+    int threads = config.archive_threads > 0 ? config.archive_threads : thpool_default_size();
+    struct archive *w;
+    
+    o->fd = fd;
+    o->pos = pos;
+    if (!(w = archive_write_new())) {
+        return NULL;
+    }
+    if (set_archive_format(w, ext, threads) == 0) {
+        archive_write_set_bytes_per_block(w, block);
+        archive_write_set_bytes_in_last_block(w, 1);
+        if (archive_write_open(w, o, NULL, upd_write, NULL) == ARCHIVE_OK) {
+            return w;
+        }
+    }
+    ERROR(archive_error_string(w));
+    archive_write_free(w);
+    return NULL;
+}
+
+static int write_new_entries(struct archive *w) {
+    for (int i = 0; i < upd.num_changed; i++) {
+        if (write_file_entry(w, upd.changed[i]) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * As in create_archive(), files that cannot be read are archived empty;
+ * an entry whose header cannot be written fails the whole update.
+ */
+static int write_file_entry(struct archive *w, const struct pipe_file *f) {
+    struct archive_entry *entry;
+    char target[PATH_MAX + 1] = {0};
+    size_t len;
+    char *buf;
+    ssize_t n;
+    int fd, r, ret = 0;
+    
+    if (!(entry = archive_entry_new())) {
+        return -1;
+    }
+    archive_entry_set_pathname(entry, f->path + f->name_offset);
+    archive_entry_copy_stat(entry, &f->sb);
+    if (S_ISLNK(f->sb.st_mode) && readlink(f->path, target, PATH_MAX) > 0) {
+        archive_entry_set_symlink(entry, target);
+    }
+    r = archive_write_header(w, entry);
+    archive_entry_free(entry);
+    if (r < ARCHIVE_WARN) {
+        ERROR(f->path);
+        ERROR(archive_error_string(w));
+        return -1;
+    }
+    if (!S_ISREG(f->sb.st_mode) || !f->sb.st_size || (fd = open(f->path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return 0;
+    }
+    len = io_block_size(f->sb.st_size);
+    if (!(buf = malloc(len))) {
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while ((n = read(fd, buf, len)) > 0) {
+        if (archive_write_data(w, buf, n) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    free(buf);
+    close(fd);
+    return ret;
+}
+
+static la_ssize_t upd_write(struct archive *a, void *client_data, const void *buff, size_t len) {
+    struct upd_out *o = (struct upd_out *)client_data;
+    
+    if (o->capture) {
+        if (buf_add(&o->capture_buf, buff, len) == -1) {
+            archive_set_error(a, ENOMEM, "%s", strerror(ENOMEM));
+            return -1;
+        }
+        return len;
+    }
+    if (write_all(o->fd, buff, len) == -1) {
+        archive_set_error(a, errno, "%s", strerror(errno));
+        return -1;
+    }
+    o->pos += len;
+    return len;
+}
+
+/*
+ * Finds end of central directory record (zip64 one too, if needed)
+ * at the very end of the archive, then reads the central directory.
+ */
+static int read_zip_cd(int fd, off_t size, struct zip_cd *cd) {
+    size_t tail_len = size < ZIP_EOCD_LEN + ZIP_MAX16 ? size : ZIP_EOCD_LEN + ZIP_MAX16;
+    off_t tail_off = size - tail_len;
+    unsigned char *tail, *eocd = NULL;
+    uint64_t num;
+    int ret = -1;
+    
+    if (tail_len < ZIP_EOCD_LEN || !(tail = malloc(tail_len))) {
+        return -1;
+    }
+    if (read_all(fd, tail, tail_len, tail_off) == -1) {
+        goto end;
+    }
+    // archive comment can hold anything: signature must be followed by the whole comment
+    for (long i = tail_len - ZIP_EOCD_LEN; i >= 0 && !eocd; i--) {
+        if (get32(tail + i) == ZIP_EOCD_SIG && i + ZIP_EOCD_LEN + get16(tail + i + 20) == tail_len) {
+            eocd = tail + i;
+        }
+    }
+    if (!eocd) {
+        goto end;
+    }
+    num = get16(eocd + 10);
+    cd->size = get32(eocd + 12);
+    cd->offset = get32(eocd + 16);
+    cd->comment_len = get16(eocd + 20);
+    if (cd->comment_len) {
+        if (!(cd->comment = malloc(cd->comment_len))) {
+            goto end;
+        }
+        memcpy(cd->comment, eocd + ZIP_EOCD_LEN, cd->comment_len);
+    }
+    if (num == ZIP_MAX16 || cd->size == ZIP_MAX32 || cd->offset == ZIP_MAX32) {
+        unsigned char loc[ZIP64_LOCATOR_LEN], z64[ZIP64_EOCD_LEN];
+        off_t loc_off = tail_off + (eocd - tail) - ZIP64_LOCATOR_LEN;
+        
+        if (loc_off < 0 || read_all(fd, loc, ZIP64_LOCATOR_LEN, loc_off) == -1 || get32(loc) != ZIP64_LOCATOR_SIG ||
+            read_all(fd, z64, ZIP64_EOCD_LEN, get64(loc + 8)) == -1 || get32(z64) != ZIP64_EOCD_SIG) {
+            goto end;
+        }
+        num = get64(z64 + 32);
+        cd->size = get64(z64 + 40);
+        cd->offset = get64(z64 + 48);
+    }
+    if (cd->offset + cd->size > (uint64_t)size || !(cd->data = malloc(cd->size + 1)) ||
+        read_all(fd, cd->data, cd->size, cd->offset) == -1 ||
+        parse_zip_recs(cd->data, cd->size, &cd->recs, &cd->num_recs) == -1 || cd->num_recs != num) {
+        goto end;
+    }
+    ret = 0;
+
+end:
+    free(tail);
+    return ret;
+}
+
+static int parse_zip_recs(const unsigned char *data, uint64_t len, struct zip_rec **recs, int *num) {
+    uint64_t pos = 0;
+    int cap = 0;
+    
+    *recs = NULL;
+    *num = 0;
+    while (pos + ZIP_CD_LEN <= len && get32(data + pos) == ZIP_CD_SIG) {
+        const unsigned char *p = data + pos;
+        struct zip_rec r = {
+            .p = p, .name_len = get16(p + 28), .extra_len = get16(p + 30), .comment_len = get16(p + 32),
+            .csize = get32(p + 20), .usize = get32(p + 24), .offset = get32(p + 42)
+        };
+        
+        pos += ZIP_CD_LEN + r.name_len + r.extra_len + r.comment_len;
+        if (pos > len) {
+            break;
+        }
+        read_zip64_extra(&r);
+        if (*num == cap) {
+            struct zip_rec *tmp;
+            
+            cap = cap ? cap * 2 : 256;
+            if (!(tmp = realloc(*recs, cap * sizeof(struct zip_rec)))) {
+                break;
+            }
+            *recs = tmp;
+        }
+        (*recs)[(*num)++] = r;
+    }
+    if (pos > len || (pos + ZIP_CD_LEN <= len && get32(data + pos) == ZIP_CD_SIG)) {
+        free(*recs);
+        *recs = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Zip64 extra field holds, in this order, only the values whose 32 bits field is maxed out.
+ */
+static void read_zip64_extra(struct zip_rec *r) {
+    const unsigned char *q = r->p + ZIP_CD_LEN + r->name_len, *end = q + r->extra_len;
+    
+    for (; q + 4 <= end && q + 4 + get16(q + 2) <= end; q += 4 + get16(q + 2)) {
+        if (get16(q) == 1) {
+            const unsigned char *d = q + 4, *d_end = d + get16(q + 2);
+            
+            if (r->usize == ZIP_MAX32 && d + 8 <= d_end) {
+                r->usize = get64(d);
+                d += 8;
+            }
+            if (r->csize == ZIP_MAX32 && d + 8 <= d_end) {
+                r->csize = get64(d);
+                d += 8;
+            }
+            if (r->offset == ZIP_MAX32 && d + 8 <= d_end) {
+                r->offset = get64(d);
+            }
+            break;
+        }
+    }
+}
+
+/*
+ * Returns members sorted by offset, or NULL if two of them
+ * share their data or any of them is not before the central directory.
+ */
+static struct zip_member *sort_zip_members(const struct zip_cd *cd) {
+    struct zip_member *members = malloc(sizeof(struct zip_member) * (cd->num_recs + 1));
+    
+    if (!members) {
+        return NULL;
+    }
+    for (int i = 0; i < cd->num_recs; i++) {
+        members[i].offset = cd->recs[i].offset;
+        members[i].rec = i;
+    }
+    qsort(members, cd->num_recs, sizeof(struct zip_member), cmp_members);
+    for (int i = 0; i < cd->num_recs; i++) {
+        if ((i && members[i].offset == members[i - 1].offset) || members[i].offset >= cd->offset) {
+            free(members);
+            return NULL;
+        }
+    }
+    return members;
+}
+
+static int cmp_members(const void *a, const void *b) {
+    uint64_t x = ((const struct zip_member *)a)->offset, y = ((const struct zip_member *)b)->offset;
+    
+    return (x > y) - (x < y);
+}
+
+/*
+ * Appends r with given offset; its zip64 extra field is written again
+ * with the values that need it now.
+ */
+static int add_zip_rec(struct byte_buf *b, const struct zip_rec *r, uint64_t offset) {
+    const unsigned char *extra = r->p + ZIP_CD_LEN + r->name_len, *end = extra + r->extra_len, *q;
+    unsigned char hdr[ZIP_CD_LEN], z64[4 + 3 * 8];
+    int z64_len = 4, extra_len = 0;
+    
+    memcpy(hdr, r->p, ZIP_CD_LEN);
+    put32(hdr + 20, r->csize >= ZIP_MAX32 ? ZIP_MAX32 : r->csize);
+    put32(hdr + 24, r->usize >= ZIP_MAX32 ? ZIP_MAX32 : r->usize);
+    put32(hdr + 42, offset >= ZIP_MAX32 ? ZIP_MAX32 : offset);
+    if (r->usize >= ZIP_MAX32) {
+        put64(z64 + z64_len, r->usize);
+        z64_len += 8;
+    }
+    if (r->csize >= ZIP_MAX32) {
+        put64(z64 + z64_len, r->csize);
+        z64_len += 8;
+    }
+    if (offset >= ZIP_MAX32) {
+        put64(z64 + z64_len, offset);
+        z64_len += 8;
+    }
+    for (q = extra; q + 4 <= end && q + 4 + get16(q + 2) <= end; q += 4 + get16(q + 2)) {
+        if (get16(q) != 1) {
+            extra_len += 4 + get16(q + 2);
+        }
+    }
+    if (z64_len > 4) {
+        put16(z64, 1);
+        put16(z64 + 2, z64_len - 4);
+        extra_len += z64_len;
+        if (get16(hdr + 6) < 45) {
+            // version needed to extract zip64 entries
+            put16(hdr + 6, 45);
+        }
+    }
+    if (extra_len > ZIP_MAX16) {
+        return -1;
+    }
+    put16(hdr + 30, extra_len);
+    if (buf_add(b, hdr, ZIP_CD_LEN) == -1 || buf_add(b, r->p + ZIP_CD_LEN, r->name_len) == -1) {
+        return -1;
+    }
+    for (q = extra; q + 4 <= end && q + 4 + get16(q + 2) <= end; q += 4 + get16(q + 2)) {
+        if (get16(q) != 1 && buf_add(b, q, 4 + get16(q + 2)) == -1) {
+            return -1;
+        }
+    }
+    if (z64_len > 4 && buf_add(b, z64, z64_len) == -1) {
+        return -1;
+    }
+    return buf_add(b, end, r->comment_len);
+}
+
+/*
+ * Appends zip64 end of central directory record and its locator if needed,
+ * then end of central directory record with old archive's comment.
+ */
+static int add_zip_eocd(struct byte_buf *b, uint64_t num, uint64_t cd_offset, uint64_t cd_size, const struct zip_cd *old) {
+    unsigned char eocd[ZIP_EOCD_LEN] = {0};
+    
+    if (num >= ZIP_MAX16 || cd_offset >= ZIP_MAX32 || cd_size >= ZIP_MAX32) {
+        unsigned char z64[ZIP64_EOCD_LEN] = {0}, loc[ZIP64_LOCATOR_LEN] = {0};
+        
+        put32(z64, ZIP64_EOCD_SIG);
+        put64(z64 + 4, ZIP64_EOCD_LEN - 12);
+        put16(z64 + 12, 45);
+        put16(z64 + 14, 45);
+        put64(z64 + 24, num);
+        put64(z64 + 32, num);
+        put64(z64 + 40, cd_size);
+        put64(z64 + 48, cd_offset);
+        put32(loc, ZIP64_LOCATOR_SIG);
+        put64(loc + 8, cd_offset + cd_size);
+        put32(loc + 16, 1);
+        if (buf_add(b, z64, ZIP64_EOCD_LEN) == -1 || buf_add(b, loc, ZIP64_LOCATOR_LEN) == -1) {
+            return -1;
+        }
+    }
+    put32(eocd, ZIP_EOCD_SIG);
+    put16(eocd + 8, num >= ZIP_MAX16 ? ZIP_MAX16 : num);
+    put16(eocd + 10, num >= ZIP_MAX16 ? ZIP_MAX16 : num);
+    put32(eocd + 12, cd_size >= ZIP_MAX32 ? ZIP_MAX32 : cd_size);
+    put32(eocd + 16, cd_offset >= ZIP_MAX32 ? ZIP_MAX32 : cd_offset);
+    put16(eocd + 20, old->comment_len);
+    if (buf_add(b, eocd, ZIP_EOCD_LEN) == -1) {
+        return -1;
+    }
+    return buf_add(b, old->comment, old->comment_len);
+}
+
+static void free_zip_cd(struct zip_cd *cd) {
+    free(cd->data);
+    free(cd->recs);
+    free(cd->comment);
+}
+
+/*
+ * Copies len bytes at off of in_fd to current position of out_fd,
+ * inside the kernel when possible; falls back to read/write (eg: across filesystems).
+ */
+static int copy_range(int in_fd, off_t off, off_t len, int out_fd) {
+    size_t buf_len;
+    char *buf;
+    ssize_t n;
+    
+    while (len > 0) {
+        if ((n = copy_file_range(in_fd, &off, out_fd, NULL, len, 0)) > 0) {
+            len -= n;
+        } else if (n == 0) {
+            // archive is shorter than it should
+            return -1;
+        } else if (errno != EINTR) {
+            if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) {
+                return -1;
+            }
+            break;
+        }
+    }
+    if (len <= 0) {
+        return 0;
+    }
+    buf_len = io_block_size(len);
+    if (!(buf = malloc(buf_len))) {
+        return -1;
+    }
+    while (len > 0) {
+        n = len < (off_t)buf_len ? len : (off_t)buf_len;
+        if (read_all(in_fd, buf, n, off) == -1 || write_all(out_fd, buf, n) == -1) {
+            break;
+        }
+        off += n;
+        len -= n;
+    }
+    free(buf);
+    return len > 0 ? -1 : 0;
+}
+
+/*
+ * New archive gets old one's owner and group (best effort: only root, or an owner
+ * giving it one of its groups, can do it) and perms, then it is synced before being
+ * renamed over the old one, so that a crash cannot leave an empty or partial archive
+ * in its place. Dir is synced too, to make the rename itself durable.
+ */
+static int replace_archive(int out_fd, const char *tmp) {
+    char dir[PATH_MAX + 1] = {0};
+    int dir_fd;
+    
+    if (fchown(out_fd, upd.archive_sb.st_uid, upd.archive_sb.st_gid) == -1) {
+        INFO("could not keep archive's owner and group.");
+    }
+    if (fchmod(out_fd, upd.archive_sb.st_mode & 07777) == -1 || fsync(out_fd) == -1 ||
+        rename(tmp, thread_h->full_path) == -1) {
+        return -1;
+    }
+    strncpy(dir, thread_h->full_path, PATH_MAX);
+    if ((dir_fd = open(dirname(dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return 0;
+}
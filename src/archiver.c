@@ -5,82 +5,668 @@ static int recursive_archive(const char *path, const struct stat *sb, int typefl
 #if ARCHIVE_VERSION_NUMBER >= 3002000
 static const char *passphrase_callback(struct archive *a, void *_client_data);
 #endif
-static int try_extractor(const char *tmp);
-static void extractor_thread(struct archive *a, const char *current_dir);
+static int extract_members(int first, int len);
+static int try_extractor(const char *tmp, const char **members, int num_members);
+static int last_member_header(const struct extract_ctx *ctx);
+static int member_offset(const struct extract_ctx *ctx, const char *name);
+static const char *skip_root(const char *name);
+static int count_workers(struct extract_ctx *ctx);
+static int parallel_extract(struct extract_ctx *ctx, int workers);
+static void extract_job(void *x);
+static const char *hardlink_name(const struct extract_ctx *ctx, struct archive_entry *entry);
+static int extractor_thread(struct archive *a, struct extract_ctx *ctx, int first, int stride);
+static struct archive *new_disk_writer(void);
+static int extract_entry(struct archive *a, struct archive *ext, struct archive_entry *entry, const struct extract_ctx *ctx);
+static int copy_data_blocks(struct archive *a, struct archive *ext, const struct extract_ctx *ctx);
+static int extract_cancelled(const struct extract_ctx *ctx);
+static int save_dir_fixup(struct extract_ctx *ctx, struct archive_entry *entry, const char *path);
+static void apply_dir_fixups(struct extract_ctx *ctx);
+static const struct write_format *find_format(const char *name);
+static void set_write_options(struct archive *a, const struct write_format *fmt, int threads);
+static int open_output(void);
+static int close_output(void);
+static la_ssize_t out_write(struct archive *a, void *client_data, const void *buff, size_t len);
+static int out_close(struct archive *a, void *client_data);
+static int start_pipeline(void);
+static void *prefetch_func(void *x);
+static int prefetch_file(const struct pipe_file *f);
+static void *compress_func(void *x);
+static void *writer_func(void *x);
+static int push_chunk(struct bqueue *q, struct archive_entry *entry, char *data, size_t len);
+static void free_chunk(void *x);
+static void set_pipe_err(int err);
+static int open_parallel_gzip(int threads);
+static la_ssize_t pgz_write(struct archive *a, void *client_data, const void *buff, size_t len);
+static int pgz_close(struct archive *a, void *client_data);
+static void pgz_submit(void);
+static void pgz_flush_oldest(void);
+static void pgz_compress(void *x);
+static void pgz_free(void);
+
+/*
+ * Archive formats that can be created: format is chosen by new archive's extension.
+ * A NULL filter means no compression filter (eg: zip compresses by itself).
+ */
+struct write_format {
+    const char *ext;
+    const char *filter;
+    const char *format;
+};
+
+/*
+ * Archive creation is split in 4 stages, each one in its own thread,
+ * connected by bounded queues so that disk reads, compression and disk writes overlap:
+ * walk (archiver_func) -> files_q -> prefetch -> chunks_q -> compress -> out_q -> writer.
+ * Each queue has a single producer and a single consumer, so archive order is kept.
+ * First error is saved in err: every stage stops as soon as its queues are aborted.
+ */
+struct pipeline {
+    struct bqueue *files_q, *chunks_q, *out_q;
+    pthread_t prefetch_th, compress_th, writer_th;
+    int fd;
+    atomic_int err;
+};
+
+/*
+ * Parallel gzip: tar stream is cut in PGZ_BLOCK sized blocks, each one compressed
+ * by a pool thread into a standalone gzip member. Members are handed to the writer in order:
+ * their concatenation is a valid gzip file.
+ * At most num_blocks blocks are in flight.
+ */
+struct pgz_block {
+    unsigned char *in;
+    size_t in_len;
+    unsigned char *out;
+    size_t out_len;
+    int busy;
+};
+
+struct pgz {
+    struct thpool *pool;
+    struct pgz_block *blocks;
+    int num_blocks;
+    unsigned long submitted, written;
+    pthread_mutex_t lck;
+    pthread_cond_t done;
+};
+
+static const struct write_format write_formats[] = {
+    {".tar.gz", "gzip", "paxr"}, {".tgz", "gzip", "paxr"},
+    {".tar.zst", "zstd", "paxr"}, {".tzst", "zstd", "paxr"},
+    {".tar.xz", "xz", "paxr"}, {".txz", "xz", "paxr"},
+    {".tar.bz2", "bzip2", "paxr"}, {".tbz2", "bzip2", "paxr"},
+    {DEDUP_EXT, NULL, NULL}, {".tar", NULL, "paxr"}, {".zip", NULL, "zip"}
+};
 
 static struct archive *archive;
 static int distance_from_root;
+static struct pipeline pl;
+static struct pgz pgz;
+#if ARCHIVE_VERSION_NUMBER >= 3002000
+static pthread_mutex_t passphrase_lck = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /*
  * It tries to create a new archive to write inside it,
  * it fails if it cannot add the proper filter, or cannot set proper format, or
- * if it cannot open thread_h->full_path (ie, the desired pathname of the new archive)
+ * if it cannot open thread_h->full_path (ie, the desired pathname of the new archive).
+ * Gzip archives are compressed by a pool of config.archive_threads threads
+ * if parallel_gzip is enabled; zstd and xz use libarchive's own threads.
+ * Deduplicated archives have their own writer (see create_dedup_archive()).
  */
 int create_archive(void) {
+    const struct write_format *fmt = find_format(thread_h->full_path);
+    int threads = config.archive_threads > 0 ? config.archive_threads : thpool_default_size();
+    int parallel = fmt->filter && !strcmp(fmt->filter, "gzip") && config.parallel_gzip && threads > 1;
+    
+    if (!fmt->format) {
+        return create_dedup_archive();
+    }
+    memset(&pgz, 0, sizeof(struct pgz));
+    memset(&pl, 0, sizeof(struct pipeline));
+    atomic_init(&pl.err, 0);
     archive = archive_write_new();
-    if ((archive_write_add_filter_gzip(archive) == ARCHIVE_OK) &&
-        (archive_write_set_format_pax_restricted(archive) == ARCHIVE_OK) &&
-        (archive_write_open_filename(archive, thread_h->full_path) == ARCHIVE_OK)) {
-        archiver_func();
-        return 0;
+    if ((!fmt->filter || parallel || archive_write_add_filter_by_name(archive, fmt->filter) == ARCHIVE_OK) &&
+        (archive_write_set_format_by_name(archive, fmt->format) == ARCHIVE_OK)) {
+        set_write_options(archive, fmt, threads);
+        // output goes through our callbacks: libarchive must not pad it
+        archive_write_set_bytes_per_block(archive, OUT_BLOCK);
+        archive_write_set_bytes_in_last_block(archive, 1);
+        if (open_output() == 0 &&
+            (parallel ? open_parallel_gzip(threads) : archive_write_open(archive, NULL, NULL, out_write, out_close)) == ARCHIVE_OK) {
+            archiver_func();
+            return atomic_load(&pl.err) ? -1 : 0;
+        }
     }
     ERROR(archive_error_string(archive));
     archive_write_free(archive);
     archive = NULL;
+    pgz_free();
+    close_output();
     return -1;
 }
 
+/*
+ * Returns the extension of name if it is one of the formats we can create, else NULL.
+ */
+const char *get_archive_ext(const char *name) {
+    int len = strlen(name);
+    
+    for (int i = 0; i < NUM(write_formats); i++) {
+        int ext_len = strlen(write_formats[i].ext);
+        
+        if (len > ext_len && !strcmp(name + len - ext_len, write_formats[i].ext)) {
+            return write_formats[i].ext;
+        }
+    }
+    return NULL;
+}
+
+static const struct write_format *find_format(const char *name) {
+    const char *ext = get_archive_ext(name);
+    int i;
+    
+    if (!ext) {
+        ext = DEFAULT_ARCHIVE_EXT;
+    }
+    for (i = 0; i < NUM(write_formats) - 1 && strcmp(write_formats[i].ext, ext); i++);
+    return &write_formats[i];
+}
+
+/*
+ * Sets filter, format and options of a for one of write_formats' extensions
+ * (gzip is single threaded here: parallel gzip is only used while creating archives).
+ */
+int set_archive_format(struct archive *a, const char *ext, int threads) {
+    const struct write_format *fmt = NULL;
+    
+    for (int i = 0; i < NUM(write_formats) && !fmt; i++) {
+        if (!strcmp(write_formats[i].ext, ext)) {
+            fmt = &write_formats[i];
+        }
+    }
+    if (!fmt || !fmt->format || (fmt->filter && archive_write_add_filter_by_name(a, fmt->filter) != ARCHIVE_OK) ||
+        archive_write_set_format_by_name(a, fmt->format) != ARCHIVE_OK) {
+        return -1;
+    }
+    set_write_options(a, fmt, threads);
+    return 0;
+}
+
+/*
+ * Options not supported by linked libarchive are only logged.
+ */
+static void set_write_options(struct archive *a, const struct write_format *fmt, int threads) {
+    char val[20];
+    int ret = ARCHIVE_OK;
+    
+    if (config.archive_level >= 0) {
+        snprintf(val, sizeof(val), "%d", config.archive_level);
+        if (fmt->filter) {
+            ret = archive_write_set_filter_option(a, fmt->filter, "compression-level", val);
+        } else if (!strcmp(fmt->format, "zip")) {
+            ret = archive_write_set_format_option(a, "zip", "compression-level", val);
+        }
+        if (ret != ARCHIVE_OK) {
+            WARN(archive_error_string(a));
+        }
+    }
+    if (fmt->filter && (!strcmp(fmt->filter, "zstd") || !strcmp(fmt->filter, "xz"))) {
+        snprintf(val, sizeof(val), "%d", threads);
+        if (archive_write_set_filter_option(a, fmt->filter, "threads", val) != ARCHIVE_OK) {
+            WARN(archive_error_string(a));
+        }
+    }
+}
+
+/*
+ * Opens new archive file and starts the writer stage.
+ */
+static int open_output(void) {
+    if ((pl.fd = open(thread_h->full_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1) {
+        archive_set_error(archive, errno, "%s", strerror(errno));
+        return -1;
+    }
+    if (!(pl.out_q = bq_new(OUT_Q_MAX)) || pthread_create(&pl.writer_th, NULL, writer_func, NULL)) {
+        if (pl.out_q) {
+            bq_free(pl.out_q, free_chunk);
+            pl.out_q = NULL;
+        }
+        close(pl.fd);
+        archive_set_error(archive, ENOMEM, "%s", strerror(ENOMEM));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Waits for the writer to flush every queued buffer, then closes new archive.
+ * Safe to be called more than once.
+ */
+static int close_output(void) {
+    if (!pl.out_q) {
+        return 0;
+    }
+    bq_close(pl.out_q);
+    pthread_join(pl.writer_th, NULL);
+    bq_free(pl.out_q, free_chunk);
+    pl.out_q = NULL;
+    if (close(pl.fd) == -1) {
+        set_pipe_err(errno);
+    }
+    return atomic_load(&pl.err) ? -1 : 0;
+}
+
+/*
+ * libarchive's output buffer is reused as soon as we return: queue a copy of it.
+ */
+static la_ssize_t out_write(struct archive *a, void *client_data, const void *buff, size_t len) {
+    char *data = malloc(len);
+    
+    if (!data) {
+        set_pipe_err(ENOMEM);
+    } else {
+        memcpy(data, buff, len);
+        if (push_chunk(pl.out_q, NULL, data, len) == 0) {
+            return len;
+        }
+    }
+    archive_set_error(a, atomic_load(&pl.err), "%s", strerror(atomic_load(&pl.err)));
+    return -1;
+}
+
+static int out_close(struct archive *a, void *client_data) {
+    return close_output() == -1 ? ARCHIVE_FATAL : ARCHIVE_OK;
+}
+
 /*
  * For each of the selected files, calculates the distance from root and calls nftw with recursive_archive.
  * Example: archiving /home/me/Scripts/ folder -> it contains {/x.sh, /foo/bar}.
  * recursive_archive has to create the entry exactly like /desired/path/name.tgz/{x.sh, foo/bar}
- * it copies as entry_name the pointer to current path + distance_from_root + 1, in our case:
+ * its entry name is current path + distance_from_root + 1, in our case:
  * path is /home/me/Scripts/x.sh and (path + distance_from_root + 1) points exatcly to x.sh.
- * The entry will be written to the new archive, and then data will be copied.
+ * Files are queued in archive order to the prefetch stage, that reads their data
+ * for the compress stage.
  */
 static void archiver_func(void) {
     char path[PATH_MAX + 1] = {0};
-
-    for (int i = 0; i < thread_h->num_selected; i++) {
-        strncpy(path, thread_h->selected_files[i], PATH_MAX);
-        distance_from_root = strlen(dirname(path));
-        nftw(thread_h->selected_files[i], recursive_archive, 64, FTW_MOUNT | FTW_PHYS);
+    
+    if (start_pipeline() == 0) {
+        for (int i = 0; i < thread_h->num_selected; i++) {
+            strncpy(path, thread_h->selected_files[i], PATH_MAX);
+            distance_from_root = strlen(dirname(path));
+            if (nftw(thread_h->selected_files[i], recursive_archive, 64, FTW_MOUNT | FTW_PHYS) > 0) {
+                break;
+            }
+        }
+        bq_close(pl.files_q);
+        pthread_join(pl.prefetch_th, NULL);
+        pthread_join(pl.compress_th, NULL);
+    }
+    if (pl.files_q) {
+        bq_free(pl.files_q, free);
     }
+    if (pl.chunks_q) {
+        bq_free(pl.chunks_q, free_chunk);
+    }
+    // if compress stage did not run, this closes output too
     archive_write_free(archive);
     archive = NULL;
+    close_output();
 }
 
 static int recursive_archive(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
-    char entry_name[PATH_MAX + 1] = {0};
-    int fd;
-    struct archive_entry *entry = archive_entry_new();
-
-    strncpy(entry_name, path + distance_from_root + 1, PATH_MAX);
-    archive_entry_set_pathname(entry, entry_name);
-    archive_entry_copy_stat(entry, sb);
-    archive_write_header(archive, entry);
-    archive_entry_free(entry);
-    fd = open(path, O_RDONLY);
-    if (fd != -1) {
-        char buff[BUFF_SIZE] = {0};
-        int len;
+    size_t len = strlen(path) + 1;
+    struct pipe_file *f = malloc(sizeof(struct pipe_file) + len);
+    
+    if (!f) {
+        set_pipe_err(ENOMEM);
+        return 1;
+    }
+    memcpy(f->path, path, len);
+    memcpy(&f->sb, sb, sizeof(struct stat));
+    f->name_offset = distance_from_root + 1;
+    if (bq_push(pl.files_q, f, 1) == -1) {
+        // pipeline has been aborted
+        free(f);
+        return 1;
+    }
+    return 0;
+}
+
+static int start_pipeline(void) {
+    if ((pl.files_q = bq_new(FILES_Q_MAX)) && (pl.chunks_q = bq_new(CHUNKS_Q_MAX))) {
+        if (!pthread_create(&pl.prefetch_th, NULL, prefetch_func, NULL)) {
+            if (!pthread_create(&pl.compress_th, NULL, compress_func, NULL)) {
+                return 0;
+            }
+            bq_abort(pl.files_q);
+            pthread_join(pl.prefetch_th, NULL);
+        }
+    }
+    set_pipe_err(ENOMEM);
+    return -1;
+}
+
+/*
+ * Reads upcoming files while compress stage is busy with previous ones:
+ * up to CHUNKS_Q_MAX bytes are read ahead.
+ */
+static void *prefetch_func(void *x) {
+    struct pipe_file *f;
+    
+    while ((f = bq_pop(pl.files_q))) {
+        if (prefetch_file(f) == -1) {
+            bq_abort(pl.files_q);
+        }
+        free(f);
+    }
+    bq_close(pl.chunks_q);
+    return NULL;
+}
+
+/*
+ * Queues file's header, then its data in io_block_size() sized chunks.
+ * Files that cannot be read are archived empty, as before.
+ */
+static int prefetch_file(const struct pipe_file *f) {
+    struct archive_entry *entry;
+    size_t len;
+    int fd, ret = 0;
+    
+    if (!(entry = archive_entry_new())) {
+        set_pipe_err(ENOMEM);
+        return -1;
+    }
+    archive_entry_set_pathname(entry, f->path + f->name_offset);
+    archive_entry_copy_stat(entry, &f->sb);
+    if (push_chunk(pl.chunks_q, entry, NULL, 0) == -1) {
+        return -1;
+    }
+    if (!S_ISREG(f->sb.st_mode) || !f->sb.st_size || (fd = open(f->path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return 0;
+    }
+    // let the kernel read ahead what we are going to queue
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, f->sb.st_size < CHUNKS_Q_MAX ? f->sb.st_size : CHUNKS_Q_MAX, POSIX_FADV_WILLNEED);
+    len = io_block_size(f->sb.st_size);
+    while (!ret) {
+        void *buf;
+        ssize_t n;
         
-        len = read(fd, buff, sizeof(buff));
-        while (len > 0) {
-            archive_write_data(archive, buff, len);
-            len = read(fd, buff, sizeof(buff));
+        if (posix_memalign(&buf, IO_BUF_ALIGN, len)) {
+            set_pipe_err(ENOMEM);
+            ret = -1;
+        } else if ((n = read(fd, buf, len)) <= 0) {
+            free(buf);
+            break;
+        } else {
+            ret = push_chunk(pl.chunks_q, NULL, buf, n);
         }
-        close(fd);
     }
-    return 0;
+    close(fd);
+    return ret;
+}
+
+/*
+ * Feeds libarchive with queued headers and data.
+ * Data of an entry whose header could not be written is skipped.
+ */
+static void *compress_func(void *x) {
+    struct pipe_chunk *c;
+    int skip = 0;
+    
+    while ((c = bq_pop(pl.chunks_q))) {
+        int ret = ARCHIVE_OK;
+        
+        if (c->entry) {
+            ret = archive_write_header(archive, c->entry);
+            skip = ret < ARCHIVE_WARN;
+        } else if (!skip && archive_write_data(archive, c->data, c->len) < 0) {
+            ret = ARCHIVE_FATAL;
+        }
+        free_chunk(c);
+        if (ret == ARCHIVE_FATAL) {
+            set_pipe_err(archive_errno(archive) > 0 ? archive_errno(archive) : EIO);
+            bq_abort(pl.chunks_q);
+        }
+    }
+    if (archive_write_close(archive) != ARCHIVE_OK) {
+        set_pipe_err(archive_errno(archive) > 0 ? archive_errno(archive) : EIO);
+    }
+    return NULL;
+}
+
+static void *writer_func(void *x) {
+    struct pipe_chunk *c;
+    
+    while ((c = bq_pop(pl.out_q))) {
+        size_t done = 0;
+        
+        while (done < c->len) {
+            ssize_t n = write(pl.fd, c->data + done, c->len - done);
+            
+            if (n == -1) {
+                if (errno != EINTR) {
+                    set_pipe_err(errno);
+                    bq_abort(pl.out_q);
+                    break;
+                }
+            } else {
+                done += n;
+            }
+        }
+        free_chunk(c);
+    }
+    return NULL;
+}
+
+/*
+ * Queues a chunk (its cost is its data length, or ENTRY_COST for a header); entry and data
+ * are freed if it cannot be queued.
+ */
+static int push_chunk(struct bqueue *q, struct archive_entry *entry, char *data, size_t len) {
+    struct pipe_chunk *c;
+    
+    if (!(c = malloc(sizeof(struct pipe_chunk)))) {
+        set_pipe_err(ENOMEM);
+    } else {
+        c->entry = entry;
+        c->data = data;
+        c->len = len;
+        if (bq_push(q, c, len + (entry ? ENTRY_COST : 0)) == 0) {
+            return 0;
+        }
+        set_pipe_err(EIO);
+        free(c);
+    }
+    if (entry) {
+        archive_entry_free(entry);
+    }
+    free(data);
+    return -1;
 }
 
+static void free_chunk(void *x) {
+    struct pipe_chunk *c = (struct pipe_chunk *)x;
+    
+    if (c->entry) {
+        archive_entry_free(c->entry);
+    }
+    free(c->data);
+    free(c);
+}
+
+/*
+ * Only first error is kept.
+ */
+static void set_pipe_err(int err) {
+    int none = 0;
+    
+    atomic_compare_exchange_strong(&pl.err, &none, err);
+}
+
+/*
+ * Opens new archive with our own write callbacks, that gzip tar stream in parallel.
+ */
+static int open_parallel_gzip(int threads) {
+    pgz.num_blocks = 2 * threads;
+    if (!(pgz.blocks = calloc(pgz.num_blocks, sizeof(struct pgz_block)))) {
+        archive_set_error(archive, ENOMEM, "%s", strerror(ENOMEM));
+        return ARCHIVE_FATAL;
+    }
+    pthread_mutex_init(&pgz.lck, NULL);
+    pthread_cond_init(&pgz.done, NULL);
+    // if pool cannot be created, blocks are compressed by this thread
+    pgz.pool = thpool_new(threads);
+    return archive_write_open(archive, &pgz, NULL, pgz_write, pgz_close);
+}
+
+static la_ssize_t pgz_write(struct archive *a, void *client_data, const void *buff, size_t len) {
+    size_t done = 0;
+    
+    while (done < len && !atomic_load(&pl.err)) {
+        struct pgz_block *b = &pgz.blocks[pgz.submitted % pgz.num_blocks];
+        size_t n = PGZ_BLOCK - b->in_len;
+        
+        if (!b->in && !(b->in = malloc(PGZ_BLOCK))) {
+            set_pipe_err(ENOMEM);
+            break;
+        }
+        if (n > len - done) {
+            n = len - done;
+        }
+        memcpy(b->in + b->in_len, (const char *)buff + done, n);
+        b->in_len += n;
+        done += n;
+        if (b->in_len == PGZ_BLOCK) {
+            pgz_submit();
+        }
+    }
+    if (atomic_load(&pl.err)) {
+        archive_set_error(a, atomic_load(&pl.err), "%s", strerror(atomic_load(&pl.err)));
+        return -1;
+    }
+    return len;
+}
+
+static int pgz_close(struct archive *a, void *client_data) {
+    if (pgz.blocks[pgz.submitted % pgz.num_blocks].in_len) {
+        pgz_submit();
+    }
+    while (pgz.written < pgz.submitted) {
+        pgz_flush_oldest();
+    }
+    pgz_free();
+    return close_output() == -1 ? ARCHIVE_FATAL : ARCHIVE_OK;
+}
+
+/*
+ * Hands current block to the pool, then makes sure next block is free to be filled,
+ * queuing the oldest compressed member if every block is in flight.
+ */
+static void pgz_submit(void) {
+    struct pgz_block *b = &pgz.blocks[pgz.submitted % pgz.num_blocks];
+    
+    b->busy = 1;
+    if (!pgz.pool || thpool_add(pgz.pool, pgz_compress, b) == -1) {
+        pgz_compress(b);
+    }
+    pgz.submitted++;
+    while (pgz.submitted - pgz.written >= pgz.num_blocks) {
+        pgz_flush_oldest();
+    }
+}
+
+/*
+ * Compressed member is handed to the writer stage, that will free it.
+ */
+static void pgz_flush_oldest(void) {
+    struct pgz_block *b = &pgz.blocks[pgz.written % pgz.num_blocks];
+    
+    pthread_mutex_lock(&pgz.lck);
+    while (b->busy) {
+        pthread_cond_wait(&pgz.done, &pgz.lck);
+    }
+    pthread_mutex_unlock(&pgz.lck);
+    if (!b->out) {
+        set_pipe_err(ENOMEM);
+    } else if (atomic_load(&pl.err)) {
+        free(b->out);
+    } else {
+        push_chunk(pl.out_q, NULL, (char *)b->out, b->out_len);
+    }
+    b->out = NULL;
+    b->out_len = 0;
+    b->in_len = 0;
+    pgz.written++;
+}
+
+static void pgz_compress(void *x) {
+    struct pgz_block *b = (struct pgz_block *)x;
+    z_stream z = {0};
+    int level = config.archive_level >= 0 ? config.archive_level : Z_DEFAULT_COMPRESSION;
+    
+    // windowBits + 16: write a gzip header and trailer around deflate stream
+    if (deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+        uLong bound = deflateBound(&z, b->in_len);
+        
+        if ((b->out = malloc(bound))) {
+            z.next_in = b->in;
+            z.avail_in = b->in_len;
+            z.next_out = b->out;
+            z.avail_out = bound;
+            if (deflate(&z, Z_FINISH) == Z_STREAM_END) {
+                b->out_len = z.total_out;
+            } else {
+                free(b->out);
+                b->out = NULL;
+            }
+        }
+        deflateEnd(&z);
+    }
+    pthread_mutex_lock(&pgz.lck);
+    b->busy = 0;
+    pthread_cond_broadcast(&pgz.done);
+    pthread_mutex_unlock(&pgz.lck);
+}
+
+static void pgz_free(void) {
+    if (pgz.pool) {
+        thpool_free(pgz.pool);
+        pgz.pool = NULL;
+    }
+    if (pgz.blocks) {
+        for (int i = 0; i < pgz.num_blocks; i++) {
+            free(pgz.blocks[i].in);
+            free(pgz.blocks[i].out);
+        }
+        free(pgz.blocks);
+        pgz.blocks = NULL;
+        pthread_mutex_destroy(&pgz.lck);
+        pthread_cond_destroy(&pgz.done);
+    }
+}
+
+/*
+ * Selected archives are fully extracted; selected archive members
+ * (see archive_member_offset()) are extracted on their own, one archive at a time.
+ */
 int extract_file(void) {
-    int ret = 0;
+    const char *ext;
+    int ret = 0, len;
     
-    for (int i = 0; i < thread_h->num_selected; i++) {
-        if (is_ext(thread_h->selected_files[i], arch_ext, NUM(arch_ext))) {
-            ret += try_extractor(thread_h->selected_files[i]);
+    for (int i = 0; i < thread_h->num_selected && !atomic_load(&thread_h->cancel); i++) {
+        if (!strlen(thread_h->selected_files[i])) {
+            // member already extracted together with a previous one
+            continue;
+        }
+        if ((len = archive_member_offset(thread_h->selected_files[i]))) {
+            ret += extract_members(i, len);
+        } else if ((ext = get_archive_ext(thread_h->selected_files[i])) && !strcmp(ext, DEDUP_EXT)) {
+            ret += extract_dedup_archive(thread_h->selected_files[i], &thread_h->cancel);
+        } else if (is_ext(thread_h->selected_files[i], arch_ext, NUM(arch_ext))) {
+            ret += try_extractor(thread_h->selected_files[i], NULL, 0);
         } else {
             ret--;
         }
@@ -88,83 +674,546 @@ int extract_file(void) {
     return !ret ? 0 : -1;
 }
 
+/*
+ * Extracts every selected member of the archive whose path is
+ * the first len chars of first selected one.
+ * Following selected members of the same archive are cleared from the list.
+ */
+static int extract_members(int first, int len) {
+    char archive_path[PATH_MAX + 1] = {0};
+    const char **members;
+    int num = 0, ret;
+    
+    if (!(members = malloc(sizeof(char *) * (thread_h->num_selected - first)))) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        return -1;
+    }
+    strncpy(archive_path, thread_h->selected_files[first], len);
+    for (int i = first; i < thread_h->num_selected; i++) {
+        if (!strncmp(thread_h->selected_files[i], archive_path, len) && thread_h->selected_files[i][len] == '/') {
+            members[num++] = thread_h->selected_files[i] + len + 1;
+        }
+    }
+    ret = try_extractor(archive_path, members, num);
+    for (int i = first + 1; i < thread_h->num_selected; i++) {
+        if (!strncmp(thread_h->selected_files[i], archive_path, len) && thread_h->selected_files[i][len] == '/') {
+            thread_h->selected_files[i][0] = '\0';
+        }
+    }
+    free(members);
+    return ret;
+}
+
 #if ARCHIVE_VERSION_NUMBER >= 3002000
+/*
+ * Asks main thread for a passphrase: threads reading archives concurrently wait their turn,
+ * as there is only one passphrase buffer. Each of them gets its own copy of the answer.
+ */
 static const char *passphrase_callback(struct archive *a, void *_client_data) {
+    static __thread char pwd[sizeof(passphrase)];
+    const char *ret = NULL;
     uint64_t u = 1;
     
-    if (eventfd_write(archive_cb_fd[0], u) == -1) {
-        return NULL;
-    }
-    if (eventfd_read(archive_cb_fd[1], &u) == -1) {
-        return NULL;
-    }
-    if (quit || passphrase[0] == 27) {
-        return NULL;
+    pthread_mutex_lock(&passphrase_lck);
+    if (eventfd_write(archive_cb_fd[0], u) == 0 && eventfd_read(archive_cb_fd[1], &u) == 0 &&
+        !quit && passphrase[0] != 27) {
+        strncpy(pwd, passphrase, sizeof(pwd) - 1);
+        ret = pwd;
     }
-    return passphrase;
+    pthread_mutex_unlock(&passphrase_lck);
+    return ret;
 }
 #endif
 
-static int try_extractor(const char *tmp) {
+/*
+ * Archive is extracted inside its own dir.
+ * If members is not NULL, only those members (and whatever is below them) are extracted.
+ * Zip and 7z members are independent: they are extracted by a pool of threads,
+ * each one with its own reader; other formats are streamed by this thread.
+ * Dirs get their perms and times only once every entry was written (see save_dir_fixup()).
+ */
+static int try_extractor(const char *tmp, const char **members, int num_members) {
+    char path[PATH_MAX + 1] = {0};
+    struct extract_ctx ctx = {0};
     struct archive *a;
+    int workers, ret = -1;
+    
+    strncpy(path, tmp, PATH_MAX);
+    ctx.archive_path = tmp;
+    ctx.current_dir = dirname(path);
+    ctx.cancel = &thread_h->cancel;
+    ctx.members = members;
+    ctx.num_members = num_members;
+    ctx.last_header = -1;
+    if (members && (ctx.last_header = last_member_header(&ctx)) == -2) {
+        return -1;
+    }
+    if (!(ctx.top_names = strmap_new(0))) {
+        return -1;
+    }
+    if (!(ctx.dirs = tmpfile())) {
+        strmap_free(ctx.top_names, free);
+        return -1;
+    }
+    pthread_mutex_init(&ctx.dirs_lck, NULL);
+    workers = count_workers(&ctx);
+    if (workers > 1) {
+        ret = parallel_extract(&ctx, workers);
+    } else if ((a = open_extract_archive(tmp))) {
+        ret = extractor_thread(a, &ctx, 0, 1);
+    }
+    apply_dir_fixups(&ctx);
+    fclose(ctx.dirs);
+    pthread_mutex_destroy(&ctx.dirs_lck);
+    strmap_free(ctx.top_names, free);
+    return ret;
+}
 
-    a = archive_read_new();
+/*
+ * Returns the position of the last header that must be extracted, read from archive's
+ * cached index (eg: the one built while browsing it), so that the archive is not read
+ * past it: pulling a small file from the head of a big tarball only decompresses its head.
+ * Returns -1 if there's no up to date index, -2 if no selected member is inside the archive.
+ * Index is never built here, as that would read the whole archive once more.
+ */
+static int last_member_header(const struct extract_ctx *ctx) {
+    struct arch_index *idx;
+    int ordinal = 0, last = -2;
+    
+    if (!(idx = arch_index_cached(ctx->archive_path))) {
+        return -1;
+    }
+    for (int i = 0; i < idx->num_entries; i++) {
+        if (idx->entries[i].depth) {
+            continue;
+        }
+        if (member_offset(ctx, skip_root(idx->entries[i].name)) != -1) {
+            last = ordinal;
+        }
+        ordinal++;
+    }
+    arch_index_put(idx);
+    return last;
+}
+
+/*
+ * Selected members are extracted without their parent dirs:
+ * returns how many chars must be dropped from name, or -1 if name is not a selected
+ * member nor below one (the outermost one wins if they are nested).
+ * Every name matches, with nothing to drop, when the whole archive is extracted.
+ */
+static int member_offset(const struct extract_ctx *ctx, const char *name) {
+    int len, min_len = -1;
+    const char *parent;
+    
+    if (!ctx->members) {
+        return 0;
+    }
+    for (int i = 0; i < ctx->num_members; i++) {
+        len = strlen(ctx->members[i]);
+        if (!strncmp(name, ctx->members[i], len) && (name[len] == '\0' || name[len] == '/') &&
+            (min_len == -1 || len < min_len)) {
+            min_len = len;
+            parent = ctx->members[i];
+        }
+    }
+    if (min_len == -1) {
+        return -1;
+    }
+    for (len = min_len; len && parent[len - 1] != '/'; len--);
+    return len;
+}
+
+/*
+ * Drops leading "/" and "./" from an entry name.
+ */
+static const char *skip_root(const char *name) {
+    while (*name == '/' || !strncmp(name, "./", 2)) {
+        name += *name == '/' ? 1 : 2;
+    }
+    return name;
+}
+
+/*
+ * Opens path for reading with every supported filter and format;
+ * passphrase of encrypted members is asked to user.
+ */
+struct archive *open_extract_archive(const char *path) {
+    struct archive *a;
+    struct stat sb;
+    
+    if (!(a = archive_read_new())) {
+        return NULL;
+    }
     archive_read_support_filter_all(a);
     archive_read_support_format_all(a);
 #if ARCHIVE_VERSION_NUMBER >= 3002000
     archive_read_set_passphrase_callback(a, NULL, passphrase_callback);
 #endif
-    if ((a) && (archive_read_open_filename(a, tmp, BUFF_SIZE) == ARCHIVE_OK)) {
-        char path[PATH_MAX + 1] = {0};
-        
-        strncpy(path, tmp, PATH_MAX);
-        char *current_dir = dirname(path);
-        extractor_thread(a, current_dir);
-        return 0;
+    if (!stat(path, &sb) && archive_read_open_filename(a, path, io_block_size(sb.st_size)) == ARCHIVE_OK) {
+        return a;
     }
     archive_read_free(a);
-    return -1;
+    return NULL;
+}
+
+/*
+ * Returns number of threads that will extract a zip/7z archive,
+ * or 1 if archive must be streamed (other formats, or encrypted members,
+ * as passphrase can only be asked once at a time).
+ * For zip/7z, every top level name is mapped here, as workers can only read ctx->top_names.
+ */
+static int count_workers(struct extract_ctx *ctx) {
+    struct archive *a;
+    struct archive_entry *entry;
+    int threads = config.archive_threads > 0 ? config.archive_threads : thpool_default_size();
+    int fmt, r = ARCHIVE_FATAL, off, num = 0;
+    const char *name;
+    
+    if (threads < 2 || !(a = open_extract_archive(ctx->archive_path))) {
+        return 1;
+    }
+    // only headers are read: zip's central directory is enough to list its members
+    while (!extract_cancelled(ctx) && ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN)) {
+        fmt = archive_format(a) & ARCHIVE_FORMAT_BASE_MASK;
+        if (fmt != ARCHIVE_FORMAT_ZIP && fmt != ARCHIVE_FORMAT_7ZIP) {
+            break;
+        }
+#if ARCHIVE_VERSION_NUMBER >= 3002000
+        if (archive_entry_is_encrypted(entry)) {
+            break;
+        }
+#endif
+        name = skip_root(archive_entry_pathname(entry));
+        if ((off = member_offset(ctx, name)) == -1) {
+            continue;
+        }
+        if (!map_entry_name(ctx, name + off, NULL) ||
+            (archive_entry_hardlink(entry) && !map_entry_name(ctx, hardlink_name(ctx, entry), NULL))) {
+            break;
+        }
+        num++;
+    }
+    archive_read_free(a);
+    if (r != ARCHIVE_EOF || !num) {
+        return 1;
+    }
+    return num < threads ? num : threads;
 }
 
 /*
- * calculates current_dir path, then creates the write_disk_archive that
- * will read from the selected archives and will write files on disk.
- * While there are headers inside the archive being read, it goes on copying data from
- * the read archive to the disk.
+ * Worker i extracts members i, i + workers, i + 2 * workers...
+ * skipping the others without decompressing them.
  */
-static void extractor_thread(struct archive *a, const char *current_dir) {
+static int parallel_extract(struct extract_ctx *ctx, int workers) {
+    struct extract_job *jobs;
+    struct thpool *pool;
+    int ret = 0;
+    
+    if (!(jobs = calloc(workers, sizeof(struct extract_job))) || !(pool = thpool_new(workers))) {
+        struct archive *a;
+        
+        free(jobs);
+        return (a = open_extract_archive(ctx->archive_path)) ? extractor_thread(a, ctx, 0, 1) : -1;
+    }
+    for (int i = 0; i < workers; i++) {
+        jobs[i].ctx = ctx;
+        jobs[i].first = i;
+        jobs[i].stride = workers;
+        if (thpool_add(pool, extract_job, &jobs[i]) == -1) {
+            extract_job(&jobs[i]);
+        }
+    }
+    thpool_wait(pool);
+    thpool_free(pool);
+    for (int i = 0; i < workers; i++) {
+        ret |= jobs[i].ret;
+    }
+    free(jobs);
+    return ret;
+}
+
+static void extract_job(void *x) {
+    struct extract_job *job = (struct extract_job *)x;
+    struct archive *a = open_extract_archive(job->ctx->archive_path);
+    
+    job->ret = a ? extractor_thread(a, job->ctx, job->first, job->stride) : -1;
+}
+
+/*
+ * Entries are extracted inside current_dir, but an existing file/dir must not be
+ * overwritten: if entry's top level name already exists there, a number is appended to it
+ * (eg: foo/bar is extracted as foo1/bar), shortening the name only if it would not fit.
+ * Existence is checked only the first time a top level name is met:
+ * every entry below it is then extracted under the same name.
+ * Chosen names are reserved too (keyed as "/name", as no top level name holds a '/'),
+ * so that two top level names are never mapped to the same one.
+ * Writes entry's destination path in fullpath (if not NULL); returns NULL if out of memory.
+ */
+const char *map_entry_name(struct extract_ctx *ctx, const char *name, char *fullpath) {
+    char top[PATH_MAX + 1] = {0}, new_top[PATH_MAX + 2] = {0}, path[PATH_MAX + 1] = {0};
+    const char *rest;
+    char *mapped, *reserved;
+    int len, digits;
+    
+    name = skip_root(name);
+    rest = strchrnul(name, '/');
+    if (rest == name) {
+        // "./" entry is current_dir itself
+        if (fullpath) {
+            strncpy(fullpath, ctx->current_dir, PATH_MAX);
+        }
+        return ctx->current_dir;
+    }
+    len = rest - name > PATH_MAX ? PATH_MAX : rest - name;
+    strncpy(top, name, len);
+    if (!(mapped = strmap_get(ctx->top_names, top))) {
+        snprintf(new_top, sizeof(new_top), "/%s", top);
+        snprintf(path, PATH_MAX, "%s/%s", ctx->current_dir, top);
+        for (int num = 1; !access(path, F_OK) || strmap_get(ctx->top_names, new_top); num++) {
+            digits = snprintf(NULL, 0, "%d", num);
+            snprintf(new_top, sizeof(new_top), "/%.*s%d", len + digits > NAME_MAX ? NAME_MAX - digits : len, top, num);
+            snprintf(path, PATH_MAX, "%s/%s", ctx->current_dir, new_top + 1);
+        }
+        if (!(mapped = strdup(new_top + 1)) || strmap_put(ctx->top_names, top, mapped) == -1) {
+            free(mapped);
+            return NULL;
+        }
+        if (!(reserved = strdup("")) || strmap_put(ctx->top_names, new_top, reserved) == -1) {
+            free(reserved);
+            return NULL;
+        }
+    }
+    if (fullpath) {
+        snprintf(fullpath, PATH_MAX, "%s/%s%s", ctx->current_dir, mapped, rest);
+    }
+    return mapped;
+}
+
+/*
+ * Blocks are passed from the read archive to the disk one as they are, without copying them
+ * in a buffer of ours; their offsets let sparse files be recreated with their holes.
+ * Memory used does not depend on entry's size: only one block at a time is held by libarchive.
+ * Returns 0 when entry's data is over, 1 if job was cancelled,
+ * -1 if it could not be read, -2 if it could not be written.
+ */
+static int copy_data_blocks(struct archive *a, struct archive *ext, const struct extract_ctx *ctx) {
+    const void *buff;
+    size_t size;
+    la_int64_t offset;
+    int ret;
+    
+    while ((ret = archive_read_data_block(a, &buff, &size, &offset)) == ARCHIVE_OK) {
+        if (archive_write_data_block(ext, buff, size, offset) < ARCHIVE_WARN) {
+            return -2;
+        }
+        if (extract_cancelled(ctx)) {
+            return 1;
+        }
+    }
+    return ret == ARCHIVE_EOF ? 0 : -1;
+}
+
+/*
+ * Hardlink target of entry, without the parent dirs of the selected member it is below.
+ */
+static const char *hardlink_name(const struct extract_ctx *ctx, struct archive_entry *entry) {
+    const char *name = skip_root(archive_entry_hardlink(entry));
+    int off = member_offset(ctx, name);
+
+    return off > 0 ? name + off : name;
+}
+
+/*
+ * Writes on disk the entries read from a, starting from first one and then every
+ * stride entries (see parallel_extract()); data of other entries is skipped.
+ * Only selected members count, if any: archive is not read past the last of them,
+ * when its position is known.
+ * Entries (and their hardlink targets) are moved inside ctx->current_dir (see map_entry_name()).
+ * An entry that cannot be written is reported, then next ones are extracted anyway.
+ * Job's cancel flag is checked for every entry and every data block.
+ * Frees a.
+ */
+static int extractor_thread(struct archive *a, struct extract_ctx *ctx, int first, int stride) {
     struct archive *ext;
     struct archive_entry *entry;
-    int flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_FFLAGS;
-    char buff[BUFF_SIZE], fullpathname[PATH_MAX + 1];
-    char name[PATH_MAX + 1] = {0}, tmp_name[PATH_MAX + 1] = {0};
-
-    ext = archive_write_disk_new();
-    archive_write_disk_set_options(ext, flags);
-    archive_write_disk_set_standard_lookup(ext);
-    while (archive_read_next_header(a, &entry) != ARCHIVE_EOF) {
-        strncpy(name, archive_entry_pathname(entry), PATH_MAX);
-        int num = 0;
-        /* avoid overwriting a file/dir in path if it has the same name of a file being extracted there */
-        if (strchr(name, '/')) {
-            strncpy(tmp_name, strchr(name, '/'), PATH_MAX);
-        } else {
-            tmp_name[0] = '\0';
+    char fullpathname[PATH_MAX + 1];
+    const char *name;
+    int r = ARCHIVE_FATAL, off, is_dir, dirs = 0, ret = 0;
+    
+    if (!(ext = new_disk_writer())) {
+        archive_read_free(a);
+        return -1;
+    }
+    for (int i = 0, h = 0; !extract_cancelled(ctx) &&
+         ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN); h++) {
+        if (ctx->last_header != -1 && h > ctx->last_header) {
+            r = ARCHIVE_EOF;
+            break;
+        }
+        name = skip_root(archive_entry_pathname(entry));
+        if ((off = member_offset(ctx, name)) == -1) {
+            // tar data is skipped by seeking when possible, zip members are not even reached
+            archive_read_data_skip(a);
+            continue;
         }
-        int len = strlen(name) - strlen(tmp_name);
-        while (access(name, F_OK) == 0) {
-            num++;
-            snprintf(name + len, PATH_MAX - len, "%d%s", num, tmp_name);
+        if (i++ % stride != first) {
+            continue;
+        }
+        if (!map_entry_name(ctx, name + off, fullpathname)) {
+            ret = -1;
+            break;
         }
-        snprintf(fullpathname, PATH_MAX, "%s/%s", current_dir, name);
         archive_entry_set_pathname(entry, fullpathname);
-        archive_write_header(ext, entry);
-        len = archive_read_data(a, buff, sizeof(buff));
-        while (len > 0) {
-            archive_write_data(ext, buff, len);
-            len = archive_read_data(a, buff, sizeof(buff));
+        is_dir = archive_entry_filetype(entry) == AE_IFDIR && strcmp(fullpathname, ctx->current_dir);
+        if (is_dir && save_dir_fixup(ctx, entry, fullpathname) == -1) {
+            ret = -1;
+            break;
+        }
+        archive_write_disk_set_options(ext, is_dir ? EXTRACT_DIR_FLAGS : EXTRACT_FLAGS);
+        if (archive_entry_hardlink(entry)) {
+            if (!map_entry_name(ctx, hardlink_name(ctx, entry), fullpathname)) {
+                ret = -1;
+                break;
+            }
+            archive_entry_set_hardlink(entry, fullpathname);
         }
+        if (extract_entry(a, ext, entry, ctx) == -1) {
+            ret = -1;
+        }
+        /*
+         * disk writer keeps each dir in memory to fix its mode at the end:
+         * flush them once in a while, so that memory does not grow with the number of dirs.
+         * Flushed dirs only get owner-only perms, so entries below them can still be written:
+         * their own perms and times are restored by apply_dir_fixups().
+         */
+        if (archive_entry_filetype(entry) == AE_IFDIR && ++dirs == EXTRACT_MAX_DIRS) {
+            archive_write_free(ext);
+            dirs = 0;
+            if (!(ext = new_disk_writer())) {
+                archive_read_free(a);
+                return -1;
+            }
+        }
+    }
+    if (r != ARCHIVE_EOF && !extract_cancelled(ctx)) {
+        ERROR(archive_error_string(a));
+    }
+    if (r != ARCHIVE_EOF) {
+        ret = -1;
     }
     archive_read_free(a);
     archive_write_free(ext);
+    return ret;
+}
+
+static struct archive *new_disk_writer(void) {
+    struct archive *ext;
+    
+    if ((ext = archive_write_disk_new())) {
+        archive_write_disk_set_options(ext, EXTRACT_FLAGS);
+        archive_write_disk_set_standard_lookup(ext);
+    }
+    return ext;
+}
+
+/*
+ * Writes entry (already moved to its destination) with its data.
+ * If it cannot be written, or job is cancelled while its data is being written,
+ * whatever was written of it is removed: no truncated file is left behind.
+ */
+static int extract_entry(struct archive *a, struct archive *ext, struct archive_entry *entry, const struct extract_ctx *ctx) {
+    int r;
+    
+    if ((r = archive_write_header(ext, entry)) < ARCHIVE_WARN) {
+        ERROR(archive_entry_pathname(entry));
+        ERROR(archive_error_string(ext));
+        return -1;
+    }
+    if (r == ARCHIVE_WARN) {
+        WARN(archive_error_string(ext));
+    }
+    if ((r = copy_data_blocks(a, ext, ctx)) == 0 && (r = archive_write_finish_entry(ext)) >= ARCHIVE_WARN) {
+        return 0;
+    }
+    if (r != 1) {
+        ERROR(archive_entry_pathname(entry));
+        ERROR(archive_error_string(r == -1 ? a : ext));
+    }
+    archive_write_finish_entry(ext);
+    // a dir may already hold entries extracted before
+    if (archive_entry_filetype(entry) != AE_IFDIR) {
+        unlink(archive_entry_pathname(entry));
+    }
+    return -1;
+}
+
+static int extract_cancelled(const struct extract_ctx *ctx) {
+    return ctx->cancel && atomic_load(ctx->cancel);
+}
+
+/*
+ * A dir is written owner-only, without its times (nor ACLs and file flags, that could
+ * forbid writing inside it), then it is fixed by apply_dir_fixups():
+ * disk writer would fix it as soon as it is freed, while entries below it may still be
+ * written by any worker (changing its mtime again, or failing if it is read-only).
+ * Dirs are saved on disk, so that memory does not grow with their number.
+ */
+static int save_dir_fixup(struct extract_ctx *ctx, struct archive_entry *entry, const char *path) {
+    struct dir_fixup f = {
+        .mode = archive_entry_perm(entry),
+        .times[0].tv_nsec = UTIME_OMIT,
+        .times[1].tv_nsec = UTIME_OMIT,
+        .len = strlen(path),
+    };
+    int ret = 0;
+    
+    if (archive_entry_atime_is_set(entry)) {
+        f.times[0] = (struct timespec) {archive_entry_atime(entry), archive_entry_atime_nsec(entry)};
+    }
+    if (archive_entry_mtime_is_set(entry)) {
+        f.times[1] = (struct timespec) {archive_entry_mtime(entry), archive_entry_mtime_nsec(entry)};
+    }
+    archive_entry_set_perm(entry, S_IRWXU);
+    pthread_mutex_lock(&ctx->dirs_lck);
+    if (fwrite(path, 1, f.len, ctx->dirs) != f.len || fwrite(&f, sizeof(f), 1, ctx->dirs) != 1) {
+        ERROR("could not save extracted dirs.");
+        ret = -1;
+    }
+    pthread_mutex_unlock(&ctx->dirs_lck);
+    return ret;
+}
+
+/*
+ * Dirs are fixed from last extracted one, so that a dir is fixed after the ones below it
+ * (a dir without exec permission could not be entered anymore).
+ * A dir is never followed if it was replaced by a symlink.
+ */
+static void apply_dir_fixups(struct extract_ctx *ctx) {
+    struct dir_fixup f;
+    char path[PATH_MAX + 1];
+    off_t pos;
+    int fd;
+    
+    if (fflush(ctx->dirs) == EOF || (pos = ftello(ctx->dirs)) == -1) {
+        return;
+    }
+    while (pos >= (off_t)sizeof(f)) {
+        if (pread(fileno(ctx->dirs), &f, sizeof(f), pos - sizeof(f)) != sizeof(f) || f.len > PATH_MAX ||
+            pos < (off_t)(sizeof(f) + f.len) ||
+            pread(fileno(ctx->dirs), path, f.len, pos - sizeof(f) - f.len) != (ssize_t)f.len) {
+            ERROR("could not read extracted dirs.");
+            return;
+        }
+        pos -= sizeof(f) + f.len;
+        path[f.len] = '\0';
+        if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) == -1) {
+            continue;
+        }
+        if (fchmod(fd, f.mode & 07777) == -1 || futimens(fd, f.times) == -1) {
+            WARN(path);
+        }
+        close(fd);
+    }
 }
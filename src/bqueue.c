@@ -0,0 +1,140 @@
+#include "../inc/bqueue.h"
+
+/*
+ * Single item queued in a bounded queue.
+ */
+struct bq_node {
+    void *item;
+    size_t cost;
+    struct bq_node *next;
+};
+
+/*
+ * Fifo of items shared between a producer and a consumer thread.
+ * Every item has a cost (eg: its size in bytes): producer is blocked
+ * while the cost of queued items would go beyond max_cost.
+ * closed: producer will not push anymore; consumer gets NULL once queue is drained.
+ * aborted: both sides give up straight away.
+ */
+struct bqueue {
+    struct bq_node *head, *tail;
+    size_t cost, max_cost;
+    int closed;
+    int aborted;
+    pthread_mutex_t lck;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+};
+
+/*
+ * Returns NULL if queue could not be allocated.
+ */
+struct bqueue *bq_new(size_t max_cost) {
+    struct bqueue *q;
+    
+    if (!(q = calloc(1, sizeof(struct bqueue)))) {
+        return NULL;
+    }
+    q->max_cost = max_cost;
+    pthread_mutex_init(&q->lck, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    return q;
+}
+
+/*
+ * Appends item to the queue, waiting for enough room.
+ * An item costing more than max_cost is accepted when the queue is empty.
+ * Returns -1 if queue was aborted (or node could not be allocated):
+ * item is then still owned by caller.
+ */
+int bq_push(struct bqueue *q, void *item, size_t cost) {
+    struct bq_node *node;
+    
+    if (!(node = malloc(sizeof(struct bq_node)))) {
+        bq_abort(q);
+        return -1;
+    }
+    node->item = item;
+    node->cost = cost;
+    node->next = NULL;
+    pthread_mutex_lock(&q->lck);
+    while (q->head && q->cost + cost > q->max_cost && !q->aborted) {
+        pthread_cond_wait(&q->not_full, &q->lck);
+    }
+    if (q->aborted) {
+        pthread_mutex_unlock(&q->lck);
+        free(node);
+        return -1;
+    }
+    if (q->tail) {
+        q->tail->next = node;
+    } else {
+        q->head = node;
+    }
+    q->tail = node;
+    q->cost += cost;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lck);
+    return 0;
+}
+
+/*
+ * Returns oldest item, waiting for one to be pushed.
+ * Returns NULL when queue is closed and drained, or aborted.
+ */
+void *bq_pop(struct bqueue *q) {
+    struct bq_node *node;
+    void *item = NULL;
+    
+    pthread_mutex_lock(&q->lck);
+    while (!q->head && !q->closed && !q->aborted) {
+        pthread_cond_wait(&q->not_empty, &q->lck);
+    }
+    if (q->head && !q->aborted) {
+        node = q->head;
+        q->head = node->next;
+        if (!q->head) {
+            q->tail = NULL;
+        }
+        q->cost -= node->cost;
+        item = node->item;
+        free(node);
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lck);
+    return item;
+}
+
+void bq_close(struct bqueue *q) {
+    pthread_mutex_lock(&q->lck);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lck);
+}
+
+void bq_abort(struct bqueue *q) {
+    pthread_mutex_lock(&q->lck);
+    q->aborted = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lck);
+}
+
+/*
+ * Frees the queue, and every item still inside it through free_item.
+ * No thread must be using the queue anymore.
+ */
+void bq_free(struct bqueue *q, void (*free_item)(void *)) {
+    struct bq_node *node;
+    
+    while ((node = q->head)) {
+        q->head = node->next;
+        free_item(node->item);
+        free(node);
+    }
+    pthread_mutex_destroy(&q->lck);
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    free(q);
+}
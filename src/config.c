@@ -120,6 +120,14 @@ static void read_config_file(const char *dir) {
             strncpy(config.sysinfo_layout, sysinfo, sizeof(config.sysinfo_layout));
         }
         config_lookup_int(&cfg, "safe", &config.safe);
+        config_lookup_int(&cfg, "archive_search_depth", &config.archive_search_depth);
+        config_lookup_int(&cfg, "archive_threads", &config.archive_threads);
+        config_lookup_int(&cfg, "archive_level", &config.archive_level);
+        config_lookup_int(&cfg, "parallel_gzip", &config.parallel_gzip);
+        config_lookup_int(&cfg, "dir_sizes", &config.dir_sizes);
+        config_lookup_int(&cfg, "type_colors", &config.type_colors);
+        config_lookup_int(&cfg, "dir_cache_size", &config.dir_cache_size);
+        config_lookup_int(&cfg, "dir_cache_mb", &config.dir_cache_mb);
     } else {
         fprintf(stderr, "Config file: %s at line %d.\n",
                 config_error_text(&cfg),
@@ -149,4 +157,13 @@ void config_checks(void) {
     if (config.safe < UNSAFE || config.safe > FULL_SAFE) {
         config.safe = FULL_SAFE;
     }
+    if (config.archive_search_depth < 0) {
+        config.archive_search_depth = 0;
+    }
+    if (config.archive_threads < 0) {
+        config.archive_threads = 0;
+    }
+    if (config.archive_level < -1) {
+        config.archive_level = -1;
+    }
 }
@@ -629,7 +629,7 @@ static void fix_tab_cwd(void) {
             i++;
             strncpy(ps[j].my_cwd, dirname(ps[j].my_cwd), PATH_MAX);
         }
-        if (i && ps[j].mode <= fast_browse_) {
+        if (i && ps[j].mode <= filter_) {
             change_dir(ps[j].my_cwd, j);
         }
     }
@@ -0,0 +1,283 @@
+#include "../inc/dircache.h"
+
+static struct dir_listing *find_listing(const char *path, const struct stat *sb,
+                                        int (*cmp)(const struct dirent **, const struct dirent **));
+static int scan_dir(const char *path, int (*cmp)(const struct dirent **, const struct dirent **),
+                    struct dir_listing *l);
+static int not_dot(const struct dirent *de);
+static int fill_list(const struct dir_listing *l, int hidden, char (**nl)[PATH_MAX + 1]);
+static void store_listing(struct dir_listing *l);
+static struct dir_listing *lru_listing(void);
+static void drop_listing(struct dir_listing *l);
+static void prefetch_job(void *x);
+
+/*
+ * listings has config.dir_cache_size slots (a slot is free when its path is NULL),
+ * taking mem bytes overall. Dirs are prefetched by a single, low priority thread;
+ * lck protects listings and queue.
+ */
+static struct dir_listing *listings;
+static size_t mem;
+static unsigned long used;
+static struct thpool *pool;
+static struct prefetch_req queue[PREFETCH_QUEUE_SIZE];
+static int queue_top, queue_len;
+static pthread_mutex_t lck = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int stop;
+
+/*
+ * Fills nl with path's entries sorted by cmp (hidden ones only if hidden is set),
+ * as "path/name", from its cached listing; if there is none, path is read and cached.
+ * Returns their number, or -1 if dir cannot be read (or without memory).
+ */
+int dircache_list(const char *path, int (*cmp)(const struct dirent **, const struct dirent **),
+                  int hidden, char (**nl)[PATH_MAX + 1]) {
+    struct dir_listing *l, fresh;
+    struct stat sb;
+    int num;
+    
+    if (stat(path, &sb) == -1) {
+        return -1;
+    }
+    pthread_mutex_lock(&lck);
+    if ((l = find_listing(path, &sb, cmp))) {
+        l->used = ++used;
+        num = fill_list(l, hidden, nl);
+        pthread_mutex_unlock(&lck);
+        return num;
+    }
+    pthread_mutex_unlock(&lck);
+    if (scan_dir(path, cmp, &fresh) == -1) {
+        return -1;
+    }
+    num = fill_list(&fresh, hidden, nl);
+    pthread_mutex_lock(&lck);
+    store_listing(&fresh);
+    pthread_mutex_unlock(&lck);
+    return num;
+}
+
+/*
+ * Asks background thread to read path's listing, sorted by cmp, if it is not cached yet.
+ */
+void dircache_prefetch(const char *path, int (*cmp)(const struct dirent **, const struct dirent **)) {
+    pthread_mutex_lock(&lck);
+    if (!atomic_load(&stop) && (pool || (pool = thpool_new(1)))) {
+        strncpy(queue[queue_top].path, path, PATH_MAX);
+        queue[queue_top].cmp = cmp;
+        queue_top = (queue_top + 1) % PREFETCH_QUEUE_SIZE;
+        if (queue_len < PREFETCH_QUEUE_SIZE) {
+            queue_len++;
+        }
+        // a job is added for each request: the ones whose request was forgotten just return
+        thpool_add(pool, prefetch_job, NULL);
+    }
+    pthread_mutex_unlock(&lck);
+}
+
+/*
+ * Something changed inside path: its listings are read again next time.
+ */
+void dircache_invalidate(const char *path) {
+    pthread_mutex_lock(&lck);
+    for (int i = 0; listings && i < config.dir_cache_size; i++) {
+        if (listings[i].path && !strcmp(listings[i].path, path)) {
+            drop_listing(&listings[i]);
+        }
+    }
+    pthread_mutex_unlock(&lck);
+}
+
+/*
+ * Forgets queued prefetches, waits for current one, then frees every listing.
+ */
+void free_dircache(void) {
+    atomic_store(&stop, 1);
+    if (pool) {
+        thpool_free(pool);
+        pool = NULL;
+    }
+    for (int i = 0; listings && i < config.dir_cache_size; i++) {
+        drop_listing(&listings[i]);
+    }
+    free(listings);
+    listings = NULL;
+}
+
+/*
+ * Called with lck held.
+ */
+static struct dir_listing *find_listing(const char *path, const struct stat *sb,
+                                        int (*cmp)(const struct dirent **, const struct dirent **)) {
+    for (int i = 0; listings && i < config.dir_cache_size; i++) {
+        struct dir_listing *l = &listings[i];
+        
+        if (l->path && l->cmp == cmp && l->ino == sb->st_ino && l->dev == sb->st_dev &&
+            l->mtime.tv_sec == sb->st_mtim.tv_sec && l->mtime.tv_nsec == sb->st_mtim.tv_nsec &&
+            !strcmp(l->path, path)) {
+            return l;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Reads path's listing in l. Dir is stat'ed before being read:
+ * if it changes meanwhile, its listing will not be valid anymore.
+ * Returns -1 if it cannot be read (or without memory).
+ */
+static int scan_dir(const char *path, int (*cmp)(const struct dirent **, const struct dirent **),
+                    struct dir_listing *l) {
+    struct dirent **files;
+    struct stat sb;
+    size_t len = 0;
+    char *p;
+    
+    memset(l, 0, sizeof(struct dir_listing));
+    if (stat(path, &sb) == -1 || (l->num = scandir(path, &files, not_dot, cmp)) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < l->num; i++) {
+        len += strlen(files[i]->d_name) + 1;
+    }
+    if ((l->path = strdup(path)) && (p = l->names = malloc(len ? len : 1))) {
+        for (int i = 0; i < l->num; i++) {
+            p = stpcpy(p, files[i]->d_name) + 1;
+        }
+    }
+    for (int i = 0; i < l->num; i++) {
+        free(files[i]);
+    }
+    free(files);
+    if (!l->names) {
+        drop_listing(l);
+        return -1;
+    }
+    l->dev = sb.st_dev;
+    l->ino = sb.st_ino;
+    l->mtime = sb.st_mtim;
+    l->cmp = cmp;
+    l->size = len + strlen(path) + 1 + sizeof(struct dir_listing);
+    return 0;
+}
+
+static int not_dot(const struct dirent *de) {
+    return strcmp(de->d_name, ".");
+}
+
+/*
+ * Fills nl with l's entries as "path/name", skipping hidden ones if !hidden.
+ * Returns their number, or -1 without memory.
+ */
+static int fill_list(const struct dir_listing *l, int hidden, char (**nl)[PATH_MAX + 1]) {
+    const char *name = l->names;
+    int num = 0;
+    
+    if (!(*nl = calloc(l->num ? l->num : 1, sizeof(**nl)))) {
+        return -1;
+    }
+    for (int i = 0; i < l->num; i++, name += strlen(name) + 1) {
+        // same rule as scandir filter used for uncached listings
+        if (name[0] == '.' && !hidden && name[1] != '.') {
+            continue;
+        }
+        snprintf((*nl)[num++], PATH_MAX, "%s/%s", l->path, name);
+    }
+    return num;
+}
+
+/*
+ * Caches l (taking its data), replacing an older listing of same dir and sorting,
+ * then least recently used listings until it fits in memory budget.
+ * It is dropped if it can never fit. Called with lck held.
+ */
+static void store_listing(struct dir_listing *l) {
+    const size_t budget = (size_t)config.dir_cache_mb * 1024 * 1024;
+    struct dir_listing *slot;
+    
+    if (!listings && !(listings = calloc(config.dir_cache_size, sizeof(struct dir_listing)))) {
+        drop_listing(l);
+        return;
+    }
+    for (int i = 0; i < config.dir_cache_size; i++) {
+        if (listings[i].path && listings[i].cmp == l->cmp && !strcmp(listings[i].path, l->path)) {
+            drop_listing(&listings[i]);
+        }
+    }
+    if (l->size > budget) {
+        drop_listing(l);
+        return;
+    }
+    while (mem + l->size > budget && (slot = lru_listing())) {
+        drop_listing(slot);
+    }
+    for (slot = listings; slot < listings + config.dir_cache_size && slot->path; slot++);
+    if (slot == listings + config.dir_cache_size) {
+        slot = lru_listing();
+        drop_listing(slot);
+    }
+    mem += l->size;
+    l->used = ++used;
+    *slot = *l;
+}
+
+/*
+ * Returns least recently used listing, or NULL if there is none. Called with lck held.
+ */
+static struct dir_listing *lru_listing(void) {
+    struct dir_listing *lru = NULL;
+    
+    for (int i = 0; i < config.dir_cache_size; i++) {
+        if (listings[i].path && (!lru || listings[i].used < lru->used)) {
+            lru = &listings[i];
+        }
+    }
+    return lru;
+}
+
+/*
+ * l is either a free slot, or a listing not yet cached (and not counted in mem).
+ */
+static void drop_listing(struct dir_listing *l) {
+    if (l->path && l >= listings && l < listings + config.dir_cache_size) {
+        mem -= l->size;
+    }
+    free(l->path);
+    free(l->names);
+    memset(l, 0, sizeof(struct dir_listing));
+}
+
+/*
+ * Reads most recently asked dir, at lowest priority, unless its listing is already cached.
+ */
+static void prefetch_job(void *x) {
+    char path[PATH_MAX + 1];
+    struct prefetch_req req;
+    struct dir_listing l;
+    struct stat sb;
+    int cached;
+    
+    pthread_mutex_lock(&lck);
+    if (atomic_load(&stop) || !queue_len) {
+        pthread_mutex_unlock(&lck);
+        return;
+    }
+    queue_top = (queue_top + PREFETCH_QUEUE_SIZE - 1) % PREFETCH_QUEUE_SIZE;
+    req = queue[queue_top];
+    queue_len--;
+    pthread_mutex_unlock(&lck);
+    
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    // listings are cached by the path getcwd() returns once dir is entered
+    if (!realpath(req.path, path) || stat(path, &sb) == -1 || !S_ISDIR(sb.st_mode)) {
+        return;
+    }
+    pthread_mutex_lock(&lck);
+    cached = find_listing(path, &sb, req.cmp) != NULL;
+    pthread_mutex_unlock(&lck);
+    if (!cached && scan_dir(path, req.cmp, &l) == 0) {
+        pthread_mutex_lock(&lck);
+        store_listing(&l);
+        pthread_mutex_unlock(&lck);
+    }
+}
@@ -0,0 +1,349 @@
+#include "../inc/du.h"
+
+static void du_job(void *x);
+static off_t du_walk(char *path, size_t len, const struct stat *sb, struct strmap *links);
+static struct du_node **find_node(dev_t dev, ino_t ino);
+static int find_size(const struct stat *sb, off_t *size, time_t *stored);
+static int changed_since(const struct stat *sb, unsigned long since);
+static time_t now_sec(void);
+
+/*
+ * Dirs are summed by a single background thread, so that a big tree never
+ * slows down the UI; du_fd is written every time one is done.
+ * pending holds the dirs already queued, to queue each of them once.
+ * Nodes are chained in buckets by inode; lck protects them and pending.
+ * epoch counts invalidations: a dir is not cached if it was invalidated while it was summed
+ * (the last DU_INVALS invalidated dirs are kept to know it, see changed_since()).
+ */
+static struct thpool *pool;
+static struct strmap *pending;
+static struct du_node **buckets;
+static size_t num_buckets, num_nodes;
+static unsigned long epoch, lost_epoch;
+static struct du_inval invals[DU_INVALS];
+static size_t num_invals;
+static pthread_mutex_t lck = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int stop;
+static int du_fd = -1;
+
+/*
+ * Returns the fd polled by main loop to know that new sizes are ready.
+ */
+int du_init(void) {
+    du_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return du_fd;
+}
+
+/*
+ * Writes recursive size of dir path (sb is its stat) in size, if it is known;
+ * else queues path to be summed and returns -1.
+ * A size stored more than DU_TTL seconds ago is still written, while path is summed again.
+ */
+int du_size(const char *path, const struct stat *sb, off_t *size) {
+    time_t stored;
+    int ret = find_size(sb, size, &stored);
+    char *job;
+    
+    if (ret == 0 && now_sec() - stored < DU_TTL) {
+        return 0;
+    }
+    pthread_mutex_lock(&lck);
+    if (du_fd != -1 && (pending || (pending = strmap_new(0))) && !strmap_get(pending, path) &&
+        (pool || (pool = thpool_new(1))) && (job = strdup(path))) {
+        if (strmap_put(pending, path, job) == -1 || thpool_add(pool, du_job, job) == -1) {
+            strmap_del(pending, path);
+            free(job);
+        }
+    }
+    pthread_mutex_unlock(&lck);
+    return ret;
+}
+
+/*
+ * Writes cached size of dir sb in size, without queueing anything.
+ * Returns -1 if it is not known, or not valid anymore (see struct du_node).
+ */
+int du_cached(const struct stat *sb, off_t *size) {
+    time_t stored;
+    
+    return find_size(sb, size, &stored);
+}
+
+/*
+ * Current epoch: to be passed to du_store() for a dir whose walk starts now.
+ */
+unsigned long du_epoch(void) {
+    unsigned long e;
+    
+    pthread_mutex_lock(&lck);
+    e = epoch;
+    pthread_mutex_unlock(&lck);
+    return e;
+}
+
+/*
+ * Wakes up main loop, as if some sizes were computed.
+ */
+void du_notify(void) {
+    if (du_fd != -1) {
+        eventfd_write(du_fd, 1);
+    }
+}
+
+/*
+ * Something changed inside dir path: its size, and sizes of every dir above it,
+ * are summed again next time they are asked for. Subdirs keep theirs.
+ */
+void du_invalidate(const char *path) {
+    char dir[PATH_MAX + 1] = {0};
+    struct du_node **n, *node;
+    struct stat sb;
+    char *slash;
+    
+    strncpy(dir, path, PATH_MAX);
+    pthread_mutex_lock(&lck);
+    epoch++;
+    pthread_mutex_unlock(&lck);
+    do {
+        if (stat(strlen(dir) ? dir : "/", &sb) == 0) {
+            pthread_mutex_lock(&lck);
+            if (invals[num_invals % DU_INVALS].epoch) {
+                lost_epoch = invals[num_invals % DU_INVALS].epoch;
+            }
+            invals[num_invals++ % DU_INVALS] = (struct du_inval) {sb.st_dev, sb.st_ino, epoch};
+            if ((n = find_node(sb.st_dev, sb.st_ino))) {
+                node = *n;
+                *n = node->next;
+                free(node);
+                num_nodes--;
+            }
+            pthread_mutex_unlock(&lck);
+        }
+        if ((slash = strrchr(dir, '/'))) {
+            *slash = '\0';
+        }
+    } while (slash);
+}
+
+/*
+ * Stops summing as soon as possible, then frees every cached size.
+ */
+void du_free(void) {
+    atomic_store(&stop, 1);
+    if (pool) {
+        thpool_free(pool);
+    }
+    if (pending) {
+        strmap_free(pending, NULL);
+    }
+    for (size_t i = 0; i < num_buckets; i++) {
+        for (struct du_node *n = buckets[i], *next; n; n = next) {
+            next = n->next;
+            free(n);
+        }
+    }
+    free(buckets);
+    if (du_fd != -1) {
+        close(du_fd);
+    }
+}
+
+/*
+ * Hardlinked files are counted once for each job (links holds their inodes).
+ * Path itself is always read again, as its size may be expired.
+ * du_fd is written once path is no more pending, even if its size could not be cached:
+ * main loop will then ask it again.
+ */
+static void du_job(void *x) {
+    char path[PATH_MAX + 1] = {0};
+    struct strmap *links = strmap_new(0);
+    struct stat sb;
+    
+    strncpy(path, (char *)x, PATH_MAX);
+    if (links && !atomic_load(&stop) && lstat(path, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+        du_walk(path, strlen(path), &sb, links);
+    }
+    if (links) {
+        strmap_free(links, NULL);
+    }
+    pthread_mutex_lock(&lck);
+    strmap_del(pending, (char *)x);
+    pthread_mutex_unlock(&lck);
+    free(x);
+    if (!atomic_load(&stop)) {
+        eventfd_write(du_fd, 1);
+    }
+}
+
+/*
+ * Sums apparent sizes of path's tree (path is a PATH_MAX + 1 buffer, len its length),
+ * without crossing filesystems, and caches the size of each dir.
+ * Subdirs whose size is still valid are not walked again.
+ * Dir is closed before walking its subdirs, whose names are kept in a buffer,
+ * so that a deep tree does not need a fd for each level.
+ * Returns -1 if the walk was stopped.
+ */
+static off_t du_walk(char *path, size_t len, const struct stat *sb, struct strmap *links) {
+    struct byte_buf subdirs = {0};
+    struct dirent *de;
+    struct stat st;
+    off_t size = sb->st_size;
+    unsigned long since = du_epoch();
+    char key[50];
+    DIR *d;
+    
+    if (!(d = opendir(path))) {
+        // an unreadable dir only counts for itself
+        du_store(sb, size, since);
+        return size;
+    }
+    while ((de = readdir(d)) && !atomic_load(&stop)) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") ||
+            fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (st.st_dev == sb->st_dev && buf_add(&subdirs, de->d_name, strlen(de->d_name) + 1) == -1) {
+                break;
+            }
+        } else if (st.st_nlink > 1) {
+            snprintf(key, sizeof(key), "%lx:%lx", (unsigned long)st.st_dev, (unsigned long)st.st_ino);
+            if (!strmap_get(links, key)) {
+                strmap_put(links, key, links);
+                size += st.st_size;
+            }
+        } else {
+            size += st.st_size;
+        }
+    }
+    closedir(d);
+    for (size_t off = 0; off < subdirs.len && !atomic_load(&stop); off += strlen((char *)subdirs.data + off) + 1) {
+        const char *name = (char *)subdirs.data + off;
+        off_t sub;
+        
+        if (len + strlen(name) + 1 > PATH_MAX) {
+            continue;
+        }
+        snprintf(path + len, PATH_MAX + 1 - len, "/%s", name);
+        if (lstat(path, &st) == 0 &&
+            (du_cached(&st, &sub) == 0 || (sub = du_walk(path, len + strlen(name) + 1, &st, links)) != -1)) {
+            size += sub;
+        }
+        path[len] = '\0';
+    }
+    free(subdirs.data);
+    if (atomic_load(&stop)) {
+        return -1;
+    }
+    du_store(sb, size, since);
+    return size;
+}
+
+/*
+ * Returns the link pointing to node of (dev, ino), or NULL. Called with lck held.
+ */
+static struct du_node **find_node(dev_t dev, ino_t ino) {
+    if (!num_buckets) {
+        return NULL;
+    }
+    for (struct du_node **n = &buckets[(ino ^ dev) & (num_buckets - 1)]; *n; n = &(*n)->next) {
+        if ((*n)->ino == ino && (*n)->dev == dev) {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Writes size of node of dir sb in size, and when it was stored in stored.
+ * Returns -1 if there is none, or its dir's mtime changed.
+ */
+static int find_size(const struct stat *sb, off_t *size, time_t *stored) {
+    struct du_node **n;
+    int ret = -1;
+    
+    pthread_mutex_lock(&lck);
+    if ((n = find_node(sb->st_dev, sb->st_ino)) && (*n)->mtime.tv_sec == sb->st_mtim.tv_sec &&
+        (*n)->mtime.tv_nsec == sb->st_mtim.tv_nsec) {
+        *size = (*n)->size;
+        *stored = (*n)->stored;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&lck);
+    return ret;
+}
+
+/*
+ * Whether dir sb was invalidated after epoch "since". Called with lck held.
+ * If some invalidations after since were already forgotten, it could have been.
+ */
+static int changed_since(const struct stat *sb, unsigned long since) {
+    if (since == epoch) {
+        return 0;
+    }
+    if (since < lost_epoch) {
+        return 1;
+    }
+    for (size_t i = 0; i < num_invals && i < DU_INVALS; i++) {
+        if (invals[i].epoch > since && invals[i].ino == sb->st_ino && invals[i].dev == sb->st_dev) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Adds (or updates) node of dir sb, whose walk started at epoch "since". Buckets are doubled
+ * whenever there are more nodes than buckets. Without memory, size is just not cached.
+ */
+void du_store(const struct stat *sb, off_t size, unsigned long since) {
+    struct du_node **n, *node = NULL;
+    
+    pthread_mutex_lock(&lck);
+    if (changed_since(sb, since)) {
+        // something changed inside dir while it was summed
+    } else if ((n = find_node(sb->st_dev, sb->st_ino))) {
+        node = *n;
+    } else if ((node = malloc(sizeof(struct du_node)))) {
+        if (num_nodes >= num_buckets) {
+            size_t num = num_buckets ? 2 * num_buckets : 1024;
+            struct du_node **b = calloc(num, sizeof(struct du_node *));
+            
+            if (b) {
+                for (size_t i = 0; i < num_buckets; i++) {
+                    for (struct du_node *m = buckets[i], *next; m; m = next) {
+                        next = m->next;
+                        m->next = b[(m->ino ^ m->dev) & (num - 1)];
+                        b[(m->ino ^ m->dev) & (num - 1)] = m;
+                    }
+                }
+                free(buckets);
+                buckets = b;
+                num_buckets = num;
+            }
+        }
+        if (num_buckets) {
+            node->dev = sb->st_dev;
+            node->ino = sb->st_ino;
+            node->next = buckets[(node->ino ^ node->dev) & (num_buckets - 1)];
+            buckets[(node->ino ^ node->dev) & (num_buckets - 1)] = node;
+            num_nodes++;
+        } else {
+            free(node);
+            node = NULL;
+        }
+    }
+    if (node) {
+        node->mtime = sb->st_mtim;
+        node->stored = now_sec();
+        node->size = size;
+    }
+    pthread_mutex_unlock(&lck);
+}
+
+static time_t now_sec(void) {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
@@ -0,0 +1,436 @@
+#include "../inc/du_analyzer.h"
+
+/*
+ * Dir being summed by analyzer pool: its size grows while it is read, then with
+ * the size of each of its subdirs, once they are done. pending counts its own job
+ * plus its subdirs not done yet: last one to finish adds dir's size to its parent.
+ * row is the entry of analyzed dir this dir is below.
+ */
+struct walk_dir {
+    struct walk_dir *parent;
+    int row;
+    atomic_llong size;
+    atomic_int pending;
+    struct stat sb;
+    unsigned long since;
+    char path[];
+};
+
+/*
+ * Entry of analyzed dir: its size grows live while its tree is walked.
+ */
+struct du_row {
+    atomic_llong size;
+    atomic_int done;
+};
+
+static int start_walk(const char *path, DIR *d);
+static void queue_dir(struct walk_dir *parent, int row, const char *path, const struct stat *sb);
+static void dir_job(void *x);
+static void add_size(struct walk_dir *w, off_t size);
+static int first_link(const struct stat *sb);
+static void finish_dir(struct walk_dir *w);
+static void maybe_notify(void);
+static int cmp_rows(const void *a, const void *b);
+static void focus_row(int win, int row);
+static void stop_walk(void);
+
+/*
+ * Analyzer state: rows of analyzed dir (root), their paths (listed in tab through order,
+ * that is the tab's view), and the sizes printed last time (shown), that order is sorted by.
+ * links holds inodes of hardlinked files already counted during current walk.
+ */
+static char root[PATH_MAX + 1];
+static struct du_row *rows;
+static char (*paths)[PATH_MAX + 1];
+static int *order;
+static off_t *shown;
+static off_t shown_total;
+static int num_rows, num_dirs, shown_done, du_win;
+static atomic_int num_done, stop;
+static atomic_long last_notify;
+static struct thpool *pool;
+static struct strmap *links;
+static pthread_mutex_t links_lck = PTHREAD_MUTEX_INITIALIZER;
+static char label[PATH_MAX + 1];
+
+/*
+ * Enters disk usage analyzer mode in active tab, on path; if it is already active,
+ * moves analyzer to path: subdirs whose size was already computed
+ * (and did not change meanwhile) are not walked again.
+ * Only one tab at a time can be in disk usage analyzer mode.
+ */
+void show_du_analyzer(const char *path) {
+    char dir[PATH_MAX + 1] = {0};
+    DIR *d;
+    
+    if (ps[!active].mode == du_) {
+        print_info(_(du_already_active), ERR_LINE);
+        return;
+    }
+    if (!(d = opendir(path))) {
+        print_info(strerror(errno), ERR_LINE);
+        return;
+    }
+    // path may be one of the rows that are going to be freed
+    strncpy(dir, path, PATH_MAX);
+    stop_walk();
+    if (start_walk(dir, d) == -1) {
+        return;
+    }
+    du_win = active;
+    if (ps[active].mode != du_) {
+        show_special_tab(num_rows, paths, root, du_);
+    } else {
+        str_ptr[active] = paths;
+        ps[active].number_of_files = num_rows;
+        ps[active].curr_pos = 0;
+        ps[active].mywin.delta = 0;
+    }
+    ps[active].view = order;
+    shown_total = -1;
+    refresh_du_analyzer();
+}
+
+/*
+ * Reads entries of path (opened as d): files are counted straight away, as dirs whose size
+ * is cached; other dirs are queued to analyzer pool.
+ */
+static int start_walk(const char *path, DIR *d) {
+    struct byte_buf names = {0};
+    struct dirent *de;
+    struct stat sb, st;
+    off_t size;
+    int i = 0;
+    
+    fstat(dirfd(d), &sb);
+    while ((de = readdir(d))) {
+        if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..") &&
+            buf_add(&names, de->d_name, strlen(de->d_name) + 1) == 0) {
+            num_rows++;
+        }
+    }
+    closedir(d);
+    strncpy(root, path, PATH_MAX);
+    rows = calloc(num_rows ? num_rows : 1, sizeof(struct du_row));
+    paths = calloc(num_rows ? num_rows : 1, PATH_MAX + 1);
+    order = calloc(num_rows ? num_rows : 1, sizeof(int));
+    shown = calloc(num_rows ? num_rows : 1, sizeof(off_t));
+    links = strmap_new(0);
+    if (!rows || !paths || !order || !shown || !links) {
+        free(names.data);
+        stop_walk();
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        return -1;
+    }
+    pool = thpool_new(0);
+    for (size_t off = 0; off < names.len; off += strlen((char *)names.data + off) + 1, i++) {
+        // avoid a double slash when analyzing "/"
+        snprintf(paths[i], PATH_MAX, "%s/%s", strcmp(root, "/") ? root : "", (char *)names.data + off);
+        order[i] = i;
+        if (lstat(paths[i], &st) == -1) {
+            atomic_store(&rows[i].done, 1);
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode) || st.st_dev != sb.st_dev) {
+            // as du -x: other filesystems' mountpoints only count for themselves
+            if (!S_ISDIR(st.st_mode) && !first_link(&st)) {
+                st.st_size = 0;
+            }
+            atomic_store(&rows[i].size, st.st_size);
+            atomic_store(&rows[i].done, 1);
+        } else if (du_cached(&st, &size) == 0) {
+            atomic_store(&rows[i].size, size);
+            atomic_store(&rows[i].done, 1);
+            atomic_fetch_add(&num_done, 1);
+            num_dirs++;
+        } else {
+            num_dirs++;
+            queue_dir(NULL, i, paths[i], &st);
+        }
+        shown[i] = atomic_load(&rows[i].size);
+    }
+    free(names.data);
+    return 0;
+}
+
+/*
+ * If the pool could not be created (or job could not be queued),
+ * dir is read straight away.
+ */
+static void queue_dir(struct walk_dir *parent, int row, const char *path, const struct stat *sb) {
+    struct walk_dir *w = malloc(sizeof(struct walk_dir) + strlen(path) + 1);
+    
+    if (!w) {
+        return;
+    }
+    w->parent = parent;
+    w->row = row;
+    w->sb = *sb;
+    w->since = du_epoch();
+    atomic_init(&w->size, 0);
+    atomic_init(&w->pending, 1);
+    strcpy(w->path, path);
+    add_size(w, sb->st_size);
+    if (parent) {
+        atomic_fetch_add(&parent->pending, 1);
+    }
+    if (!pool || thpool_add(pool, dir_job, w) == -1) {
+        dir_job(w);
+    }
+}
+
+/*
+ * Reads a dir, counting its files and queueing its subdirs (on the same filesystem)
+ * whose size is not cached yet.
+ */
+static void dir_job(void *x) {
+    struct walk_dir *w = (struct walk_dir *)x;
+    char path[PATH_MAX + 1] = {0};
+    struct dirent *de;
+    struct stat st;
+    off_t size;
+    DIR *d;
+    
+    if (!quit && !atomic_load(&stop) && (d = opendir(w->path))) {
+        while ((de = readdir(d)) && !atomic_load(&stop)) {
+            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") ||
+                fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                continue;
+            }
+            if (!S_ISDIR(st.st_mode)) {
+                if (first_link(&st)) {
+                    add_size(w, st.st_size);
+                }
+            } else if (st.st_dev == w->sb.st_dev) {
+                if (du_cached(&st, &size) == 0) {
+                    add_size(w, size);
+                } else {
+                    snprintf(path, PATH_MAX, "%s/%s", w->path, de->d_name);
+                    queue_dir(w, w->row, path, &st);
+                }
+            }
+        }
+        closedir(d);
+    }
+    maybe_notify();
+    finish_dir(w);
+}
+
+/*
+ * Size is added to dir being read and, for live updates, to its row.
+ */
+static void add_size(struct walk_dir *w, off_t size) {
+    atomic_fetch_add(&w->size, size);
+    atomic_fetch_add(&rows[w->row].size, size);
+}
+
+/*
+ * Hardlinked files are only counted the first time one of their links is met.
+ * Cached sizes of subdirs may count again links already met.
+ */
+static int first_link(const struct stat *sb) {
+    char key[50];
+    int first = 1;
+    
+    if (sb->st_nlink < 2) {
+        return 1;
+    }
+    snprintf(key, sizeof(key), "%lx:%lx", (unsigned long)sb->st_dev, (unsigned long)sb->st_ino);
+    pthread_mutex_lock(&links_lck);
+    if (strmap_get(links, key)) {
+        first = 0;
+    } else {
+        strmap_put(links, key, links);
+    }
+    pthread_mutex_unlock(&links_lck);
+    return first;
+}
+
+/*
+ * Called when a job, or a subdir, of w is done: if it was the last one,
+ * w's size is cached and added to its parent, that may be done in turn.
+ * A row is done once its whole tree is.
+ */
+static void finish_dir(struct walk_dir *w) {
+    struct walk_dir *parent;
+    
+    while (w && atomic_fetch_sub(&w->pending, 1) == 1) {
+        parent = w->parent;
+        if (!atomic_load(&stop)) {
+            du_store(&w->sb, atomic_load(&w->size), w->since);
+            if (parent) {
+                atomic_fetch_add(&parent->size, atomic_load(&w->size));
+            } else {
+                atomic_store(&rows[w->row].done, 1);
+                atomic_fetch_add(&num_done, 1);
+                du_notify();
+            }
+        }
+        free(w);
+        w = parent;
+    }
+}
+
+/*
+ * Asks main loop to refresh analyzer tab, at most once every DU_REFRESH_MS.
+ */
+static void maybe_notify(void) {
+    struct timespec now;
+    long ms, last = atomic_load(&last_notify);
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    if (ms - last >= DU_REFRESH_MS && atomic_compare_exchange_strong(&last_notify, &last, ms)) {
+        du_notify();
+    }
+}
+
+/*
+ * Called by main loop when some sizes changed: rows are sorted again by size
+ * (biggest first), keeping cursor on the same row.
+ * shown_total is -1 for a new listing.
+ */
+void refresh_du_analyzer(void) {
+    char total[20] = {0};
+    off_t tot = 0;
+    int done = atomic_load(&num_done), row;
+    
+    if (ps[du_win].mode != du_) {
+        return;
+    }
+    for (int i = 0; i < num_rows; i++) {
+        shown[i] = atomic_load(&rows[i].size);
+        tot += shown[i];
+    }
+    if (tot == shown_total && done == shown_done) {
+        return;
+    }
+    // a new listing starts from its biggest entry
+    row = num_rows && shown_total != -1 ? order[ps[du_win].curr_pos] : -1;
+    shown_total = tot;
+    shown_done = done;
+    qsort(order, num_rows, sizeof(int), cmp_rows);
+    change_unit(tot, total);
+    snprintf(ps[du_win].title, PATH_MAX, _(du_mode_str), root, total, done, num_dirs);
+    reset_win(du_win);
+    focus_row(du_win, row);
+}
+
+static int cmp_rows(const void *a, const void *b) {
+    int r1 = *(const int *)a, r2 = *(const int *)b;
+    
+    if (shown[r1] != shown[r2]) {
+        return (shown[r1] < shown[r2]) - (shown[r1] > shown[r2]);
+    }
+    return r1 - r2;
+}
+
+static void focus_row(int win, int row) {
+    for (int i = 0; i < num_rows; i++) {
+        if (order[i] == row) {
+            if (i > ps[win].curr_pos) {
+                scroll_down(win, i - ps[win].curr_pos);
+            }
+            break;
+        }
+    }
+}
+
+/*
+ * Text printed for i-th row of analyzer tab: its size ("+" while its tree
+ * is still being walked), its share of total size and its name.
+ */
+char *du_label(int i) {
+    const char bar[] = "##########";
+    char size[20] = {0};
+    int r = order[i];
+    double perc = shown_total > 0 ? 100.0 * shown[r] / shown_total : 0;
+    
+    change_unit(shown[r], size);
+    snprintf(label, PATH_MAX, "%9s%c %5.1f%% [%-*.*s] %s", size, atomic_load(&rows[r].done) ? ' ' : '+', perc,
+             DU_BAR_LEN, (int)(perc * DU_BAR_LEN / 100 + 0.5), bar, strrchr(paths[r], '/') + 1);
+    return label;
+}
+
+/*
+ * Dirs are analyzed in turn; on a file, analyzer is left moving to it.
+ */
+void du_enter_press(struct stat s) {
+    if (!num_rows) {
+        return;
+    }
+    if (S_ISDIR(s.st_mode)) {
+        show_du_analyzer(tab_entry(active, ps[active].curr_pos));
+    } else {
+        leave_mode_helper(s);
+        free_du_analyzer();
+    }
+}
+
+/*
+ * Analyzes parent dir, with cursor on the dir analyzed until now.
+ */
+void du_go_up(void) {
+    char parent[PATH_MAX + 1] = {0};
+    char old[PATH_MAX + 1] = {0};
+    char *slash;
+    
+    if (!strcmp(root, "/")) {
+        return;
+    }
+    strncpy(old, root, PATH_MAX);
+    strncpy(parent, root, PATH_MAX);
+    slash = strrchr(parent, '/');
+    if (slash == parent) {
+        // parent of "/dir" is "/"
+        slash++;
+    }
+    *slash = '\0';
+    show_du_analyzer(parent);
+    if (ps[active].mode == du_ && !strcmp(root, parent)) {
+        for (int i = 0; i < num_rows; i++) {
+            if (!strcmp(paths[i], old)) {
+                focus_row(active, i);
+                break;
+            }
+        }
+    }
+}
+
+void leave_du_mode(const char *str) {
+    leave_special_mode(str, active);
+    free_du_analyzer();
+}
+
+void free_du_analyzer(void) {
+    stop_walk();
+}
+
+/*
+ * Stops current walk, waiting for its jobs (they check stop flag for each entry),
+ * then frees its rows.
+ */
+static void stop_walk(void) {
+    atomic_store(&stop, 1);
+    if (pool) {
+        thpool_free(pool);
+        pool = NULL;
+    }
+    atomic_store(&stop, 0);
+    if (links) {
+        strmap_free(links, NULL);
+        links = NULL;
+    }
+    free(rows);
+    free(paths);
+    free(order);
+    free(shown);
+    rows = NULL;
+    paths = NULL;
+    order = NULL;
+    shown = NULL;
+    num_rows = num_dirs = shown_done = 0;
+    atomic_store(&num_done, 0);
+}
@@ -0,0 +1,216 @@
+#include "../inc/filetype.h"
+
+static int ext_type(const char *path);
+static int mime_type(const char *mime);
+static int queue_path(const char *path);
+static void *classifier_thread(void *x);
+
+static const char *img_ext[] = {"png", "jpg", "jpeg", "gif", "bmp", "svg", "webp", "tif", "tiff", "ico", "xpm", "psd"};
+static const char *video_ext[] = {"mp4", "mkv", "avi", "webm", "mov", "flv", "wmv", "mpg", "mpeg", "m4v", "ogv", "3gp"};
+static const char *arch_type_ext[] = {"tar", "tgz", "gz", "zip", "rar", "xz", "txz", "zst", "tzst", "bz2", "tbz2", "7z",
+                                      "lz4", "lzma", "ar", "deb", "rpm", "iso", "jar", "cpio"};
+static const char *src_ext[] = {"c", "h", "cc", "cpp", "cxx", "hh", "hpp", "py", "sh", "js", "ts", "go", "rs", "java",
+                                "rb", "pl", "lua", "php", "cs", "swift", "kt", "hs", "ml", "el", "vim", "cmake"};
+static const char *doc_ext[] = {"pdf", "txt", "md", "rst", "tex", "doc", "docx", "odt", "ods", "odp", "xls", "xlsx",
+                                "ppt", "pptx", "epub", "rtf", "djvu", "ps"};
+
+/*
+ * queue is a stack of paths (top is the next one to be probed), of which pending
+ * indexes the ones still queued; lck protects both.
+ * type_fd is written once some types are known, to redraw listings.
+ */
+static char *queue[TYPE_QUEUE_SIZE];
+static int queue_top, queue_len;
+static struct strmap *pending;
+static pthread_t classifier_th;
+static pthread_mutex_t lck = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int running, stop;
+static int type_fd = -1;
+
+/*
+ * Returns the fd polled by main loop to know that new types are known.
+ */
+int filetype_init(void) {
+    type_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return type_fd;
+}
+
+/*
+ * Returns type of regular file path (sb is its stat): from its extension if known,
+ * else from its mimetype if it was already probed.
+ * Otherwise it is queued to be probed, and -1 is returned: it never blocks.
+ */
+int file_type(const char *path, const struct stat *sb) {
+    char mime[MIME_LEN];
+    int type;
+    
+    if ((type = ext_type(path)) != -1) {
+        return type;
+    }
+    if (!sb->st_size) {
+        return TYPE_OTHER;
+    }
+    if (cached_mimetype(sb, mime, sizeof(mime)) == 0) {
+        return mime_type(mime);
+    }
+    return queue_path(path) == 0 ? -1 : TYPE_OTHER;
+}
+
+/*
+ * Stops classifier thread, then frees every path still queued.
+ */
+void free_filetypes(void) {
+    pthread_mutex_lock(&lck);
+    stop = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lck);
+    if (running) {
+        pthread_join(classifier_th, NULL);
+        running = 0;
+    }
+    while (queue_len) {
+        queue_top = (queue_top + TYPE_QUEUE_SIZE - 1) % TYPE_QUEUE_SIZE;
+        free(queue[queue_top]);
+        queue_len--;
+    }
+    if (pending) {
+        strmap_free(pending, NULL);
+        pending = NULL;
+    }
+    if (type_fd != -1) {
+        close(type_fd);
+    }
+}
+
+/*
+ * Type of path from its extension (case insensitive), or -1 if it is not a known one.
+ */
+static int ext_type(const char *path) {
+    const char *ext = strrchr(path, '.');
+    const struct {
+        const char **exts;
+        int num;
+        int type;
+    } tables[] = {
+        {img_ext, NUM(img_ext), TYPE_IMAGE},
+        {video_ext, NUM(video_ext), TYPE_VIDEO},
+        {arch_type_ext, NUM(arch_type_ext), TYPE_ARCHIVE},
+        {src_ext, NUM(src_ext), TYPE_SOURCE},
+        {doc_ext, NUM(doc_ext), TYPE_DOCUMENT}
+    };
+    
+    if (!ext || strchr(ext, '/') || ext[-1] == '/') {
+        return -1;
+    }
+    for (int i = 0; i < (int)NUM(tables); i++) {
+        for (int j = 0; j < tables[i].num; j++) {
+            if (!strcasecmp(ext + 1, tables[i].exts[j])) {
+                return tables[i].type;
+            }
+        }
+    }
+    return -1;
+}
+
+static int mime_type(const char *mime) {
+    const char *arch_mimes[] = {"application/zip", "application/gzip", "application/x-xz", "application/x-tar",
+                                "application/x-bzip2", "application/zstd", "application/x-7z-compressed",
+                                "application/x-rar", "application/x-lzma", "application/x-cpio"};
+    
+    if (!strncmp(mime, "image/", strlen("image/"))) {
+        return TYPE_IMAGE;
+    }
+    if (!strncmp(mime, "video/", strlen("video/"))) {
+        return TYPE_VIDEO;
+    }
+    for (int i = 0; i < (int)NUM(arch_mimes); i++) {
+        if (!strcmp(mime, arch_mimes[i])) {
+            return TYPE_ARCHIVE;
+        }
+    }
+    // eg: text/x-c, text/x-shellscript, text/x-script.python
+    if (!strncmp(mime, "text/x-", strlen("text/x-"))) {
+        return TYPE_SOURCE;
+    }
+    if (!strncmp(mime, "text/", strlen("text/")) || !strcmp(mime, "application/pdf")) {
+        return TYPE_DOCUMENT;
+    }
+    return TYPE_OTHER;
+}
+
+/*
+ * Pushes path on top of queue, unless it is already queued; classifier thread
+ * is started on first use. Returns -1 if path could not be queued.
+ */
+static int queue_path(const char *path) {
+    char *p = NULL;
+    int ret = 0;
+    
+    pthread_mutex_lock(&lck);
+    if (stop || type_fd == -1 || (!pending && !(pending = strmap_new(0)))) {
+        ret = -1;
+    } else if (!strmap_get(pending, path)) {
+        if (!running) {
+            running = !pthread_create(&classifier_th, NULL, classifier_thread, NULL);
+        }
+        if (!running || !(p = strdup(path)) || strmap_put(pending, path, p) == -1) {
+            if (running) {
+                free(p);
+            }
+            ret = -1;
+        } else {
+            if (queue_len == TYPE_QUEUE_SIZE) {
+                // forget oldest path: it will be queued again if it is drawn again
+                strmap_del(pending, queue[queue_top]);
+                free(queue[queue_top]);
+            } else {
+                queue_len++;
+            }
+            queue[queue_top] = p;
+            queue_top = (queue_top + 1) % TYPE_QUEUE_SIZE;
+            pthread_cond_signal(&cond);
+        }
+    }
+    pthread_mutex_unlock(&lck);
+    return ret;
+}
+
+/*
+ * Probes queued paths at lowest priority (their mimetypes are cached by get_mimetype_str()).
+ * A path stays pending until it is probed, so that it is not queued again meanwhile.
+ * main loop is woken up when queue is empty, or TYPE_REFRESH_MS after last time;
+ * never if nothing was probed (eg: libmagic is not available).
+ */
+static void *classifier_thread(void *x) {
+    char mime[MIME_LEN], *path;
+    struct timespec last = {0}, now;
+    int probed = 0;
+    
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    pthread_mutex_lock(&lck);
+    while (!stop) {
+        if (!queue_len) {
+            pthread_cond_wait(&cond, &lck);
+            continue;
+        }
+        queue_top = (queue_top + TYPE_QUEUE_SIZE - 1) % TYPE_QUEUE_SIZE;
+        path = queue[queue_top];
+        queue_len--;
+        pthread_mutex_unlock(&lck);
+        
+        probed += get_mimetype_str(path, mime, sizeof(mime)) == 0;
+        
+        pthread_mutex_lock(&lck);
+        strmap_del(pending, path);
+        free(path);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (probed && (!queue_len || (now.tv_sec - last.tv_sec) * 1000 + (now.tv_nsec - last.tv_nsec) / 1000000 >= TYPE_REFRESH_MS)) {
+            eventfd_write(type_fd, 1);
+            probed = 0;
+            last = now;
+        }
+    }
+    pthread_mutex_unlock(&lck);
+    return NULL;
+}
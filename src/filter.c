@@ -0,0 +1,287 @@
+#include "../inc/filter.h"
+
+/*
+ * Initial size of names index, per listed file
+ */
+#define AVG_NAME_LEN 32
+
+/*
+ * Rows (listing indexes) matching pattern[0..level]:
+ * extending the pattern only needs to scan these again.
+ */
+struct filter_level {
+    int *rows;
+    int num_rows;
+    int computed;
+};
+
+/*
+ * Filter state of a tab: listing's basenames are stored lowercased inside
+ * a single contiguous buffer, so each keystroke scans a compact index
+ * instead of walking PATH_MAX-sized fullpaths.
+ */
+struct filter {
+    char *names;
+    int *offsets;
+    int num_all;
+    int parent;
+    wchar_t pattern[NAME_MAX + 1];
+    int len;
+    struct filter_level levels[NAME_MAX + 1];
+    char old_file[NAME_MAX + 1];
+};
+
+static int build_index(int win);
+static size_t lower_name(const char *name, size_t len, char *out);
+static int compute_level(int win);
+static void apply_view(int win);
+static void free_levels(struct filter *f);
+static void print_filter(int win);
+
+static struct filter filters[MAX_TABS];
+
+/*
+ * Enters filter mode in active tab: current file is saved
+ * to restore cursor position when leaving.
+ */
+void show_filter(void) {
+    struct filter *f = &filters[active];
+
+    strncpy(f->old_file, strrchr(ps[active].nl[ps[active].curr_pos], '/') + 1, NAME_MAX);
+    if (build_index(active) == -1) {
+        return;
+    }
+    show_special_tab(ps[active].number_of_files, NULL, ps[active].title, filter_);
+    print_filter(active);
+}
+
+/*
+ * Copies every listed file's basename, lowercased (see lower_name()), inside f->names.
+ * Must be called on the unfiltered listing.
+ */
+static int build_index(int win) {
+    struct filter *f = &filters[win];
+    size_t used = 0, size = (ps[win].number_of_files + 1) * AVG_NAME_LEN;
+
+    f->num_all = ps[win].number_of_files;
+    f->parent = -1;
+    if (!(f->names = malloc(size)) || !(f->offsets = malloc(f->num_all * sizeof(int)))) {
+        free(f->names);
+        f->names = NULL;
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        return -1;
+    }
+    for (int i = 0; i < f->num_all; i++) {
+        const char *name = strrchr(ps[win].nl[i], '/') + 1;
+        size_t len = strlen(name), max = len * MB_CUR_MAX + 1;
+
+        // a lowercased char may take more bytes than the original one
+        if (used + max > size) {
+            char *tmp;
+
+            size = 2 * size + max;
+            if (!(tmp = realloc(f->names, size))) {
+                quit = MEM_ERR_QUIT;
+                ERROR("could not realloc. Leaving.");
+                return -1;
+            }
+            f->names = tmp;
+        }
+        f->offsets[i] = used;
+        used += lower_name(name, len, f->names + used);
+        if (!strcmp(name, "..")) {
+            f->parent = i;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes name lowercased in out, one multibyte char at a time with towlower(),
+ * as pattern is (see filter_input()); bytes that are not part of a valid char
+ * are copied as they are. Returns written bytes, NUL included.
+ */
+static size_t lower_name(const char *name, size_t len, char *out) {
+    mbstate_t in_st = {0}, out_st = {0};
+    size_t done = 0, n, m;
+    wchar_t wc;
+
+    while (len) {
+        n = mbrtowc(&wc, name, len, &in_st);
+        if (n == (size_t)-1 || n == (size_t)-2 || n == 0) {
+            memset(&in_st, 0, sizeof(mbstate_t));
+            n = 1;
+            out[done++] = *name;
+        } else if ((m = wcrtomb(out + done, towlower(wc), &out_st)) != (size_t)-1) {
+            done += m;
+        } else {
+            memcpy(out + done, name, n);
+            done += n;
+        }
+        name += n;
+        len -= n;
+    }
+    out[done++] = '\0';
+    return done;
+}
+
+/*
+ * Printable chars are appended to pattern, refining current rows;
+ * backspace drops last char, going back to previous (cached) level.
+ */
+void filter_input(wint_t c) {
+    struct filter *f = &filters[active];
+
+    if (c == 127 || c == KEY_BACKSPACE) {
+        if (!f->len) {
+            return;
+        }
+        f->len--;
+        free(f->levels[f->len + 1].rows);
+        memset(&f->levels[f->len + 1], 0, sizeof(struct filter_level));
+        f->pattern[f->len] = L'\0';
+    } else {
+        if (f->len == NAME_MAX - 2) {
+            return;
+        }
+        f->pattern[f->len++] = towlower(c);
+    }
+    if (compute_level(active) == -1) {
+        return;
+    }
+    apply_view(active);
+    reset_win(active);
+    print_filter(active);
+}
+
+/*
+ * A plain pattern is matched as a substring, so it can refine nearest computed
+ * level's rows; a pattern with wildcards is matched as a glob ("*pattern*")
+ * against the whole index. ".." always stays visible.
+ */
+static int compute_level(int win) {
+    struct filter *f = &filters[win];
+    struct filter_level *l = &f->levels[f->len], *prev = NULL;
+    char mbstr[NAME_MAX + 1] = {0}, glob[NAME_MAX + 3] = {0};
+    int is_glob, num;
+
+    if (!f->len || l->computed) {
+        return 0;
+    }
+    if (wcstombs(mbstr, f->pattern, NAME_MAX) == (size_t)-1) {
+        return -1;
+    }
+    is_glob = strpbrk(mbstr, "*?[") != NULL;
+    if (is_glob) {
+        snprintf(glob, sizeof(glob), "*%s*", mbstr);
+    } else {
+        for (int i = f->len - 1; i > 0 && !prev; i--) {
+            if (f->levels[i].computed) {
+                prev = &f->levels[i];
+            }
+        }
+    }
+    num = prev ? prev->num_rows : f->num_all;
+    // ".." is never filtered out, so rows is never empty
+    if (!(l->rows = malloc((num + 1) * sizeof(int)))) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        return -1;
+    }
+    for (int i = 0; i < num; i++) {
+        int idx = prev ? prev->rows[i] : i;
+        const char *name = f->names + f->offsets[idx];
+
+        if (idx == f->parent || (is_glob ? !fnmatch(glob, name, 0) : !!strstr(name, mbstr))) {
+            l->rows[l->num_rows++] = idx;
+        }
+    }
+    l->computed = 1;
+    return 0;
+}
+
+static void apply_view(int win) {
+    struct filter *f = &filters[win];
+
+    if (f->len) {
+        ps[win].view = f->levels[f->len].rows;
+        ps[win].number_of_files = f->levels[f->len].num_rows;
+    } else {
+        ps[win].view = NULL;
+        ps[win].number_of_files = f->num_all;
+    }
+}
+
+/*
+ * Called by generate_list when a filtered listing has been regenerated
+ * (eg: inotify event or sorting change): rebuilds index and current level.
+ */
+void update_filter(int win) {
+    struct filter *f = &filters[win];
+
+    free(f->names);
+    free(f->offsets);
+    f->names = NULL;
+    f->offsets = NULL;
+    free_levels(f);
+    ps[win].view = NULL;
+    if (build_index(win) == -1 || compute_level(win) == -1) {
+        return;
+    }
+    apply_view(win);
+    if (win == active) {
+        print_filter(win);
+    }
+}
+
+/*
+ * Restores full listing, moving cursor back to the file
+ * that was current when filter mode was entered.
+ */
+void leave_filter_mode(int win) {
+    char old_file[NAME_MAX + 1] = {0};
+
+    strncpy(old_file, filters[win].old_file, NAME_MAX);
+    free_filter(win);
+    leave_special_mode(NULL, win);
+    reset_win(win);
+    move_cursor_to_file(0, old_file, win);
+    print_info("", INFO_LINE);
+}
+
+/*
+ * Drops filter state of win, giving back its full listing.
+ * Does not redraw anything.
+ */
+void free_filter(int win) {
+    struct filter *f = &filters[win];
+
+    if (ps[win].view) {
+        ps[win].view = NULL;
+        ps[win].number_of_files = f->num_all;
+    }
+    free_levels(f);
+    free(f->names);
+    free(f->offsets);
+    f->names = NULL;
+    f->offsets = NULL;
+    f->len = 0;
+    wmemset(f->pattern, 0, NAME_MAX + 1);
+}
+
+static void free_levels(struct filter *f) {
+    for (int i = 1; i <= f->len; i++) {
+        free(f->levels[i].rows);
+        memset(&f->levels[i], 0, sizeof(struct filter_level));
+    }
+}
+
+static void print_filter(int win) {
+    char str[PATH_MAX + 1] = {0};
+    char mbstr[NAME_MAX + 1] = {0};
+
+    wcstombs(mbstr, filters[win].pattern, NAME_MAX);
+    snprintf(str, PATH_MAX, _(filter_mode_str), mbstr, ps[win].number_of_files, filters[win].num_all);
+    print_info(str, INFO_LINE);
+}
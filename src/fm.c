@@ -5,9 +5,19 @@ static void open_file(const char *str);
 static int new_file(const char *name);
 static int new_dir(const char *name);
 static int rename_file_folders(const char *name);
-static void select_file(const char *str);
+static int reserve_selected(int num, size_t bytes);
+static int select_file(const char *str);
+static int find_selected(const char *str, uint32_t hash);
+static void insert_selected(int slot);
+static void index_selected(void);
+static void drop_selected(int slot);
+static void unselect_file(const char *str);
+static void trim_selected(void);
 static void select_all(void);
 static void deselect_all(void);
+static void compact_selected(void);
+static int build_selected_rows(void);
+static void update_selected_mode(void);
 static void cpr(const char *tmp);
 static int recursive_copy(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf);
 static int recursive_remove(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf);
@@ -15,6 +25,35 @@ static void rmrf(const char *path);
 
 static const char *pkg_ext[] = {".pkg.tar.xz", ".deb", ".rpm"};
 static int distance_from_root, is_selecting;
+
+/*
+ * Selected paths are packed, in selection order, in sel_arena: sel_slot[slot].off is the offset
+ * of a path there, or SEL_DEAD once it has been unselected. sel_table is an open addressing
+ * (linear probing) hash table of slot + 1 (0 if empty), at most half full: it is hashed
+ * and compared through sel_arena, so each path is stored once.
+ * Slots only move in compact_selected(), so membership is O(1)
+ * and unselecting a file just leaves a tombstone behind.
+ * Files selected while browsing an archive are archive members: they are flagged
+ * and counted in sel_members, so that jobs can refuse them without a stat.
+ * Tombstones are dropped lazily: once they are half of the slots, or when selected files
+ * are needed in order (selected_file(), selected mode, jobs).
+ * sel_rows are selected files as rows of selected mode, built only while a tab shows them:
+ * its first sel_rows_num ones are up to date.
+ */
+#define SEL_DEAD ((size_t)-1)
+
+struct sel_slot {
+    size_t off;
+    uint32_t hash;
+    uint32_t member;
+};
+
+static struct sel_slot *sel_slot;
+static char *sel_arena;
+static char (*sel_rows)[PATH_MAX + 1];
+static int *sel_table;
+static size_t sel_len, sel_size;
+static int sel_slots, sel_slot_cap, sel_table_cap, sel_rows_num, sel_rows_cap, sel_members;
 static int (*const short_func[SHORT_FILE_OPERATIONS])(const char *) = {
     new_file, new_dir, rename_file_folders
 };
@@ -24,6 +63,12 @@ int change_dir(const char *str, int win) {
     const int event_mask = IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVE;
     
     if (chdir(str) != -1) {
+        // a filter only narrows the listing it was typed on
+        if (ps[win].mode == filter_) {
+            free_filter(win);
+            leave_special_mode(NULL, win);
+            print_info("", INFO_LINE);
+        }
         getcwd(ps[win].my_cwd, PATH_MAX);
         strncpy(ps[win].title, ps[win].my_cwd, PATH_MAX);
         tab_refresh(win);
@@ -162,7 +207,7 @@ static int new_dir(const char *name) {
 }
 
 static int rename_file_folders(const char *name) {
-    return rename(ps[active].nl[ps[active].curr_pos], name);
+    return rename(tab_entry(active, ps[active].curr_pos), name);
 }
 
 /*
@@ -183,20 +228,21 @@ int remove_file(void) {
 }
 
 /*
- * If there are no selected files, or the file user selected wasn't already selected (remove_from_list() returns 0),
- * add this file to select list.
+ * If the file user selected wasn't already selected, add it to selected files;
+ * else remove it.
  */
 void manage_space_press(const char *str) {
     int idx;
     char c;
-    int i = is_present(str, selected, num_selected, -1, 0);
 
-    if (i == -1) {
-        select_file(str);
+    if (selected_index(str) == -1) {
+        if (select_file(str) == -1) {
+            return;
+        }
         idx = 0;
         c = '*';
     } else {
-        selected = remove_from_list(&num_selected, selected, i);
+        unselect_file(str);
         c = ' ';
         num_selected ? (idx = 1) : (idx = 2);
     }
@@ -205,16 +251,178 @@ void manage_space_press(const char *str) {
     if (!strcmp(ps[active].my_cwd, ps[!active].my_cwd)) {
         highlight_selected(str, c, !active);
     }
-    update_special_mode(num_selected, selected, selected_);
+    update_selected_mode();
 }
 
-static void select_file(const char *str) {
-    selected = safe_realloc(++num_selected, selected);
-    if (quit) {
-        return;
+/*
+ * Returns slot of str in selected files, or -1.
+ */
+int selected_index(const char *str) {
+    return sel_table ? sel_table[find_selected(str, strmap_hash(str))] - 1 : -1;
+}
+
+/*
+ * Returns bucket of str in sel_table, or the empty one where it would be put.
+ */
+static int find_selected(const char *str, uint32_t hash) {
+    int mask = sel_table_cap - 1, i = hash & mask;
+    
+    for (; sel_table[i]; i = (i + 1) & mask) {
+        const struct sel_slot *s = &sel_slot[sel_table[i] - 1];
+        
+        if (s->hash == hash && !strcmp(sel_arena + s->off, str)) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void insert_selected(int slot) {
+    int mask = sel_table_cap - 1, i = sel_slot[slot].hash & mask;
+    
+    while (sel_table[i]) {
+        i = (i + 1) & mask;
+    }
+    sel_table[i] = slot + 1;
+}
+
+/*
+ * Rebuilds sel_table from live slots, after it grew or slots moved.
+ */
+static void index_selected(void) {
+    memset(sel_table, 0, sel_table_cap * sizeof(int));
+    for (int j = 0; j < sel_slots; j++) {
+        if (sel_slot[j].off != SEL_DEAD) {
+            insert_selected(j);
+        }
+    }
+}
+
+/*
+ * Returns i-th selected file, in selection order.
+ */
+const char *selected_file(int i) {
+    if (sel_slots != num_selected) {
+        compact_selected();
+    }
+    return sel_arena + sel_slot[i].off;
+}
+
+/*
+ * Returns number of selected archive members.
+ */
+int selected_members(void) {
+    return sel_members;
+}
+
+/*
+ * Makes room for num more selected files, whose paths are bytes long in total.
+ * Slots, arena and sel_table grow geometrically, once for a whole batch.
+ */
+static int reserve_selected(int num, size_t bytes) {
+    if (sel_slots + num > sel_slot_cap) {
+        int cap = sel_slot_cap ? sel_slot_cap : 64;
+        struct sel_slot *tmp;
+        
+        while (cap < sel_slots + num) {
+            cap *= 2;
+        }
+        if (!(tmp = realloc(sel_slot, cap * sizeof(struct sel_slot)))) {
+            return -1;
+        }
+        sel_slot = tmp;
+        sel_slot_cap = cap;
+    }
+    if (sel_len + bytes > sel_size) {
+        size_t size = sel_size ? sel_size : 4096;
+        char *tmp;
+        
+        while (size < sel_len + bytes) {
+            size *= 2;
+        }
+        if (!(tmp = realloc(sel_arena, size))) {
+            return -1;
+        }
+        sel_arena = tmp;
+        sel_size = size;
+    }
+    if (2 * (num_selected + num) > sel_table_cap) {
+        int cap = sel_table_cap ? sel_table_cap : 128;
+        int *tmp;
+        
+        while (cap < 2 * (num_selected + num)) {
+            cap *= 2;
+        }
+        if (!(tmp = realloc(sel_table, cap * sizeof(int)))) {
+            return -1;
+        }
+        sel_table = tmp;
+        sel_table_cap = cap;
+        index_selected();
+    }
+    return 0;
+}
+
+static int select_file(const char *str) {
+    size_t len = strnlen(str, PATH_MAX);
+    
+    if (reserve_selected(1, len + 1) == -1) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        return -1;
+    }
+    memcpy(sel_arena + sel_len, str, len);
+    sel_arena[sel_len + len] = '\0';
+    sel_slot[sel_slots].off = sel_len;
+    sel_slot[sel_slots].hash = strmap_hash(sel_arena + sel_len);
+    sel_slot[sel_slots].member = ps[active].mode == archive_;
+    sel_members += sel_slot[sel_slots].member;
+    insert_selected(sel_slots++);
+    sel_len += len + 1;
+    num_selected++;
+    return 0;
+}
+
+/*
+ * Leaves a tombstone in slot: caller then calls trim_selected().
+ * Its bucket is emptied by moving back following ones of the same run
+ * that may live there, so that no lookup stops early.
+ */
+static void drop_selected(int slot) {
+    int mask = sel_table_cap - 1, i = sel_slot[slot].hash & mask;
+    
+    while (sel_table[i] != slot + 1) {
+        i = (i + 1) & mask;
+    }
+    for (int j = (i + 1) & mask; sel_table[j]; j = (j + 1) & mask) {
+        int home = sel_slot[sel_table[j] - 1].hash & mask;
+        
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            sel_table[i] = sel_table[j];
+            i = j;
+        }
+    }
+    sel_table[i] = 0;
+    sel_members -= sel_slot[slot].member;
+    sel_slot[slot].off = SEL_DEAD;
+    sel_rows_num = 0;
+    num_selected--;
+}
+
+static void unselect_file(const char *str) {
+    drop_selected(selected_index(str));
+    trim_selected();
+}
+
+/*
+ * An empty selection is freed; else it is compacted once half of its slots are tombstones.
+ */
+static void trim_selected(void) {
+    if (!num_selected) {
+        free_selected();
+    } else if (sel_slots > 2 * num_selected) {
+        compact_selected();
     }
-    memset(selected[num_selected - 1], 0, PATH_MAX + 1);
-    strncpy(selected[num_selected - 1], str, PATH_MAX);
 }
 
 void manage_all_space_press(void) {
@@ -226,81 +434,257 @@ void manage_all_space_press(void) {
         idx = 3;
     } else {
         deselect_all();
-        selected ? (idx = 4) : (idx = 5);
+        num_selected ? (idx = 4) : (idx = 5);
     }
     print_info(_(file_sel[idx]), INFO_LINE);
-    update_special_mode(num_selected, selected, selected_);
+    update_selected_mode();
 }
 
+/*
+ * Rows of active tab are marked one by one; other tab, if it shows the same dir,
+ * is marked once at the end.
+ */
 static void select_all(void) {
     for (int i = 0; i < ps[active].number_of_files; i++) {
-        if (strcmp(strrchr(ps[active].nl[i], '/') + 1, "..")) {
-            if (is_present(ps[active].nl[i], selected, num_selected, -1, 0) != -1) {
-                continue;
-            }
-            select_file(ps[active].nl[i]);
-            highlight_selected(ps[active].nl[i], '*', active);
-            if (!strcmp(ps[active].my_cwd, ps[!active].my_cwd)) {
-                highlight_selected(ps[active].nl[i], '*', !active);
+        if (strcmp(strrchr(tab_entry(active, i), '/') + 1, "..") && selected_index(tab_entry(active, i)) == -1) {
+            if (select_file(tab_entry(active, i)) == -1) {
+                return;
             }
+            mark_row(active, i, '*');
         }
     }
+    if (!strcmp(ps[active].my_cwd, ps[!active].my_cwd)) {
+        refresh_selected_marks(!active);
+    }
 }
 
 static void deselect_all(void) {
     for (int i = 0; i < ps[active].number_of_files; i++) {
-        int j = is_present(ps[active].nl[i], selected, num_selected, -1, 0);
+        int j = selected_index(tab_entry(active, i));
+        
         if (j != -1) {
-            selected = remove_from_list(&num_selected, selected, j);
-            highlight_selected(ps[active].nl[i], ' ', active);
-            if (!strcmp(ps[active].my_cwd, ps[!active].my_cwd)) {
-                highlight_selected(ps[active].nl[i], ' ', !active);
+            drop_selected(j);
+            mark_row(active, i, ' ');
+        }
+    }
+    trim_selected();
+    if (!strcmp(ps[active].my_cwd, ps[!active].my_cwd)) {
+        refresh_selected_marks(!active);
+    }
+}
+
+/*
+ * Drops tombstones in a single pass, moving following paths back and keeping selection order.
+ */
+static void compact_selected(void) {
+    size_t len = 0;
+    int num = 0;
+    
+    for (int j = 0; j < sel_slots; j++) {
+        if (sel_slot[j].off != SEL_DEAD) {
+            size_t size = strlen(sel_arena + sel_slot[j].off) + 1;
+            
+            if (j != num) {
+                memmove(sel_arena + len, sel_arena + sel_slot[j].off, size);
+                sel_slot[num] = sel_slot[j];
+                sel_slot[num].off = len;
+            }
+            len += size;
+            num++;
+        }
+    }
+    sel_len = len;
+    sel_slots = num;
+    index_selected();
+}
+
+/*
+ * Copies selected files not already there to sel_rows.
+ */
+static int build_selected_rows(void) {
+    if (num_selected > sel_rows_cap) {
+        int cap = sel_rows_cap ? sel_rows_cap : 64;
+        char (*tmp)[PATH_MAX + 1];
+        
+        while (cap < num_selected) {
+            cap *= 2;
+        }
+        if (!(tmp = realloc(sel_rows, cap * (PATH_MAX + 1)))) {
+            quit = MEM_ERR_QUIT;
+            ERROR("could not malloc. Leaving.");
+            return -1;
+        }
+        sel_rows = tmp;
+        sel_rows_cap = cap;
+    }
+    for (; sel_rows_num < num_selected; sel_rows_num++) {
+        strcpy(sel_rows[sel_rows_num], selected_file(sel_rows_num));
+    }
+    return 0;
+}
+
+/*
+ * Refreshes tabs in selected mode; their rows are only built if there is any.
+ */
+static void update_selected_mode(void) {
+    for (int win = 0; win < cont; win++) {
+        if (ps[win].mode == selected_ && num_selected) {
+            if (build_selected_rows() == 0) {
+                update_special_mode(num_selected, sel_rows, selected_);
+            }
+            return;
+        }
+    }
+    update_special_mode(num_selected, NULL, selected_);
+}
+
+/*
+ * Selects (select == 1) or unselects every file of current listing matching an expression
+ * of predicates (see compile_predicates()). Files are statx'ed only if their name
+ * is not enough to evaluate it. Matching files are collected first, so that selection
+ * is sized once for all of them. Marks are printed once, at the end.
+ */
+void select_matching(int select) {
+    char str[100] = {0}, mesg[100];
+    struct pred_expr e;
+    struct statx stx;
+    int fd, num = 0, *matches;
+    size_t bytes = 0;
+    
+    ask_user(_(pred_sel[!select]), str, sizeof(str) - 1);
+    if (!strlen(str) || str[0] == 27) {
+        return;
+    }
+    if (compile_predicates(str, &e) == -1) {
+        print_info(_(pred_wrong_expr), ERR_LINE);
+        return;
+    }
+    if (!(matches = malloc(ps[active].number_of_files * sizeof(int)))) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        return;
+    }
+    fd = open(ps[active].my_cwd, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int i = 0; i < ps[active].number_of_files && !quit; i++) {
+        const char *name = strrchr(tab_entry(active, i), '/') + 1;
+        int j = selected_index(tab_entry(active, i)), ret;
+        
+        // ".." is never selected; nothing to do for files already as wanted
+        if (!strcmp(name, "..") || (j != -1) == select) {
+            continue;
+        }
+        if ((ret = eval_predicates(&e, name, DT_UNKNOWN, NULL)) == -1) {
+            if (fd == -1 || statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, e.mask | STATX_TYPE, &stx) == -1) {
+                continue;
+            }
+            ret = eval_predicates(&e, name, IFTODT(stx.stx_mode), &stx);
+        }
+        if (ret == 1) {
+            if (!select) {
+                drop_selected(j);
+            } else {
+                bytes += strlen(tab_entry(active, i)) + 1;
+            }
+            matches[num++] = i;
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (!select) {
+        trim_selected();
+    } else if (num && reserve_selected(num, bytes) == -1) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+    } else {
+        for (int i = 0; i < num; i++) {
+            if (select_file(tab_entry(active, matches[i])) == -1) {
+                break;
             }
         }
     }
+    free(matches);
+    refresh_selected_marks(active);
+    if (cont == 2 && !strcmp(ps[active].my_cwd, ps[!active].my_cwd)) {
+        refresh_selected_marks(!active);
+    }
+    update_selected_mode();
+    snprintf(mesg, sizeof(mesg), _(pred_sel_result[!select]), num);
+    print_info(mesg, INFO_LINE);
 }
 
 void remove_selected(void) {
+    const char *str = tab_entry(active, ps[active].curr_pos);
     int idx;
     
     if (!strcmp(ps[active].my_cwd, ps[!active].my_cwd)) {
-        highlight_selected(selected[ps[active].curr_pos], ' ', !active);
+        highlight_selected(str, ' ', !active);
     }
-    selected = remove_from_list(&num_selected, selected, ps[active].curr_pos);
+    unselect_file(str);
     if (num_selected) {
         idx = 1;
     } else {
         idx = 2;
     }
-    update_special_mode(num_selected, selected, selected_);
+    update_selected_mode();
     print_info(_(file_sel[idx]), INFO_LINE);
 }
 
 void remove_all_selected(void) {
-    for (int i = 0; i < num_selected; i++) {
-        if (cont == 2) {
-            highlight_selected(selected[i], ' ', !active);
-        }
+    free_selected();
+    if (cont == 2) {
+        refresh_selected_marks(!active);
     }
-    free(selected);
-    selected = NULL;
-    num_selected = 0;
-    update_special_mode(num_selected, selected, selected_);
+    update_selected_mode();
     print_info(_(selected_cleared), INFO_LINE);
 }
 
 void show_selected(void) {
-    if (num_selected) {
-        show_special_tab(num_selected, selected, selected_mode_str, selected_);
-    } else {
+    if (!num_selected) {
         print_info(_(no_selected_files), INFO_LINE);
+    } else if (build_selected_rows() == 0) {
+        show_special_tab(num_selected, sel_rows, selected_mode_str, selected_);
     }
 }
 
-void free_selected(void) {
-    if (selected) {
-        free(selected);
+/*
+ * Hands selected files over to a new job, in selection order: pointers to them are followed
+ * by their paths in the same block, to be freed at once. Selection is emptied.
+ */
+char **detach_selected(void) {
+    char **files;
+    
+    if (sel_slots != num_selected) {
+        compact_selected();
+    }
+    if ((files = malloc(num_selected * sizeof(char *) + sel_len))) {
+        char *paths = (char *)(files + num_selected);
+        
+        memcpy(paths, sel_arena, sel_len);
+        for (int i = 0; i < num_selected; i++) {
+            files[i] = paths + sel_slot[i].off;
+        }
+    } else {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
     }
+    free_selected();
+    update_selected_mode();
+    return files;
+}
+
+void free_selected(void) {
+    free(sel_arena);
+    free(sel_slot);
+    free(sel_table);
+    free(sel_rows);
+    sel_arena = NULL;
+    sel_slot = NULL;
+    sel_table = NULL;
+    sel_rows = NULL;
+    sel_len = sel_size = 0;
+    sel_slots = sel_slot_cap = sel_table_cap = sel_rows_num = sel_rows_cap = sel_members = 0;
+    num_selected = 0;
 }
 
 /*
@@ -0,0 +1,550 @@
+#include "../inc/fuzzy.h"
+
+/*
+ * Candidates are stored as pointers (relative to walk root) inside fixed blocks,
+ * whose strings live in never-moved chunks: this way the walker can keep appending
+ * while scoring jobs read them, only publishing the new num_cands.
+ */
+#define CAND_BLOCK_SHIFT 16
+#define CAND_BLOCK (1 << CAND_BLOCK_SHIFT)
+#define MAX_CAND_BLOCKS 256
+#define NAMES_CHUNK (1024 * 1024)
+
+/*
+ * Scoring bonuses/penalties
+ */
+#define FUZZY_MATCH 16
+#define FUZZY_BOUNDARY 8
+#define FUZZY_CONSECUTIVE 4
+#define FUZZY_BASENAME 8
+#define FUZZY_GAP 1
+
+struct fuzzy_match {
+    int idx;
+    int score;
+};
+
+/*
+ * Matches of pattern[0..level]: candidates up to "scanned" were already scored,
+ * so a longer pattern only needs to refine these, plus candidates walked meanwhile.
+ */
+struct fuzzy_level {
+    struct fuzzy_match *matches;
+    int num_matches;
+    int scanned;
+    int computed;
+};
+
+/*
+ * Scoring job: scores either src matches or candidates in [from, to),
+ * keeping its own matches and its own top MAX_FUZZY_RESULTS heap.
+ */
+struct fuzzy_job {
+    const struct fuzzy_match *src;
+    int from, to;
+    struct fuzzy_match *matches;
+    int num_matches;
+    struct fuzzy_match top[MAX_FUZZY_RESULTS];
+    int num_top;
+};
+
+static int walk_candidates(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf);
+static void *walker_thread(void *x);
+static void notify_walk(int force);
+static int add_candidate(const char *name);
+static const char *candidate(int i);
+static int match_score(const char *str, const char *pattern, int icase);
+static int fuzzy_score(const char *str, const char *pattern, int icase);
+static void refine(int level);
+static void reset_levels(void);
+static void score_job(void *x);
+static int cmp_score(const void *a, const void *b);
+static void heap_push(struct fuzzy_match *heap, int *num, struct fuzzy_match m);
+static void update_results(void);
+static void free_fuzzy(void);
+
+static char root[PATH_MAX + 1];
+static char pattern[NAME_MAX + 1];
+static int root_len, pattern_len, icase, walk_hidden, walking;
+static char **cand_blocks[MAX_CAND_BLOCKS];
+static char **names_chunks;
+static int num_chunks;
+static size_t chunk_used;
+static atomic_int num_cands, stop_walk;
+static struct fuzzy_level levels[NAME_MAX + 1];
+static struct fuzzy_match ranked[MAX_FUZZY_RESULTS];
+static char (*results)[PATH_MAX + 1];
+static int num_results;
+static struct thpool *pool;
+static pthread_t walker_th;
+static int fuzzy_fd = -1;
+
+/*
+ * Returns the fd polled by main loop to know that new candidates were walked.
+ */
+int fuzzy_init(void) {
+    fuzzy_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return fuzzy_fd;
+}
+
+/*
+ * Enters fuzzy finder mode in active tab: starts walking current dir
+ * in background, while user can already start typing.
+ * Only one tab at a time can be in fuzzy finder mode.
+ */
+void show_fuzzy_finder(void) {
+    if (ps[!active].mode == fuzzy_) {
+        print_info(_(fuzzy_already_active), ERR_LINE);
+        return;
+    }
+    if (!(results = calloc(MAX_FUZZY_RESULTS, PATH_MAX + 1))) {
+        quit = MEM_ERR_QUIT;
+        ERROR("could not malloc. Leaving.");
+        return;
+    }
+    strncpy(root, ps[active].my_cwd, PATH_MAX);
+    // avoid a double slash when building results' path from "/"
+    root_len = strcmp(root, "/") ? strlen(root) : 0;
+    walk_hidden = ps[active].show_hidden;
+    memset(pattern, 0, sizeof(pattern));
+    pattern_len = 0;
+    icase = 1;
+    atomic_store(&num_cands, 0);
+    atomic_store(&stop_walk, 0);
+    pool = thpool_new(0);
+    walking = !pthread_create(&walker_th, NULL, walker_thread, NULL);
+    num_results = 0;
+    show_special_tab(num_results, results, ps[active].title, fuzzy_);
+    update_results();
+}
+
+static void *walker_thread(void *x) {
+    nftw(root, walk_candidates, 64, FTW_MOUNT | FTW_PHYS | FTW_ACTIONRETVAL);
+    notify_walk(1);
+    pthread_exit(NULL);
+}
+
+/*
+ * Wakes up main loop to update results (see refresh_fuzzy_finder()),
+ * at most once every FUZZY_REFRESH_MS unless forced (when walk is over).
+ */
+static void notify_walk(int force) {
+    static struct timespec last;
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (force || (now.tv_sec - last.tv_sec) * 1000 + (now.tv_nsec - last.tv_nsec) / 1000000 >= FUZZY_REFRESH_MS) {
+        if (fuzzy_fd != -1 && !atomic_load(&stop_walk)) {
+            eventfd_write(fuzzy_fd, 1);
+        }
+        last = now;
+    }
+}
+
+static int walk_candidates(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    if (quit || atomic_load(&stop_walk)) {
+        return FTW_STOP;
+    }
+    if (ftwbuf->level == 0) {
+        return FTW_CONTINUE;
+    }
+    if (!walk_hidden && path[ftwbuf->base] == '.') {
+        return FTW_SKIP_SUBTREE;
+    }
+    if (add_candidate(path + root_len + 1) == -1) {
+        return FTW_STOP;
+    }
+    notify_walk(0);
+    return FTW_CONTINUE;
+}
+
+static int add_candidate(const char *name) {
+    int n = atomic_load_explicit(&num_cands, memory_order_relaxed);
+    int block = n >> CAND_BLOCK_SHIFT;
+    size_t len = strlen(name) + 1;
+    
+    if (block == MAX_CAND_BLOCKS) {
+        return -1;
+    }
+    if (!cand_blocks[block] && !(cand_blocks[block] = malloc(CAND_BLOCK * sizeof(char *)))) {
+        return -1;
+    }
+    if (!num_chunks || chunk_used + len > NAMES_CHUNK) {
+        char **tmp = realloc(names_chunks, (num_chunks + 1) * sizeof(char *));
+        
+        if (!tmp || !(tmp[num_chunks] = malloc(NAMES_CHUNK))) {
+            names_chunks = tmp ? tmp : names_chunks;
+            return -1;
+        }
+        names_chunks = tmp;
+        num_chunks++;
+        chunk_used = 0;
+    }
+    cand_blocks[block][n & (CAND_BLOCK - 1)] = memcpy(names_chunks[num_chunks - 1] + chunk_used, name, len);
+    chunk_used += len;
+    atomic_store_explicit(&num_cands, n + 1, memory_order_release);
+    return 0;
+}
+
+static const char *candidate(int i) {
+    return cand_blocks[i >> CAND_BLOCK_SHIFT][i & (CAND_BLOCK - 1)];
+}
+
+/*
+ * Printable chars are appended to pattern, and current matches refined with them;
+ * backspace drops last char, going back to previous (cached) level of matches.
+ */
+void fuzzy_input(wint_t c) {
+    char mbstr[MB_LEN_MAX + 1] = {0};
+    int len, old_icase = icase;
+    
+    if (c == 127 || c == KEY_BACKSPACE) {
+        if (!pattern_len) {
+            return;
+        }
+        // drop a whole utf8 char, and the levels of each of its bytes
+        while (pattern_len) {
+            char removed = pattern[--pattern_len];
+            
+            free(levels[pattern_len + 1].matches);
+            memset(&levels[pattern_len + 1], 0, sizeof(struct fuzzy_level));
+            pattern[pattern_len] = '\0';
+            if ((removed & 0xC0) != 0x80) {
+                break;
+            }
+        }
+    } else {
+        len = wctomb(mbstr, c);
+        if (len <= 0 || pattern_len + len >= NAME_MAX) {
+            return;
+        }
+        // only the level of last byte of a multibyte char gets computed
+        memcpy(pattern + pattern_len, mbstr, len);
+        pattern_len += len;
+    }
+    // smart case: an uppercase char makes the whole match case sensitive
+    icase = 1;
+    for (int i = 0; i < pattern_len; i++) {
+        if (isupper((unsigned char)pattern[i])) {
+            icase = 0;
+        }
+    }
+    // cached levels are not valid anymore if case sensitivity changed
+    if (icase != old_icase) {
+        reset_levels();
+    }
+    update_results();
+}
+
+/*
+ * Refines levels[level] from levels[level - 1] (or extends it with newly walked candidates
+ * when it is already computed), splitting the work between pool threads.
+ * Then ranks the best MAX_FUZZY_RESULTS matches.
+ */
+static void refine(int level) {
+    int prev = level - 1, n_jobs = 1, cands = atomic_load_explicit(&num_cands, memory_order_acquire);
+    struct fuzzy_level *l = &levels[level];
+    struct fuzzy_job *jobs;
+    const struct fuzzy_match *src = NULL;
+    int src_num = 0, from = 0;
+    
+    if (l->computed) {
+        // eg: after a backspace: its matches only need to be ranked again
+        src = l->matches;
+        src_num = l->num_matches;
+        from = l->scanned;
+    } else {
+        // find nearest computed level (multibyte chars leave uncomputed levels behind)
+        while (prev > 0 && !levels[prev].computed) {
+            prev--;
+        }
+        if (prev > 0) {
+            src = levels[prev].matches;
+            src_num = levels[prev].num_matches;
+            from = levels[prev].scanned;
+        }
+    }
+    if (pool) {
+        n_jobs = thpool_default_size();
+    }
+    if (!(jobs = calloc(n_jobs * 2, sizeof(struct fuzzy_job)))) {
+        ERROR("could not malloc.");
+        return;
+    }
+    // first n_jobs jobs refine previous matches, last ones score candidates walked meanwhile
+    for (int i = 0; i < n_jobs; i++) {
+        jobs[i].src = src;
+        jobs[i].from = (long)src_num * i / n_jobs;
+        jobs[i].to = (long)src_num * (i + 1) / n_jobs;
+        jobs[n_jobs + i].from = from + (long)(cands - from) * i / n_jobs;
+        jobs[n_jobs + i].to = from + (long)(cands - from) * (i + 1) / n_jobs;
+    }
+    for (int i = 0; i < 2 * n_jobs; i++) {
+        if (jobs[i].to > jobs[i].from) {
+            if (!pool || thpool_add(pool, score_job, &jobs[i]) == -1) {
+                score_job(&jobs[i]);
+            }
+        }
+    }
+    if (pool) {
+        thpool_wait(pool);
+    }
+    
+    int total = 0, num_top = 0;
+    for (int i = 0; i < 2 * n_jobs; i++) {
+        total += jobs[i].num_matches;
+        num_top += jobs[i].num_top;
+    }
+    struct fuzzy_match *matches = malloc((total ? total : 1) * sizeof(struct fuzzy_match));
+    struct fuzzy_match *top = malloc((num_top ? num_top : 1) * sizeof(struct fuzzy_match));
+    if (matches && top) {
+        total = num_top = 0;
+        for (int i = 0; i < 2 * n_jobs; i++) {
+            memcpy(matches + total, jobs[i].matches, jobs[i].num_matches * sizeof(struct fuzzy_match));
+            total += jobs[i].num_matches;
+            memcpy(top + num_top, jobs[i].top, jobs[i].num_top * sizeof(struct fuzzy_match));
+            num_top += jobs[i].num_top;
+        }
+        free(l->matches);
+        l->matches = matches;
+        l->num_matches = total;
+        l->scanned = cands;
+        l->computed = 1;
+        qsort(top, num_top, sizeof(struct fuzzy_match), cmp_score);
+        num_results = num_top < MAX_FUZZY_RESULTS ? num_top : MAX_FUZZY_RESULTS;
+        memcpy(ranked, top, num_results * sizeof(struct fuzzy_match));
+    } else {
+        free(matches);
+        ERROR("could not malloc.");
+    }
+    free(top);
+    for (int i = 0; i < 2 * n_jobs; i++) {
+        free(jobs[i].matches);
+    }
+    free(jobs);
+}
+
+static void reset_levels(void) {
+    for (int i = 0; i <= NAME_MAX; i++) {
+        free(levels[i].matches);
+    }
+    memset(levels, 0, sizeof(levels));
+}
+
+static void score_job(void *x) {
+    struct fuzzy_job *job = (struct fuzzy_job *)x;
+    
+    if (!(job->matches = malloc((job->to - job->from) * sizeof(struct fuzzy_match)))) {
+        return;
+    }
+    for (int i = job->from; i < job->to; i++) {
+        int idx = job->src ? job->src[i].idx : i;
+        int score = fuzzy_score(candidate(idx), pattern, icase);
+        
+        if (score >= 0) {
+            struct fuzzy_match m = { .idx = idx, .score = score };
+            
+            job->matches[job->num_matches++] = m;
+            heap_push(job->top, &job->num_top, m);
+        }
+    }
+}
+
+/*
+ * Keeps best MAX_FUZZY_RESULTS matches in a min-heap (worst one on top).
+ */
+static void heap_push(struct fuzzy_match *heap, int *num, struct fuzzy_match m) {
+    struct fuzzy_match tmp;
+    int i;
+    
+    if (*num == MAX_FUZZY_RESULTS) {
+        if (m.score <= heap[0].score) {
+            return;
+        }
+        // replace worst match and sift it down
+        heap[0] = m;
+        i = 0;
+        while (1) {
+            int l = 2 * i + 1, r = l + 1, min = i;
+            
+            if (l < *num && heap[l].score < heap[min].score) {
+                min = l;
+            }
+            if (r < *num && heap[r].score < heap[min].score) {
+                min = r;
+            }
+            if (min == i) {
+                break;
+            }
+            tmp = heap[min];
+            heap[min] = heap[i];
+            heap[i] = tmp;
+            i = min;
+        }
+        return;
+    }
+    i = (*num)++;
+    heap[i] = m;
+    while (i && heap[(i - 1) / 2].score > heap[i].score) {
+        tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static int cmp_score(const void *a, const void *b) {
+    const struct fuzzy_match *m1 = a, *m2 = b;
+    
+    if (m1->score != m2->score) {
+        return m2->score - m1->score;
+    }
+    return m1->idx - m2->idx;
+}
+
+/*
+ * Prefers a match inside file basename; fallbacks to a match on the whole relative path.
+ */
+static int fuzzy_score(const char *str, const char *pattern, int icase) {
+    const char *base = strrchr(str, '/');
+    int score;
+    
+    if (base && (score = match_score(base + 1, pattern, icase)) >= 0) {
+        return score + FUZZY_BASENAME * pattern_len;
+    }
+    return match_score(str, pattern, icase);
+}
+
+/*
+ * Returns a score for str matching pattern as a subsequence, -1 if it does not match.
+ * Chars matching at word boundaries (after '/', '_', '-', '.', ' ') and consecutive chars
+ * gain a bonus, while gaps between matched chars and longer strings are penalized.
+ */
+static int match_score(const char *str, const char *pattern, int icase) {
+    const char *p = pattern, *s;
+    int score = 0, consecutive = 0;
+    
+    for (s = str; *s && *p; s++) {
+        char c = icase ? tolower((unsigned char)*s) : *s;
+        
+        if (c == *p) {
+            score += FUZZY_MATCH + FUZZY_CONSECUTIVE * consecutive;
+            if (s == str || strchr("/_-. ", s[-1])) {
+                score += FUZZY_BOUNDARY;
+            }
+            consecutive++;
+            p++;
+        } else {
+            if (p != pattern) {
+                score -= FUZZY_GAP;
+            }
+            consecutive = 0;
+        }
+    }
+    if (*p) {
+        return -1;
+    }
+    score -= (s - str + strlen(s)) / 8;
+    return score > 0 ? score : 0;
+}
+
+/*
+ * Recomputes ranked results for current pattern, then refreshes fuzzy tab.
+ * With an empty pattern, first walked candidates are shown.
+ */
+static void update_results(void) {
+    int cands;
+    
+    if (pattern_len) {
+        refine(pattern_len);
+    } else {
+        cands = atomic_load_explicit(&num_cands, memory_order_acquire);
+        num_results = cands < MAX_FUZZY_RESULTS ? cands : MAX_FUZZY_RESULTS;
+        for (int i = 0; i < num_results; i++) {
+            ranked[i].idx = i;
+        }
+    }
+    for (int i = 0; i < num_results; i++) {
+        snprintf(results[i], PATH_MAX, "%.*s/%s", root_len, root, candidate(ranked[i].idx));
+    }
+    for (int win = 0; win < cont; win++) {
+        if (ps[win].mode == fuzzy_) {
+            snprintf(ps[win].title, PATH_MAX, _(fuzzy_mode_str), pattern, num_results, atomic_load(&num_cands));
+            ps[win].number_of_files = num_results;
+            reset_win(win);
+        }
+    }
+}
+
+/*
+ * Called by main loop while candidates are walked: counts and results are updated,
+ * cursor stays on the highlighted result (that can only move down in ranking).
+ */
+void refresh_fuzzy_finder(void) {
+    for (int win = 0; win < cont; win++) {
+        if (ps[win].mode == fuzzy_ && results) {
+            int idx = num_results ? ranked[ps[win].curr_pos].idx : -1;
+            
+            update_results();
+            for (int i = 0; i < num_results; i++) {
+                if (ranked[i].idx == idx) {
+                    if (i > 0) {
+                        scroll_down(win, i);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Moves to the highlighted result's dir (or inside it, if it is a dir).
+ */
+void fuzzy_enter_press(struct stat s) {
+    if (num_results) {
+        leave_mode_helper(s);
+        free_fuzzy();
+    }
+}
+
+void leave_fuzzy_mode(const char *str) {
+    leave_special_mode(str, active);
+    free_fuzzy();
+}
+
+/*
+ * Called at exit: fuzzy finder may still be active.
+ */
+void free_fuzzy_finder(void) {
+    free_fuzzy();
+    if (fuzzy_fd != -1) {
+        close(fuzzy_fd);
+        fuzzy_fd = -1;
+    }
+}
+
+static void free_fuzzy(void) {
+    atomic_store(&stop_walk, 1);
+    if (walking) {
+        pthread_join(walker_th, NULL);
+        walking = 0;
+    }
+    if (pool) {
+        thpool_free(pool);
+        pool = NULL;
+    }
+    reset_levels();
+    for (int i = 0; i < MAX_CAND_BLOCKS; i++) {
+        free(cand_blocks[i]);
+        cand_blocks[i] = NULL;
+    }
+    for (int i = 0; i < num_chunks; i++) {
+        free(names_chunks[i]);
+    }
+    free(names_chunks);
+    names_chunks = NULL;
+    num_chunks = 0;
+    free(results);
+    results = NULL;
+}
@@ -0,0 +1,82 @@
+#include "../inc/latency.h"
+
+#ifdef LATENCY_STATS
+
+static unsigned long buckets[LATENCY_BUCKETS];
+static unsigned long num_keys, max_us;
+static struct timespec key_time;
+static int pending;
+
+/*
+ * A key was just read.
+ */
+void latency_key(void) {
+    clock_gettime(CLOCK_MONOTONIC, &key_time);
+    pending = 1;
+}
+
+/*
+ * Last key read was handled (main loop is going to wait for next one).
+ */
+void latency_painted(void) {
+    struct timespec now;
+    unsigned long us;
+    int i = 0;
+    
+    if (!pending) {
+        return;
+    }
+    pending = 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    us = (now.tv_sec - key_time.tv_sec) * 1000000 + (now.tv_nsec - key_time.tv_nsec) / 1000;
+    while (i < LATENCY_BUCKETS - 1 && us >= (1UL << i)) {
+        i++;
+    }
+    buckets[i]++;
+    num_keys++;
+    if (us > max_us) {
+        max_us = us;
+    }
+}
+
+/*
+ * Last key read is not counted: it led to a question, so
+ * time spent by user answering it is not a latency.
+ */
+void latency_discard(void) {
+    pending = 0;
+}
+
+/*
+ * Logs histogram (at info level), with approximated median and 99th percentile.
+ */
+void latency_dump(void) {
+    unsigned long seen = 0, p50 = 0, p99 = 0;
+    char line[100];
+    
+    if (!num_keys) {
+        return;
+    }
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (!buckets[i]) {
+            continue;
+        }
+        seen += buckets[i];
+        if (!p50 && seen * 2 >= num_keys) {
+            p50 = 1UL << i;
+        }
+        if (!p99 && seen * 100 >= num_keys * 99) {
+            p99 = 1UL << i;
+        }
+        if (i < LATENCY_BUCKETS - 1) {
+            snprintf(line, sizeof(line), "key to paint latency < %lu us: %lu keys", 1UL << i, buckets[i]);
+        } else {
+            snprintf(line, sizeof(line), "key to paint latency >= %lu us: %lu keys", 1UL << (i - 1), buckets[i]);
+        }
+        INFO(line);
+    }
+    snprintf(line, sizeof(line), "%lu keys: median < %lu us, 99%% < %lu us, max %lu us", num_keys, p50, p99, max_us);
+    INFO(line);
+}
+
+#endif
@@ -61,7 +61,11 @@ static void log_current_options(void) {
     fprintf(log_file, "* Low battery threshold: %d\n", config.bat_low_level);
     fprintf(log_file, "* Cursor chars: \"%ls\"\n", config.cursor_chars);
     fprintf(log_file, "* Sysinfo layout: \"%s\"\n", config.sysinfo_layout);
-    fprintf(log_file, "* Safe level: %d\n\n", config.safe);
+    fprintf(log_file, "* Safe level: %d\n", config.safe);
+    fprintf(log_file, "* Archive search depth: %d\n", config.archive_search_depth);
+    fprintf(log_file, "* Archive threads: %d\n", config.archive_threads);
+    fprintf(log_file, "* Archive compression level: %d\n", config.archive_level);
+    fprintf(log_file, "* Parallel gzip: %d\n\n", config.parallel_gzip);
 }
 
 void log_message(const char *filename, int lineno, const char *funcname, 
@@ -37,17 +37,20 @@ static void manage_enter(struct stat current_file_stat);
 static void manage_enter_search(struct stat current_file_stat);
 static void manage_space(const char *str);
 static void manage_quit(void);
-static void switch_search(void);
+static int check_running_jobs(void);
+static void switch_search(void (*f)(void));
 static void check_remove(void (*f)(void));
 static int check_init(int index);
+static void check_archives(void);
 static int check_access(void);
 static void go_root_dir(void);
+static struct stat current_stat(void);
 
 /*
  * pointers to long_file_operations functions, used in main loop;
  */
 static int (*const long_func[LONG_FILE_OPERATIONS])(void) = {
-    move_file, paste_file, remove_file, create_archive, extract_file
+    move_file, paste_file, remove_file, create_archive, extract_file, update_archive, test_archives, size_archives
 };
 
 int main(int argc, char * const argv[])
@@ -102,7 +105,7 @@ static void set_pollfd(void) {
 #else
     nfds = 6;
 #endif
-    nfds++;
+    nfds += 6;
     
     main_p = malloc(nfds * sizeof(struct pollfd));
     main_p[GETCH_IX] = (struct pollfd) {
@@ -162,6 +165,36 @@ static void set_pollfd(void) {
         .fd = start_monitor(),
         .events = POLLIN,
     };
+    
+    // notifies dir sizes computed in background
+    main_p[DU_IX] = (struct pollfd) {
+        .fd = du_init(),
+        .events = POLLIN,
+    };
+    
+    // notifies file types classified in background
+    main_p[TYPE_IX] = (struct pollfd) {
+        .fd = filetype_init(),
+        .events = POLLIN,
+    };
+    
+    // notifies previews produced in background
+    main_p[PREVIEW_IX] = (struct pollfd) {
+        .fd = preview_init(),
+        .events = POLLIN,
+    };
+    
+    // notifies candidates walked by fuzzy finder
+    main_p[FUZZY_IX] = (struct pollfd) {
+        .fd = fuzzy_init(),
+        .events = POLLIN,
+    };
+    
+    // notifies archives read, or members extracted, while browsing archives
+    main_p[ARCH_BROWSE_IX] = (struct pollfd) {
+        .fd = archive_browse_init(),
+        .events = POLLIN,
+    };
 }
 
 /*
@@ -218,6 +251,11 @@ static void helper_function(int argc, char * const argv[]) {
     config.starting_helper = 1;
     config.bat_low_level = 15;
     config.safe = FULL_SAFE;
+    config.archive_search_depth = 1;
+    config.archive_level = -1;
+    config.parallel_gzip = 1;
+    config.dir_cache_size = 32;
+    config.dir_cache_mb = 16;
     device_init = DEVMON_STARTING;
     wcscpy(config.cursor_chars, L"->");
     /* 
@@ -231,7 +269,7 @@ static void helper_function(int argc, char * const argv[]) {
 }
 
 /*
- * When in fast_browse_mode do not enter switch case;
+ * When in fast_browse_mode or filter mode, printable chars do not enter switch case;
  * if device_mode or search_mode are active on current window,
  * only 'q', 'l', or 't' (and enter, that is not printable char) can be called.
  * else stat current file and enter switch case.
@@ -245,9 +283,10 @@ static void main_loop(void) {
      * v to paste,
      * r to remove,
      * b to compress,
-     * z to extract
+     * z to extract,
+     * a to add selected files to current archive
      */
-    const char long_table[] = "xvrbz";
+    const char long_table[] = "xvrbza";
 
     /*
      * n, d to create new file/dir
@@ -264,6 +303,12 @@ static void main_loop(void) {
      * i to trigger fullname win
      */
     const char special_mode_allowed_chars[] = "ltmrsi";
+
+    /*
+     * space to select archive members,
+     * z to extract them.
+     */
+    const char archive_mode_allowed_chars[] = " z";
     
     /*
      * Not graphical wchars:
@@ -281,6 +326,9 @@ static void main_loop(void) {
                                                                     (unsigned long)127, KEY_BACKSPACE);
     
     MEVENT event;
+#ifdef LIBCUPS_PRESENT
+    struct stat current_file_stat;
+#endif
 #if NCURSES_MOUSE_VERSION > 1
     mousemask(BUTTON1_RELEASED | BUTTON2_RELEASED | BUTTON3_RELEASED | BUTTON4_PRESSED | BUTTON5_PRESSED, NULL);
 #else
@@ -288,17 +336,29 @@ static void main_loop(void) {
 #endif
 
     while (!quit) {
+        latency_painted();
         wint_t c = main_poll(ps[active].mywin.fm);
+        latency_key();
         if ((ps[active].mode == fast_browse_) && iswgraph(c) && !wcschr(not_graph_wchars, c)) {
             fast_browse(c);
             continue;
         }
+        if ((ps[active].mode == filter_) && 
+            ((iswgraph(c) && !wcschr(not_graph_wchars, c)) || c == 127 || c == KEY_BACKSPACE)) {
+            filter_input(c);
+            continue;
+        }
+        if ((ps[active].mode == fuzzy_) && 
+            ((iswgraph(c) && !wcschr(not_graph_wchars, c)) || c == 127 || c == KEY_BACKSPACE)) {
+            fuzzy_input(c);
+            continue;
+        }
         c = tolower(c);
-        if (ps[active].mode > fast_browse_ && (isprint(c) && !strchr(special_mode_allowed_chars, c))) {
+        if (ps[active].mode > filter_ && (isprint(c) && !strchr(special_mode_allowed_chars, c)) &&
+            (ps[active].mode != archive_ || !strchr(archive_mode_allowed_chars, c))) {
             continue;
         }
-        struct stat current_file_stat = {0};
-        stat(str_ptr[active][ps[active].curr_pos], &current_file_stat);
+        // navigation keys never need current file's stat: it is only taken by actions using it
         switch (c) {
         case KEY_UP:
             scroll_up(active, 1);
@@ -319,18 +379,23 @@ static void main_loop(void) {
             scroll_down(active, ps[active].number_of_files - ps[active].curr_pos);
             break;
         case 127: case KEY_BACKSPACE: // backspace to go to root folder
-            if (ps[active].mode <= fast_browse_) {
+            if (ps[active].mode <= filter_) {
                 go_root_dir();
+            } else if (ps[active].mode == archive_) {
+                archive_go_up();
+            } else if (ps[active].mode == du_) {
+                du_go_up();
             }
             break;
         case 'h': // h to show hidden files
             switch_hidden();
             break;
         case 10: // enter to change dir or open a file.
-            manage_enter(current_file_stat);
+            manage_enter(current_stat());
             break;
         case 't': // t to open second tab
             if (cont < MAX_TABS) {
+                close_preview();
                 add_new_tab();
                 change_tab();
             }
@@ -344,7 +409,7 @@ static void main_loop(void) {
             }
             break;
         case 32: // space to select files
-            manage_space(str_ptr[active][ps[active].curr_pos]);
+            manage_space(tab_entry(active, ps[active].curr_pos));
             break;
         case 'l':  // show helper mess
             trigger_show_helper_message();
@@ -353,15 +418,19 @@ static void main_loop(void) {
             trigger_stats();
             break;
         case 'e': // add file to bookmarks
-            add_file_to_bookmarks(str_ptr[active][ps[active].curr_pos]);
+            add_file_to_bookmarks(tab_entry(active, ps[active].curr_pos));
             break;
         case 'f': // f to search
-            switch_search();
+            switch_search(search);
+            break;
+        case 'q': // q to search by predicates
+            switch_search(pred_search);
             break;
 #ifdef LIBCUPS_PRESENT
         case 'p': // p to print
+            current_file_stat = current_stat();
             if ((S_ISREG(current_file_stat.st_mode)) && !(current_file_stat.st_mode & S_IXUSR)) {
-                print_support(str_ptr[active][ps[active].curr_pos]);
+                print_support(tab_entry(active, ps[active].curr_pos));
             }
             break;
 #endif
@@ -371,6 +440,11 @@ static void main_loop(void) {
         case ',': // , to enable fast browse mode
             show_special_tab(ps[active].number_of_files, NULL, ps[active].title, fast_browse_);
             break;
+        case '/': // / to enable filter mode
+            if (ps[active].mode == normal) {
+                show_filter();
+            }
+            break;
         case 27: /* ESC to exit/leave special mode */
             manage_quit();
             break;
@@ -378,13 +452,18 @@ static void main_loop(void) {
             resize_win();
             break;
         case 9: // TAB to change sorting function
-            if (ps[active].mode <= fast_browse_) {
+            if (ps[active].mode <= filter_) {
                 change_sort();
+            } else if (ps[active].mode == search_) {
+                change_found_sort();
             }
             break;
         case 'i': // i to view current file fullname (in case it is too long)
             trigger_fullname_win();
             break;
+        case 'y': // y to show a preview of current file next to it
+            trigger_preview();
+            break;
         case 'n': case 'd': case 'o':   // fast operations do not require another thread.
             if (check_access()) {
                 ptr = strchr(short_table, c);
@@ -398,6 +477,26 @@ static void main_loop(void) {
         case 'k': // k to show selected files
             show_selected();
             break;
+        case 'j': // j to switch to fuzzy finder
+            if (ps[active].mode == normal) {
+                show_fuzzy_finder();
+            }
+            break;
+        case 'u': // u to analyze disk usage
+            if (ps[active].mode == normal) {
+                show_du_analyzer(ps[active].my_cwd);
+            }
+            break;
+        case '+': case '-': // +/- to select/unselect files matching predicates
+            if (ps[active].mode <= filter_) {
+                select_matching(c == '+');
+            }
+            break;
+        case 'c': // c to test selected archives, or to count their members and size
+            if (ps[active].mode == normal) {
+                check_archives();
+            }
+            break;
         case KEY_DC: // del to delete all selected files in selected mode/ all user bookmarks in bookmark mode
             if (ps[active].mode == bookmarks_) {
                 check_remove(remove_all_user_bookmarks);
@@ -409,14 +508,18 @@ static void main_loop(void) {
             if(getmouse(&event) == OK) {
                 if (event.bstate & BUTTON1_RELEASED) {
                     /* left click will send an enter event */
-                    manage_enter(current_file_stat);
+                    manage_enter(current_stat());
                 } else if (event.bstate & BUTTON2_RELEASED) {
                     /* middle click will send a space event */
-                    manage_space(str_ptr[active][ps[active].curr_pos]);
+                    manage_space(tab_entry(active, ps[active].curr_pos));
                 } else if (event.bstate & BUTTON3_RELEASED) {
                     /* right click will send a back to root dir event */
-                    if (ps[active].mode <= fast_browse_) {
+                    if (ps[active].mode <= filter_) {
                         go_root_dir();
+                    } else if (ps[active].mode == archive_) {
+                        archive_go_up();
+                    } else if (ps[active].mode == du_) {
+                        du_go_up();
                     }
                 }
                 /* scroll up and down events associated with mouse wheel */
@@ -432,8 +535,8 @@ static void main_loop(void) {
         default:
             ptr = strchr(long_table, c);
             if (ptr) {
-                if (ps[active].mode == normal) {
-                    index = LONG_FILE_OPERATIONS - strlen(ptr);
+                index = ptr - long_table;
+                if (ps[active].mode == normal || (ps[active].mode == archive_ && index == EXTRACTOR_TH)) {
                     if (check_init(index)) {
                         init_thread(index, long_func[index]);
                     }
@@ -478,10 +581,19 @@ static void manage_enter(struct stat current_file_stat) {
         manage_enter_bookmarks(current_file_stat);
     } else if (ps[active].mode == selected_) {
         leave_mode_helper(current_file_stat);
+    } else if (ps[active].mode == fuzzy_) {
+        fuzzy_enter_press(current_file_stat);
+    } else if (ps[active].mode == archive_) {
+        archive_enter_press();
+    } else if (ps[active].mode == du_) {
+        du_enter_press(current_file_stat);
     } else if (S_ISDIR(current_file_stat.st_mode)) {
-        change_dir(str_ptr[active][ps[active].curr_pos], active);
+        change_dir(tab_entry(active, ps[active].curr_pos), active);
+    } else if (S_ISREG(current_file_stat.st_mode) && is_ext(tab_entry(active, ps[active].curr_pos), arch_ext, NUM(arch_ext))) {
+        // read in background: it is opened as a file if libarchive cannot read it
+        show_archive(tab_entry(active, ps[active].curr_pos));
     } else {
-        manage_file(str_ptr[active][ps[active].curr_pos]);
+        manage_file(tab_entry(active, ps[active].curr_pos));
     }
 }
 
@@ -508,7 +620,7 @@ static void manage_enter_search(struct stat current_file_stat) {
 }
 
 static void manage_space(const char *str) {
-    if (ps[active].mode > fast_browse_) {
+    if (ps[active].mode > filter_ && ps[active].mode != archive_) {
         return;
     }
     
@@ -522,23 +634,61 @@ static void manage_space(const char *str) {
 }
 
 static void manage_quit(void) {
+    if (cancel_archive_job(active)) {
+        // an archive being read, or a member being extracted, is stopped first
+        return;
+    }
     if (ps[active].mode == search_) {
         leave_search_mode(ps[active].my_cwd);
-    } else if (ps[active].mode > fast_browse_) {
+    } else if (ps[active].mode == fuzzy_) {
+        leave_fuzzy_mode(ps[active].my_cwd);
+    } else if (ps[active].mode == archive_) {
+        leave_archive_mode(active);
+    } else if (ps[active].mode == du_) {
+        leave_du_mode(ps[active].my_cwd);
+    } else if (ps[active].mode > filter_) {
         leave_special_mode(ps[active].my_cwd, active);
+    } else if (ps[active].mode == filter_) {
+        leave_filter_mode(active);
     } else if (ps[active].mode == fast_browse_) {
         leave_special_mode(NULL, active);
         print_info("", INFO_LINE); // clear fast browse string from info line
-    } else {
+    } else if (!thread_h || check_running_jobs()) {
         quit = NORM_QUIT;
     }
 }
 
-static void switch_search(void) {
+/*
+ * Before leaving, user can choose to cancel queued jobs instead of waiting for them.
+ * Returns 0 if user does not want to leave anymore.
+ */
+static int check_running_jobs(void) {
+    char c;
+    
+    ask_user(_(cancel_jobs_quest), &c, 1);
+    if (c == 27) {
+        return 0;
+    }
+    if (c == _(yes)[0]) {
+        cancel_jobs();
+    }
+    return 1;
+}
+
+static void switch_search(void (*f)(void)) {
     if (sv.searching == NO_SEARCH) {
-        search();
+        f();
     } else if (sv.searching == SEARCHING) {
-        print_info(_(already_searching), INFO_LINE);
+        char c;
+        
+        ask_user(_(search_running_quest), &c, 1);
+        if (c == _(search_cancel)[0]) {
+            cancel_search();
+            print_info(_(search_cancelled), INFO_LINE);
+        } else if (c == _(search_restart)[0]) {
+            cancel_search();
+            sv.search_pred ? pred_search() : search();
+        }
     } else if (sv.searching == SEARCHED) {
         list_found();
     }
@@ -556,10 +706,29 @@ static void check_remove(void (*f)(void)) {
 static int check_init(int index) {
     char x;
 
-    if (!selected) {
+    if (!num_selected) {
         print_info(_(no_selected_files), ERR_LINE);
         return 0;
     }
+    // members listed while browsing an archive are not real files
+    if (index != EXTRACTOR_TH && selected_members()) {
+        print_info(_(arch_members_only), ERR_LINE);
+        return 0;
+    }
+    if (index == UPDATE_TH) {
+        struct stat sb;
+
+        if (stat(tab_entry(active, ps[active].curr_pos), &sb) == -1 || !S_ISREG(sb.st_mode) ||
+            !get_archive_ext(tab_entry(active, ps[active].curr_pos)) ||
+            !strcmp(get_archive_ext(tab_entry(active, ps[active].curr_pos)), DEDUP_EXT)) {
+            print_info(_(not_updatable), ERR_LINE);
+            return 0;
+        }
+    }
+    // archives are only read
+    if (index == TEST_TH || index == SIZE_TH) {
+        return 1;
+    }
     if (index == EXTRACTOR_TH && config.safe == FULL_SAFE) {
         ask_user(_(extr_question), &x, 1);
         if (x == _(no)[0] || x == 27) {
@@ -578,6 +747,23 @@ static int check_init(int index) {
     return 1;
 }
 
+static void check_archives(void) {
+    char c;
+    int index;
+    
+    ask_user(_(check_quest), &c, 1);
+    if (c == _(check_test)[0]) {
+        index = TEST_TH;
+    } else if (c == _(check_size)[0]) {
+        index = SIZE_TH;
+    } else {
+        return;
+    }
+    if (check_init(index)) {
+        init_thread(index, long_func[index]);
+    }
+}
+
 static int check_access(void) {
     if (access(ps[active].my_cwd, W_OK) == -1) {
         print_info(strerror(errno), ERR_LINE);
@@ -586,6 +772,13 @@ static int check_access(void) {
     return 1;
 }
 
+static struct stat current_stat(void) {
+    struct stat current_file_stat = {0};
+    
+    stat(tab_entry(active, ps[active].curr_pos), &current_file_stat);
+    return current_file_stat;
+}
+
 static void go_root_dir(void) {
     char root[PATH_MAX + 1] = {0};
         
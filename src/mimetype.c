@@ -0,0 +1,225 @@
+#include "../inc/mimetype.h"
+
+static struct magic_handle *get_handle(void);
+static void put_handle(struct magic_handle *h);
+static void cache_put(const char *key, const struct stat *sb, const char *mime);
+static void move_to_front(struct mime_entry *e);
+static void unlink_entry(struct mime_entry *e);
+static struct mime_entry *cache_get(const char *key, const struct stat *sb);
+
+/*
+ * Cached entries are chained from most (head) to least (tail) recently used:
+ * tail is the one replaced when cache is full.
+ * magic_broken avoids loading libmagic database again after it failed once.
+ */
+static struct strmap *cache;
+static struct mime_entry *head, *tail;
+static int num_entries;
+static atomic_int magic_broken;
+static struct magic_handle *handles;
+static pthread_mutex_t cache_lck = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t magic_lck = PTHREAD_MUTEX_INITIALIZER;
+
+int get_mimetype(const char *path, const char *test) {
+    char mime[MIME_LEN] = {0};
+    
+    return get_mimetype_str(path, mime, sizeof(mime)) == 0 && strstr(mime, test);
+}
+
+/*
+ * Writes path's mimetype in mime; only files not cached (or changed since) are probed.
+ * Returns -1 if path cannot be probed.
+ */
+int get_mimetype_str(const char *path, char *mime, size_t len) {
+    char key[48], probed[MIME_LEN] = {0};
+    struct magic_handle *h;
+    const char *m;
+    struct stat sb;
+    
+    if (lstat(path, &sb) == -1) {
+        return -1;
+    }
+    if (cached_mimetype(&sb, mime, len) == 0) {
+        return 0;
+    }
+    if (!(h = get_handle())) {
+        return -1;
+    }
+    // returned string belongs to the handle: it must be copied before giving it back
+    if ((m = magic_file(h->magic, path))) {
+        strncpy(probed, m, MIME_LEN - 1);
+    }
+    put_handle(h);
+    if (!m) {
+        ERROR("An error occurred while loading libmagic database.");
+        return -1;
+    }
+    snprintf(key, sizeof(key), "%lx:%lx", (unsigned long)sb.st_dev, (unsigned long)sb.st_ino);
+    cache_put(key, &sb, probed);
+    snprintf(mime, len, "%s", probed);
+    return 0;
+}
+
+/*
+ * Writes mimetype of file sb in mime if it is cached (and still valid), without probing it.
+ * Returns -1 otherwise.
+ */
+int cached_mimetype(const struct stat *sb, char *mime, size_t len) {
+    char key[48];
+    struct mime_entry *e;
+    
+    snprintf(key, sizeof(key), "%lx:%lx", (unsigned long)sb->st_dev, (unsigned long)sb->st_ino);
+    pthread_mutex_lock(&cache_lck);
+    if ((e = cache_get(key, sb))) {
+        move_to_front(e);
+        snprintf(mime, len, "%s", e->mime);
+    }
+    pthread_mutex_unlock(&cache_lck);
+    return e ? 0 : -1;
+}
+
+/*
+ * Takes a free handle, or loads a new one.
+ */
+static struct magic_handle *get_handle(void) {
+    struct magic_handle *h;
+    
+    pthread_mutex_lock(&magic_lck);
+    if ((h = handles)) {
+        handles = h->next;
+    }
+    pthread_mutex_unlock(&magic_lck);
+    if (h || magic_broken) {
+        return h;
+    }
+    if (!(h = malloc(sizeof(struct magic_handle)))) {
+        ERROR("could not malloc.");
+        return NULL;
+    }
+    if (!(h->magic = magic_open(MAGIC_MIME_TYPE)) || magic_load(h->magic, NULL) == -1) {
+        ERROR("An error occurred while loading libmagic database.");
+        if (h->magic) {
+            magic_close(h->magic);
+        }
+        free(h);
+        magic_broken = 1;
+        return NULL;
+    }
+    return h;
+}
+
+static void put_handle(struct magic_handle *h) {
+    pthread_mutex_lock(&magic_lck);
+    h->next = handles;
+    handles = h;
+    pthread_mutex_unlock(&magic_lck);
+}
+
+/*
+ * Adds (or updates) mimetype of file key; least recently used entry is replaced
+ * when cache is full. Without memory, mimetype is just not cached.
+ */
+static void cache_put(const char *key, const struct stat *sb, const char *mime) {
+    struct mime_entry *e;
+    
+    pthread_mutex_lock(&cache_lck);
+    if (!cache && !(cache = strmap_new(MIME_CACHE_SIZE))) {
+        goto end;
+    }
+    if (!(e = strmap_get(cache, key))) {
+        if (num_entries == MIME_CACHE_SIZE) {
+            e = tail;
+            unlink_entry(e);
+            strmap_del(cache, e->key);
+            num_entries--;
+        } else if (!(e = malloc(sizeof(struct mime_entry)))) {
+            goto end;
+        }
+        strncpy(e->key, key, sizeof(e->key) - 1);
+        e->key[sizeof(e->key) - 1] = '\0';
+        if (strmap_put(cache, e->key, e) == -1) {
+            free(e);
+            goto end;
+        }
+        e->prev = e->next = NULL;
+        num_entries++;
+    } else {
+        unlink_entry(e);
+    }
+    e->mtime = sb->st_mtim;
+    e->size = sb->st_size;
+    strncpy(e->mime, mime, MIME_LEN - 1);
+    e->mime[MIME_LEN - 1] = '\0';
+    e->next = head;
+    if (head) {
+        head->prev = e;
+    }
+    head = e;
+    if (!tail) {
+        tail = e;
+    }
+    
+end:
+    pthread_mutex_unlock(&cache_lck);
+}
+
+/*
+ * Returns entry of file key if it is still valid for sb. Called with cache_lck held.
+ */
+static struct mime_entry *cache_get(const char *key, const struct stat *sb) {
+    struct mime_entry *e;
+    
+    if (cache && (e = strmap_get(cache, key)) && e->size == sb->st_size &&
+        e->mtime.tv_sec == sb->st_mtim.tv_sec && e->mtime.tv_nsec == sb->st_mtim.tv_nsec) {
+        return e;
+    }
+    return NULL;
+}
+
+/*
+ * Called with cache_lck held.
+ */
+static void move_to_front(struct mime_entry *e) {
+    if (e == head) {
+        return;
+    }
+    unlink_entry(e);
+    e->next = head;
+    if (head) {
+        head->prev = e;
+    }
+    head = e;
+    if (!tail) {
+        tail = e;
+    }
+}
+
+static void unlink_entry(struct mime_entry *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+void free_mimetypes(void) {
+    struct magic_handle *h;
+    
+    while ((h = handles)) {
+        handles = h->next;
+        magic_close(h->magic);
+        free(h);
+    }
+    if (cache) {
+        strmap_free(cache, free);
+        cache = NULL;
+    }
+    head = tail = NULL;
+    num_entries = 0;
+}
@@ -0,0 +1,206 @@
+#include "../inc/predicate.h"
+
+static int compile_term(char *str, struct predicate *p);
+static int parse_unit(const char *str, const char *units, const int64_t *mult, int64_t def, int64_t *val, int64_t *unit);
+static int eval_term(const struct predicate *p, time_t now, const char *name, unsigned char d_type, const struct statx *stx);
+static int compare(int64_t a, char op, int64_t b);
+
+static const char *pred_keys[] = {"name", "size", "mtime", "type", "owner", "perm"};
+static const char *pred_ops[] = {"=", "<>=", "<>=", "=", "=", "=&"};
+static const unsigned int pred_masks[] = {0, STATX_SIZE, STATX_MTIME, STATX_TYPE, STATX_UID, STATX_MODE};
+
+/*
+ * Compiles a space separated list of "[!]key op value" terms, eg:
+ * "size>1G mtime<7d or name=*.iso".
+ * Terms are and'ed; "or" starts a new alternative.
+ * Returns -1 on a malformed expression.
+ */
+int compile_predicates(const char *str, struct pred_expr *e) {
+    char buf[PATH_MAX + 1] = {0};
+    char *tok, *saveptr;
+
+    memset(e, 0, sizeof(struct pred_expr));
+    strncpy(buf, str, PATH_MAX);
+    e->now = time(NULL);
+    for (tok = strtok_r(buf, " ", &saveptr); tok; tok = strtok_r(NULL, " ", &saveptr)) {
+        if (!strcmp(tok, "or")) {
+            // an alternative cannot be empty
+            if (!e->num_preds || e->preds[e->num_preds - 1].alt != e->num_alts) {
+                return -1;
+            }
+            e->num_alts++;
+            continue;
+        }
+        if (e->num_preds == MAX_PREDICATES || compile_term(tok, &e->preds[e->num_preds]) == -1) {
+            return -1;
+        }
+        e->preds[e->num_preds].alt = e->num_alts;
+        e->mask |= pred_masks[e->preds[e->num_preds].key];
+        e->num_preds++;
+    }
+    if (!e->num_preds || e->preds[e->num_preds - 1].alt != e->num_alts) {
+        return -1;
+    }
+    e->num_alts++;
+    return 0;
+}
+
+static int compile_term(char *str, struct predicate *p) {
+    const int64_t size_mult[] = {1, 1024, 1024 * 1024, 1024 * 1024 * 1024, 1024LL * 1024 * 1024 * 1024};
+    const int64_t time_mult[] = {1, 60, 60 * 60, 24 * 60 * 60, 7 * 24 * 60 * 60};
+    const char types[] = "fdlbcps";
+    const int64_t type_modes[] = {S_IFREG, S_IFDIR, S_IFLNK, S_IFBLK, S_IFCHR, S_IFIFO, S_IFSOCK};
+    char *op, *value, *end;
+    int i;
+
+    memset(p, 0, sizeof(struct predicate));
+    if (*str == '!') {
+        p->negate = 1;
+        str++;
+    }
+    if (!(op = strpbrk(str, "<>=&")) || !*(op + 1)) {
+        return -1;
+    }
+    value = op + 1;
+    p->op = *op;
+    *op = '\0';
+    for (i = 0; i < NUM(pred_keys) && strcmp(str, pred_keys[i]); i++);
+    if (i == NUM(pred_keys) || !strchr(pred_ops[i], p->op)) {
+        return -1;
+    }
+    p->key = i;
+    switch (p->key) {
+    case PRED_NAME:
+        strncpy(p->glob, value, NAME_MAX);
+        return 0;
+    case PRED_SIZE:
+        return parse_unit(value, "bkmgt", size_mult, 1, &p->value, &p->unit);
+    case PRED_MTIME:
+        // mtime is compared as file's age: "mtime<7d" means modified in last 7 days
+        return parse_unit(value, "smhdw", time_mult, time_mult[3], &p->value, &p->unit);
+    case PRED_TYPE:
+        if (strlen(value) != 1 || !strchr(types, *value)) {
+            return -1;
+        }
+        p->value = type_modes[strchr(types, *value) - types];
+        return 0;
+    case PRED_OWNER:
+        p->value = strtoll(value, &end, 10);
+        if (*end) {
+            struct passwd *pw = getpwnam(value);
+
+            if (!pw) {
+                return -1;
+            }
+            p->value = pw->pw_uid;
+        }
+        return 0;
+    case PRED_PERM:
+        p->value = strtoll(value, &end, 8);
+        return (*end || p->value & ~07777) ? -1 : 0;
+    }
+    return -1;
+}
+
+/*
+ * Parses a number followed by an optional (case insensitive) unit char.
+ */
+static int parse_unit(const char *str, const char *units, const int64_t *mult, int64_t def, int64_t *val, int64_t *unit) {
+    char *end;
+    const char *u;
+
+    *val = strtoll(str, &end, 10);
+    if (end == str || *val < 0) {
+        return -1;
+    }
+    *unit = def;
+    if (*end) {
+        if (*(end + 1) || !(u = strchr(units, tolower(*end)))) {
+            return -1;
+        }
+        *unit = mult[u - units];
+    }
+    return 0;
+}
+
+/*
+ * Returns 1 if name matches the expression, 0 if it does not.
+ * stx may be NULL: then, if the result depends on metadata (and d_type is not enough),
+ * -1 is returned, and caller should statx the file with e->mask and evaluate it again.
+ */
+int eval_predicates(const struct pred_expr *e, const char *name, unsigned char d_type, const struct statx *stx) {
+    int ret = 0;
+
+    for (int alt = 0, i = 0; alt < e->num_alts; alt++) {
+        int res = 1;
+
+        for (; i < e->num_preds && e->preds[i].alt == alt; i++) {
+            if (res) {
+                int r = eval_term(&e->preds[i], e->now, name, d_type, stx);
+
+                if (r == 0 || (r == -1 && res == 1)) {
+                    res = r;
+                }
+            }
+        }
+        if (res == 1) {
+            return 1;
+        }
+        if (res == -1) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+static int eval_term(const struct predicate *p, time_t now, const char *name, unsigned char d_type, const struct statx *stx) {
+    int r;
+
+    if (p->key == PRED_NAME) {
+        r = !fnmatch(p->glob, name, 0);
+    } else if (p->key == PRED_TYPE && !stx) {
+        if (d_type == DT_UNKNOWN) {
+            return -1;
+        }
+        r = DTTOIF(d_type) == p->value;
+    } else if (!stx) {
+        return -1;
+    } else {
+        switch (p->key) {
+        case PRED_SIZE:
+            r = compare(stx->stx_size, p->op, p->value * p->unit);
+            break;
+        case PRED_MTIME:
+            if (p->op == '=') {
+                r = (now - stx->stx_mtime.tv_sec) / p->unit == p->value;
+            } else {
+                r = compare(now - stx->stx_mtime.tv_sec, p->op, p->value * p->unit);
+            }
+            break;
+        case PRED_TYPE:
+            r = (stx->stx_mode & S_IFMT) == p->value;
+            break;
+        case PRED_OWNER:
+            r = stx->stx_uid == p->value;
+            break;
+        case PRED_PERM:
+            r = p->op == '=' ? (stx->stx_mode & 07777) == p->value : !!(stx->stx_mode & p->value);
+            break;
+        default:
+            r = 0;
+            break;
+        }
+    }
+    return p->negate ? !r : r;
+}
+
+static int compare(int64_t a, char op, int64_t b) {
+    switch (op) {
+    case '<':
+        return a < b;
+    case '>':
+        return a > b;
+    default:
+        return a == b;
+    }
+}
@@ -0,0 +1,332 @@
+#include "../inc/preview.h"
+
+static void preview_job(void *x);
+static int preview_text(const char *path, const struct stat *sb, struct byte_buf *b, const atomic_int *cancel);
+static int preview_dir(const char *path, struct byte_buf *b, const atomic_int *cancel);
+static int preview_archive(const char *path, struct byte_buf *b, const atomic_int *cancel);
+static int add_line(struct byte_buf *b, const char *fmt, ...);
+static int cmp_names(const void *a, const void *b);
+static struct preview *find_preview(const char *path);
+static void store_preview(const char *path, const struct stat *sb, char *text);
+
+/*
+ * Previews are produced by a single background thread, so that moving the cursor
+ * never waits for a file to be read; preview_fd is written every time one is ready.
+ * last_job is the last asked preview until it ends: it is cancelled as soon as
+ * a newer one is asked, and its path is not queued again while it is produced.
+ * lck protects cache and last_job.
+ */
+static struct preview cache[PREVIEW_CACHE_SIZE];
+static unsigned long used;
+static struct thpool *pool;
+static struct preview_job *last_job;
+static pthread_mutex_t lck = PTHREAD_MUTEX_INITIALIZER;
+static int preview_fd = -1;
+
+/*
+ * Returns the fd polled by main loop to know that a preview is ready.
+ */
+int preview_init(void) {
+    preview_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return preview_fd;
+}
+
+/*
+ * Returns a copy of path's preview, to be freed, if it is cached, otherwise NULL.
+ * Path is stat'd only by background thread (asked here, cancelling any other job), that
+ * produces it again, and notifies, only if it is missing or file changed since it was cached.
+ */
+char *get_preview(const char *path) {
+    struct preview_job *job;
+    struct preview *p;
+    char *text = NULL;
+    
+    pthread_mutex_lock(&lck);
+    if ((p = find_preview(path))) {
+        p->used = ++used;
+        if (!(text = strdup(p->text))) {
+            ERROR("could not malloc.");
+        }
+    }
+    if (preview_fd != -1 && (!last_job || strcmp(last_job->path, path)) && (pool || (pool = thpool_new(1))) &&
+               (job = malloc(sizeof(struct preview_job)))) {
+        strncpy(job->path, path, PATH_MAX);
+        job->path[PATH_MAX] = '\0';
+        atomic_init(&job->cancel, 0);
+        if (thpool_add(pool, preview_job, job) == -1) {
+            free(job);
+        } else {
+            if (last_job) {
+                atomic_store(&last_job->cancel, 1);
+            }
+            last_job = job;
+        }
+    }
+    pthread_mutex_unlock(&lck);
+    return text;
+}
+
+/*
+ * Cancels current job, waits for background thread, then frees every cached preview.
+ */
+void free_previews(void) {
+    pthread_mutex_lock(&lck);
+    if (last_job) {
+        atomic_store(&last_job->cancel, 1);
+    }
+    pthread_mutex_unlock(&lck);
+    if (pool) {
+        thpool_free(pool);
+        pool = NULL;
+    }
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++) {
+        free(cache[i].path);
+        free(cache[i].text);
+    }
+    memset(cache, 0, sizeof(cache));
+    if (preview_fd != -1) {
+        close(preview_fd);
+    }
+}
+
+/*
+ * A job already cancelled does not even stat its file.
+ * A cached preview whose file did not change is left as it is.
+ * Cancelled or failed previews are not cached, nor notified: a failed one
+ * will be asked again once cursor comes back on its file.
+ * A file that cannot be stat'd gets its error as preview (with zeroed mtime and size).
+ */
+static void preview_job(void *x) {
+    struct preview_job *job = (struct preview_job *)x;
+    struct byte_buf b = {0};
+    struct preview *p;
+    struct stat sb;
+    int ret = -1, fresh, err;
+    
+    if (atomic_load(&job->cancel)) {
+        goto end;
+    }
+    if ((err = stat(job->path, &sb) == -1 ? errno : 0)) {
+        memset(&sb, 0, sizeof(sb));
+    }
+    pthread_mutex_lock(&lck);
+    fresh = (p = find_preview(job->path)) && p->size == sb.st_size &&
+            p->mtime.tv_sec == sb.st_mtim.tv_sec && p->mtime.tv_nsec == sb.st_mtim.tv_nsec;
+    pthread_mutex_unlock(&lck);
+    if (fresh || atomic_load(&job->cancel)) {
+        goto end;
+    }
+    if (err) {
+        ret = add_line(&b, "%s", strerror(err));
+    } else if (S_ISDIR(sb.st_mode)) {
+        ret = preview_dir(job->path, &b, &job->cancel);
+    } else if (S_ISREG(sb.st_mode) && is_ext(job->path, arch_ext, NUM(arch_ext))) {
+        ret = preview_archive(job->path, &b, &job->cancel);
+    } else if (S_ISREG(sb.st_mode)) {
+        ret = preview_text(job->path, &sb, &b, &job->cancel);
+    } else {
+        ret = 0;
+    }
+end:
+    pthread_mutex_lock(&lck);
+    if (ret == 0 && !atomic_load(&job->cancel) && buf_add(&b, "", 1) == 0) {
+        store_preview(job->path, &sb, (char *)b.data);
+        b.data = NULL;
+        eventfd_write(preview_fd, 1);
+    }
+    if (last_job == job) {
+        last_job = NULL;
+    }
+    pthread_mutex_unlock(&lck);
+    free(b.data);
+    free(job);
+}
+
+/*
+ * Only first PREVIEW_BYTES of file are read. Tabs are expanded and control chars
+ * are replaced, so that each line is printed as it is;
+ * a file with NUL bytes is described by its mimetype and size instead.
+ */
+static int preview_text(const char *path, const struct stat *sb, struct byte_buf *b, const atomic_int *cancel) {
+    char buf[PREVIEW_BYTES], mime[MIME_LEN] = {0}, size[20];
+    int fd, lines = 0;
+    ssize_t n;
+    
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return add_line(b, "%s", strerror(errno));
+    }
+    while ((n = pread(fd, buf, sizeof(buf), 0)) == -1 && errno == EINTR);
+    close(fd);
+    if (n == -1) {
+        return add_line(b, "%s", strerror(errno));
+    }
+    if (memchr(buf, '\0', n)) {
+        get_mimetype_str(path, mime, sizeof(mime));
+        change_unit(sb->st_size, size);
+        return add_line(b, "%s, %s", strlen(mime) ? mime : "binary", size);
+    }
+    for (ssize_t i = 0; i < n && lines < PREVIEW_LINES && !atomic_load(cancel); i++) {
+        if (buf[i] == '\t') {
+            if (buf_add(b, "        ", PREVIEW_TAB_LEN) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        if (buf[i] == '\n') {
+            lines++;
+        } else if (iscntrl((unsigned char)buf[i])) {
+            buf[i] = '.';
+        }
+        if (buf_add(b, buf + i, 1) == -1) {
+            return -1;
+        }
+    }
+    return atomic_load(cancel) ? -1 : 0;
+}
+
+/*
+ * Summary of dir (how many dirs and files it holds), then its entries sorted by name.
+ */
+static int preview_dir(const char *path, struct byte_buf *b, const atomic_int *cancel) {
+    struct byte_buf names = {0};
+    const char **sorted = NULL;
+    struct dirent *de;
+    struct stat sb;
+    int num = 0, dirs = 0, ret = 0;
+    size_t off;
+    DIR *d;
+    
+    if (!(d = opendir(path))) {
+        return add_line(b, "%s", strerror(errno));
+    }
+    while ((de = readdir(d)) && !atomic_load(cancel)) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        int is_dir = de->d_type == DT_DIR || (de->d_type == DT_UNKNOWN &&
+                     fstatat(dirfd(d), de->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(sb.st_mode));
+        
+        // dir names end with a '/', to be told apart
+        if (buf_add(&names, de->d_name, strlen(de->d_name)) == -1 ||
+            buf_add(&names, is_dir ? "/" : "", is_dir + 1) == -1) {
+            ret = -1;
+            break;
+        }
+        dirs += is_dir;
+        num++;
+    }
+    closedir(d);
+    if (ret == -1 || atomic_load(cancel) || (num && !(sorted = malloc(num * sizeof(char *))))) {
+        free(names.data);
+        return -1;
+    }
+    off = 0;
+    for (int i = 0; i < num; i++) {
+        sorted[i] = (char *)names.data + off;
+        off += strlen(sorted[i]) + 1;
+    }
+    qsort(sorted, num, sizeof(char *), cmp_names);
+    ret = add_line(b, _(preview_dir_str), dirs, num - dirs);
+    for (int i = 0; i < num && i < PREVIEW_LINES && ret == 0; i++) {
+        ret = add_line(b, "%s", sorted[i]);
+    }
+    if (num > PREVIEW_LINES && ret == 0) {
+        ret = add_line(b, "...");
+    }
+    free(sorted);
+    free(names.data);
+    return ret;
+}
+
+/*
+ * Members of archive, with their size, from its index (see arch_index_get()):
+ * it is shared with archive browsing, and building it stops as soon as job is cancelled.
+ */
+static int preview_archive(const char *path, struct byte_buf *b, const atomic_int *cancel) {
+    struct arch_index *idx;
+    char size[20];
+    int ret = 0;
+    
+    if (!(idx = arch_index_get(path, 0, cancel))) {
+        return atomic_load(cancel) ? -1 : add_line(b, "%s", _(generic_error));
+    }
+    for (int i = 0; i < idx->num_entries && i < PREVIEW_LINES && ret == 0; i++) {
+        change_unit(idx->entries[i].size, size);
+        ret = add_line(b, "%s  %s", idx->entries[i].name, size);
+    }
+    if (idx->num_entries > PREVIEW_LINES && ret == 0) {
+        ret = add_line(b, "...");
+    }
+    arch_index_put(idx);
+    return atomic_load(cancel) ? -1 : ret;
+}
+
+/*
+ * Appends a formatted line to b. Returns -1 without memory.
+ */
+static int add_line(struct byte_buf *b, const char *fmt, ...) {
+    char line[PATH_MAX + 64];
+    va_list args;
+    int len;
+    
+    va_start(args, fmt);
+    len = vsnprintf(line, sizeof(line) - 1, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return 0;
+    }
+    if (len > (int)sizeof(line) - 2) {
+        len = sizeof(line) - 2;
+    }
+    line[len++] = '\n';
+    return buf_add(b, line, len);
+}
+
+static int cmp_names(const void *a, const void *b) {
+    return strcoll(*(const char **)a, *(const char **)b);
+}
+
+/*
+ * Called with lck held.
+ */
+static struct preview *find_preview(const char *path) {
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++) {
+        if (cache[i].path && !strcmp(cache[i].path, path)) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Caches text as preview of path (taking it), replacing an older preview of the same path,
+ * or the least recently used one. Called with lck held.
+ */
+static void store_preview(const char *path, const struct stat *sb, char *text) {
+    struct preview *p = &cache[0];
+    char *dup;
+    
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++) {
+        if (cache[i].path && !strcmp(cache[i].path, path)) {
+            p = &cache[i];
+            break;
+        }
+        if (cache[i].used < p->used) {
+            p = &cache[i];
+        }
+    }
+    if (p->path && !strcmp(p->path, path)) {
+        dup = p->path;
+    } else if (!(dup = strdup(path))) {
+        free(text);
+        return;
+    } else {
+        free(p->path);
+    }
+    free(p->text);
+    p->path = dup;
+    p->text = text;
+    p->mtime = sb->st_mtim;
+    p->size = sb->st_size;
+    p->used = ++used;
+}
@@ -28,11 +28,27 @@ int program_quit(void) {
 }
 
 static void free_everything(void) {
+    latency_dump();
     free_device_monitor();
     free_timer();
     free(main_p);
     free_selected();
     free_bookmarks();
+    for (int i = 0; i < cont; i++) {
+        if (ps[i].mode == archive_) {
+            free_archive_browse(i);
+        } else if (ps[i].mode == du_) {
+            free_du_analyzer();
+        }
+    }
+    remove_archive_tmp();
+    free_arch_index_cache();
+    du_free();
+    free_filetypes();
+    free_previews();
+    free_fuzzy_finder();
+    free_dircache();
+    free_mimetypes();
 }
 
 static void quit_thread_func(void) {
@@ -43,6 +59,10 @@ static void quit_thread_func(void) {
 
 static void quit_worker_th(void) {
     if ((worker_th) && (pthread_kill(worker_th, 0) != ESRCH)) {
+        // do not wait for jobs when leaving because of an error
+        if (quit != NORM_QUIT) {
+            cancel_jobs();
+        }
         INFO(quit_with_running_thread);
         printf("%s\n", quit_with_running_thread);
         pthread_join(worker_th, NULL);
@@ -1,10 +1,65 @@
 #include "../inc/search.h"
 
 static int recursive_search(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf);
-static int search_inside_archive(const char *path);
+static int match_name(const char *name);
+static int add_found(const char *path, const char *member);
+static void search_inside_archive(const char *path);
+static void search_archive_job(void *path);
+static void update_progress(void);
+static void report_progress(void);
+static void start_search(void);
+static void walk_predicates(const char *root);
+static void queue_dir(const char *path, int depth);
+static void walk_dir_job(void *x);
+static void sort_found(int idx);
+static int found_name_cmp(const void *a, const void *b);
+static int found_size_cmp(const void *a, const void *b);
+static int found_mtime_cmp(const void *a, const void *b);
 static void *search_thread(void *x);
+static void join_search_th(void);
+
+/*
+ * Directory to be read by predicate search walker.
+ */
+struct walk_job {
+    int depth;
+    char path[];
+};
+
+/*
+ * Metadata of a found file, used to sort results.
+ */
+struct found_meta {
+    const char *name;
+    off_t size;
+    time_t mtime;
+};
+
+static struct thpool *pool;
+static pthread_mutex_t found_lck = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Search progress counters: written by search thread and archive pool,
+ * read by main thread (through get_search_progress()) while refreshing SEARCH_LINE.
+ */
+static atomic_int cancelled, curr_depth;
+static atomic_ulong dirs_scanned, entries_scanned, dirs_rate, entries_rate;
+static struct timespec last_report;
+static unsigned long last_dirs, last_entries, walked;
+
+/*
+ * Predicate search state: compiled expression, filesystem walk is bound to,
+ * and whether hidden files have to be checked.
+ */
+static struct pred_expr pred;
+static dev_t root_dev;
+static int walk_hidden;
+
+static int (*const found_cmp[])(const void *, const void *) = {found_name_cmp, found_size_cmp, found_mtime_cmp};
 
 void search(void) {
+    // previous search thread may have ended without being joined yet
+    join_search_th();
     ask_user(_(search_insert_name), sv.searched_string, 20);
     if (strlen(sv.searched_string) < 5 || sv.searched_string[0] == 27) {
         if (strlen(sv.searched_string) > 0 && sv.searched_string[0] != 27) {
@@ -16,6 +71,7 @@ void search(void) {
         sv.found_cont = 0;
         sv.search_archive = 0;
         sv.search_lazy = 0;
+        sv.search_pred = 0;
         ask_user(_(search_archives), &c, 1);
         if (c == 27) {
             return;
@@ -37,15 +93,50 @@ void search(void) {
                 sv.search_lazy = 1;
             }
         }
-        sv.searching = SEARCHING;
-        print_info("", SEARCH_LINE);
-        pthread_create(&search_th, NULL, search_thread, NULL);
+        start_search();
     }
 }
 
+/*
+ * Asks user for an expression of predicates on files' metadata
+ * (see compile_predicates()), then searches current dir tree for matching files.
+ */
+void pred_search(void) {
+    join_search_th();
+    ask_user(_(pred_search_insert), sv.searched_string, sizeof(sv.searched_string) - 1);
+    if (!strlen(sv.searched_string) || sv.searched_string[0] == 27) {
+        return;
+    }
+    if (compile_predicates(sv.searched_string, &pred) == -1) {
+        print_info(_(pred_wrong_expr), ERR_LINE);
+        return;
+    }
+    sv.found_cont = 0;
+    sv.search_archive = 0;
+    sv.search_lazy = 0;
+    sv.search_pred = 1;
+    walk_hidden = ps[active].show_hidden;
+    start_search();
+}
+
+static void start_search(void) {
+    atomic_store(&cancelled, 0);
+    atomic_store(&curr_depth, 0);
+    atomic_store(&dirs_scanned, 0);
+    atomic_store(&entries_scanned, 0);
+    atomic_store(&dirs_rate, 0);
+    atomic_store(&entries_rate, 0);
+    last_dirs = last_entries = walked = 0;
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+    sv.found_sort = 0;
+    sv.searching = SEARCHING;
+    print_info("", SEARCH_LINE);
+    pthread_create(&search_th, NULL, search_thread, NULL);
+}
+
 static int recursive_search(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
     char *fixed_str;
-    int len, r = 0, ret = FTW_CONTINUE;
+    int ret = FTW_CONTINUE;
     /*
      * if searching "pippo" from "/home/pippo",
      * avoid saving "/home/pippo" as a result.
@@ -53,6 +144,15 @@ static int recursive_search(const char *path, const struct stat *sb, int typefla
     if (ftwbuf->level == 0) {
         return ret;
     }
+    if (atomic_load(&cancelled)) {
+        return FTW_STOP;
+    }
+    if (typeflag == FTW_D || typeflag == FTW_DNR) {
+        atomic_fetch_add(&dirs_scanned, 1);
+    }
+    atomic_fetch_add(&entries_scanned, 1);
+    atomic_store(&curr_depth, ftwbuf->level);
+    update_progress();
     fixed_str = strrchr(path, '/') + 1;
     /*
      * if lazy: avoid checking hidden files and
@@ -62,67 +162,262 @@ static int recursive_search(const char *path, const struct stat *sb, int typefla
         return FTW_SKIP_SUBTREE;
     }
     if ((sv.search_archive) && (is_ext(fixed_str, arch_ext, NUM(arch_ext)))) {
-        return search_inside_archive(path);
+        search_inside_archive(path);
+    } else if (match_name(fixed_str) && add_found(path, NULL)) {
+        ret = FTW_STOP;
     }
-    len = strlen(sv.searched_string);
+    return (quit || sv.found_cont == MAX_NUMBER_OF_FOUND) ? FTW_STOP : ret;
+}
+
+static int match_name(const char *name) {
     if (!sv.search_lazy) {
-        r = !strncmp(fixed_str, sv.searched_string, len);
-    } else if (strcasestr(fixed_str, sv.searched_string)) {
-        r = 1;
+        return !strncmp(name, sv.searched_string, strlen(sv.searched_string));
     }
-    if (r) {
-        strncpy(sv.found_searched[sv.found_cont], path, PATH_MAX);
+    return strcasestr(name, sv.searched_string) != NULL;
+}
+
+/*
+ * Adds path (or path/member for archives members) to found files.
+ * Returns 1 when MAX_NUMBER_OF_FOUND has been reached.
+ */
+static int add_found(const char *path, const char *member) {
+    int full;
+    
+    pthread_mutex_lock(&found_lck);
+    if (sv.found_cont < MAX_NUMBER_OF_FOUND) {
+        if (member) {
+            snprintf(sv.found_searched[sv.found_cont], PATH_MAX, "%s/%s", path, member);
+        } else {
+            strncpy(sv.found_searched[sv.found_cont], path, PATH_MAX);
+        }
         sv.found_cont++;
-        if (sv.found_cont == MAX_NUMBER_OF_FOUND) {
-            ret = FTW_STOP;
+    }
+    full = sv.found_cont == MAX_NUMBER_OF_FOUND;
+    pthread_mutex_unlock(&found_lck);
+    return full;
+}
+
+/*
+ * Archives are scanned by the search pool, so that nftw can go on walking the tree
+ * while archives are being decompressed.
+ * If the pool could not be created, archive is scanned by search thread itself.
+ */
+static void search_inside_archive(const char *path) {
+    char *arg = strdup(path);
+    
+    if (!arg) {
+        return;
+    }
+    if (!pool || thpool_add(pool, search_archive_job, arg) == -1) {
+        search_archive_job(arg);
+    }
+}
+
+/*
+ * For each entry in the archive index (cached by path, size and mtime, so that
+ * repeated searches only read headers once), checks entry name against searched string.
+ * Nested archives' entries are listed as "inner.tar/member" up to config.archive_search_depth.
+ */
+static void search_archive_job(void *path) {
+    struct arch_index *idx;
+    char name[PATH_MAX + 1] = {0};
+    
+    if (!atomic_load(&cancelled) && sv.found_cont < MAX_NUMBER_OF_FOUND && 
+        (idx = arch_index_get(path, config.archive_search_depth, &cancelled))) {
+        atomic_fetch_add(&entries_scanned, idx->num_entries);
+        for (int i = 0; i < idx->num_entries && !quit && !atomic_load(&cancelled); i++) {
+            // match against member's name, without its leading path and its trailing '/' if it is a dir
+            strncpy(name, idx->entries[i].name, PATH_MAX);
+            int len = strlen(name);
+            if (len > 1 && name[len - 1] == '/') {
+                name[len - 1] = '\0';
+            }
+            char *ptr = strrchr(name, '/');
+            if (match_name(ptr ? ptr + 1 : name) && add_found(path, idx->entries[i].name)) {
+                break;
+            }
         }
+        arch_index_put(idx);
     }
-    return quit ? FTW_STOP : ret;
+    free(path);
 }
 
 /*
- * For each entry in the archive, it checks "entry + len" pointer against searched string.
- * Len is always the offset of the current dir inside archive, eg: foo.tgz/bar/x,
- * while checking x, len will be strlen("bar/")
+ * Predicate search walker: every directory is read by a pool job, that queues
+ * its subdirs. Files are only statx'ed when the expression cannot be evaluated
+ * by their name and d_type, asking only for the fields it needs.
+ * Search thread meanwhile refreshes progress counters.
  */
-static int search_inside_archive(const char *path) {
-    int ret = FTW_CONTINUE, string_length;
-    struct archive_entry *entry;
-    struct archive *a = archive_read_new();
+static void walk_predicates(const char *root) {
+    struct stat sb;
+    
+    if (stat(root, &sb) == -1) {
+        return;
+    }
+    root_dev = sb.st_dev;
+    queue_dir(root, 0);
+    if (pool) {
+        while (!thpool_timedwait(pool, SEARCH_PROGRESS_MS)) {
+            report_progress();
+        }
+    }
+}
+
+/*
+ * If the pool could not be created (or job could not be queued),
+ * dir is read straight away.
+ */
+static void queue_dir(const char *path, int depth) {
+    struct walk_job *job = malloc(sizeof(struct walk_job) + strlen(path) + 1);
+    
+    if (!job) {
+        return;
+    }
+    job->depth = depth;
+    strcpy(job->path, path);
+    if (!pool || thpool_add(pool, walk_dir_job, job) == -1) {
+        walk_dir_job(job);
+    }
+}
 
-    archive_read_support_filter_all(a);
-    archive_read_support_format_all(a);
-    string_length = strlen(sv.searched_string);
-    if ((a) && (archive_read_open_filename(a, path, BUFF_SIZE) == ARCHIVE_OK)) {
-        while ((!quit) && (ret == FTW_CONTINUE) && (archive_read_next_header(a, &entry) == ARCHIVE_OK)) {
-            int len = 0, r = 0;
-            
-            if (!sv.search_lazy) {
-                r = !strncmp(archive_entry_pathname(entry) + len, sv.searched_string, string_length);
-            } else if (strcasestr(archive_entry_pathname(entry) + len, sv.searched_string)) {
-                r = 1;
+static void walk_dir_job(void *x) {
+    struct walk_job *job = (struct walk_job *)x;
+    char path[PATH_MAX + 1] = {0};
+    struct dirent *de;
+    struct stat sb;
+    DIR *d;
+    int fd;
+    // avoid a double slash when walking from "/"
+    const char *parent = strcmp(job->path, "/") ? job->path : "";
+    
+    if (quit || atomic_load(&cancelled) || sv.found_cont == MAX_NUMBER_OF_FOUND) {
+        goto end;
+    }
+    if ((fd = open(job->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        goto end;
+    }
+    // as FTW_MOUNT: do not walk other filesystems
+    if (fstat(fd, &sb) == -1 || sb.st_dev != root_dev || !(d = fdopendir(fd))) {
+        close(fd);
+        goto end;
+    }
+    atomic_fetch_add(&dirs_scanned, 1);
+    atomic_store(&curr_depth, job->depth);
+    while ((de = readdir(d)) && !quit && !atomic_load(&cancelled)) {
+        struct statx stx;
+        unsigned char type = de->d_type;
+        int ret;
+        
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") || (!walk_hidden && de->d_name[0] == '.')) {
+            continue;
+        }
+        atomic_fetch_add(&entries_scanned, 1);
+        ret = eval_predicates(&pred, de->d_name, type, NULL);
+        if (ret == -1 || type == DT_UNKNOWN) {
+            if (statx(dirfd(d), de->d_name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, 
+                      pred.mask | STATX_TYPE, &stx) == -1) {
+                continue;
+            }
+            type = IFTODT(stx.stx_mode);
+            if (ret == -1) {
+                ret = eval_predicates(&pred, de->d_name, type, &stx);
             }
-            if (r) {
-                snprintf(sv.found_searched[sv.found_cont], PATH_MAX, "%s/%s", path, archive_entry_pathname(entry));
-                sv.found_cont++;
-                if (sv.found_cont == MAX_NUMBER_OF_FOUND) {
-                    ret = FTW_STOP;
-                }
+        }
+        if (ret == 1 || type == DT_DIR) {
+            snprintf(path, PATH_MAX, "%s/%s", parent, de->d_name);
+            if (ret == 1 && add_found(path, NULL)) {
+                break;
             }
-            char *ptr = strrchr(archive_entry_pathname(entry), '/');
-            if ((ptr) && (strlen(ptr) == 1)) {
-                len = strlen(archive_entry_pathname(entry));
+            if (type == DT_DIR) {
+                queue_dir(path, job->depth + 1);
             }
         }
     }
-    archive_read_free(a);
-    return quit ? FTW_STOP : ret;
+    closedir(d);
+    
+end:
+    free(job);
+}
+
+/*
+ * Called by search thread for each walked entry: at most once every SEARCH_PROGRESS_MS,
+ * computes scan rates and asks main thread to refresh SEARCH_LINE sticky message.
+ * Clock is only checked every 64 entries to keep the walk cheap.
+ */
+static void update_progress(void) {
+    if (++walked % 64) {
+        return;
+    }
+    report_progress();
+}
+
+static void report_progress(void) {
+    struct timespec now;
+    unsigned long dirs, entries;
+    long elapsed;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - last_report.tv_sec) * 1000 + (now.tv_nsec - last_report.tv_nsec) / 1000000;
+    if (elapsed < SEARCH_PROGRESS_MS) {
+        return;
+    }
+    dirs = atomic_load(&dirs_scanned);
+    entries = atomic_load(&entries_scanned);
+    atomic_store(&dirs_rate, (dirs - last_dirs) * 1000 / elapsed);
+    atomic_store(&entries_rate, (entries - last_entries) * 1000 / elapsed);
+    last_dirs = dirs;
+    last_entries = entries;
+    last_report = now;
+    print_info(NULL, SEARCH_LINE);
+}
+
+/*
+ * Fills str with current search counters.
+ */
+void get_search_progress(char *str, size_t len) {
+    snprintf(str, len, "%s %lu dirs (%lu/s), %lu entries (%lu/s), depth %d", _(searching_mess[0]),
+             atomic_load(&dirs_scanned), atomic_load(&dirs_rate),
+             atomic_load(&entries_scanned), atomic_load(&entries_rate),
+             atomic_load(&curr_depth));
+}
+
+/*
+ * Stops a running search: walker and archive pool check cancelled flag
+ * for each entry, so search thread can be joined straight away.
+ */
+void cancel_search(void) {
+    atomic_store(&cancelled, 1);
+    join_search_th();
+    sv.searching = NO_SEARCH;
+    sv.found_cont = 0;
+    print_info("", SEARCH_LINE);
+}
+
+static void join_search_th(void) {
+    if (search_th) {
+        pthread_join(search_th, NULL);
+        search_th = 0;
+    }
 }
 
 static void *search_thread(void *x) {
     INFO("starting recursive search...");
-    nftw(ps[active].my_cwd, recursive_search, 64, FTW_MOUNT | FTW_PHYS | FTW_ACTIONRETVAL);
-    if (!quit) {
+    if (sv.search_archive || sv.search_pred) {
+        pool = thpool_new(0);
+    }
+    if (sv.search_pred) {
+        walk_predicates(ps[active].my_cwd);
+    } else {
+        nftw(ps[active].my_cwd, recursive_search, 64, FTW_MOUNT | FTW_PHYS | FTW_ACTIONRETVAL);
+    }
+    if (pool) {
+        // wait for every archive to be scanned
+        thpool_free(pool);
+        pool = NULL;
+    }
+    if (atomic_load(&cancelled)) {
+        INFO("search cancelled.");
+    } else if (!quit) {
         char str[100];
         
         INFO("ended recursive search");
@@ -136,6 +431,8 @@ static void *search_thread(void *x) {
                 print_info(_(no_found), INFO_LINE);
             }
         } else {
+            // parallel walkers find files in no particular order
+            sort_found(0);
             sv.searching = SEARCHED;
             snprintf(str, 100, "Search finished, %d files found.", sv.found_cont);
         }
@@ -144,14 +441,76 @@ static void *search_thread(void *x) {
         send_notification(str);
 #endif
     }
-    pthread_detach(pthread_self());
     pthread_exit(NULL);
 }
 
+/*
+ * Sorts found files by name, size (biggest first) or last modified (newest first).
+ * Files inside archives cannot be stat'ed: they are considered empty and never modified.
+ */
+static void sort_found(int idx) {
+    struct found_meta *meta;
+    char (*tmp)[PATH_MAX + 1];
+    struct stat sb;
+    
+    if (!(meta = malloc(sv.found_cont * sizeof(struct found_meta)))) {
+        return;
+    }
+    if (!(tmp = malloc(sv.found_cont * sizeof(sv.found_searched[0])))) {
+        free(meta);
+        return;
+    }
+    for (int i = 0; i < sv.found_cont; i++) {
+        meta[i].name = sv.found_searched[i];
+        if (lstat(sv.found_searched[i], &sb) == -1) {
+            memset(&sb, 0, sizeof(struct stat));
+        }
+        meta[i].size = sb.st_size;
+        meta[i].mtime = sb.st_mtime;
+    }
+    qsort(meta, sv.found_cont, sizeof(struct found_meta), found_cmp[idx]);
+    for (int i = 0; i < sv.found_cont; i++) {
+        memcpy(tmp[i], meta[i].name, sizeof(tmp[i]));
+    }
+    memcpy(sv.found_searched, tmp, sv.found_cont * sizeof(sv.found_searched[0]));
+    sv.found_sort = idx;
+    free(tmp);
+    free(meta);
+}
+
+/*
+ * Called when pressing TAB in search mode: switches to next sorting function.
+ */
+void change_found_sort(void) {
+    sort_found((sv.found_sort + 1) % NUM(found_cmp));
+    print_info(_(found_sorting_str[sv.found_sort]), INFO_LINE);
+    for (int win = 0; win < cont; win++) {
+        if (ps[win].mode == search_) {
+            reset_win(win);
+        }
+    }
+}
+
+static int found_name_cmp(const void *a, const void *b) {
+    return strcmp(((const struct found_meta *)a)->name, ((const struct found_meta *)b)->name);
+}
+
+static int found_size_cmp(const void *a, const void *b) {
+    off_t s1 = ((const struct found_meta *)a)->size, s2 = ((const struct found_meta *)b)->size;
+    
+    return (s1 < s2) - (s1 > s2);
+}
+
+static int found_mtime_cmp(const void *a, const void *b) {
+    time_t t1 = ((const struct found_meta *)a)->mtime, t2 = ((const struct found_meta *)b)->mtime;
+    
+    return (t1 < t2) - (t1 > t2);
+}
+
 void list_found(void) {
-    char str[100];
+    char str[PATH_MAX + 1];
     
-    sprintf(str, _(search_mode_str), sv.found_cont, sv.searched_string);
+    snprintf(str, PATH_MAX, _(search_mode_str), sv.found_cont, sv.searched_string);
     show_special_tab(sv.found_cont, sv.found_searched, str, search_);
     print_info("", SEARCH_LINE);
 }
@@ -166,30 +525,26 @@ void leave_search_mode(const char *str) {
 
 /*
  * While in search mode, enter will switch to current highlighted file's dir.
- * It checks if file is inside an archive; if so, it removes last part
- * of file's path while we're inside an archive.
+ * It checks if file is inside an archive; if so, it removes the part
+ * of file's path that lives inside the outermost archive (nested archives included).
  * Then returns the index where the real filename begins (to extract the directory path).
  */
 int search_enter_press(const char *str) {
     char arch_str[PATH_MAX + 1] = {0};
-    const char *tmp;
+    const char *tmp = str;
 
     if (sv.search_archive) {
-        int len;
+        struct stat sb;
         
         strncpy(arch_str, str, PATH_MAX);
-        while ((len = strlen(arch_str))) {
-            tmp = strrchr(arch_str, '/');
-            if (is_ext(tmp, arch_ext, NUM(arch_ext))) {
+        for (char *ptr = strchr(arch_str + 1, '/'); ptr; ptr = strchr(ptr + 1, '/')) {
+            *ptr = '\0';
+            if (is_ext(arch_str, arch_ext, NUM(arch_ext)) && !stat(arch_str, &sb) && S_ISREG(sb.st_mode)) {
+                tmp = arch_str;
                 break;
             }
-            arch_str[len - strlen(tmp)] = '\0';
+            *ptr = '/';
         }
     }
-    if (strlen(arch_str)) {
-        tmp = arch_str;
-    } else {
-        tmp = str;
-    }
     return (strlen(tmp) - strlen(strrchr(tmp, '/')));
 }
@@ -0,0 +1,107 @@
+#include "../inc/sha256.h"
+
+static void compress_block(uint32_t *state, const unsigned char *p);
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * SHA-256 (FIPS 180-4), used to identify chunks of deduplicated archives.
+ */
+void sha256_init(struct sha256 *s) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    
+    memcpy(s->state, iv, sizeof(iv));
+    s->len = 0;
+    s->buf_len = 0;
+}
+
+void sha256_update(struct sha256 *s, const void *data, size_t len) {
+    const unsigned char *p = data;
+    
+    s->len += len;
+    if (s->buf_len) {
+        size_t n = 64 - s->buf_len < len ? 64 - s->buf_len : len;
+        
+        memcpy(s->buf + s->buf_len, p, n);
+        s->buf_len += n;
+        p += n;
+        len -= n;
+        if (s->buf_len < 64) {
+            return;
+        }
+        compress_block(s->state, s->buf);
+        s->buf_len = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+        compress_block(s->state, p);
+    }
+    memcpy(s->buf, p, len);
+    s->buf_len = len;
+}
+
+void sha256_final(struct sha256 *s, unsigned char *digest) {
+    uint64_t bits = s->len * 8;
+    
+    s->buf[s->buf_len++] = 0x80;
+    if (s->buf_len > 56) {
+        memset(s->buf + s->buf_len, 0, 64 - s->buf_len);
+        compress_block(s->state, s->buf);
+        s->buf_len = 0;
+    }
+    memset(s->buf + s->buf_len, 0, 56 - s->buf_len);
+    for (int i = 0; i < 8; i++) {
+        s->buf[63 - i] = bits >> (8 * i);
+    }
+    compress_block(s->state, s->buf);
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = s->state[i] >> 24;
+        digest[4 * i + 1] = s->state[i] >> 16;
+        digest[4 * i + 2] = s->state[i] >> 8;
+        digest[4 * i + 3] = s->state[i];
+    }
+}
+
+void sha256(const void *data, size_t len, unsigned char *digest) {
+    struct sha256 s;
+    
+    sha256_init(&s);
+    sha256_update(&s, data, len);
+    sha256_final(&s, digest);
+}
+
+static void compress_block(uint32_t *state, const unsigned char *p) {
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    for (int i = 0; i < 64; i++) {
+        t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
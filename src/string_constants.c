@@ -7,13 +7,17 @@ const char generic_error[] = "A generic error occurred. Check log.";
 
 const char *info_win_str[] = {"?: ", "I: ", "E: "};
 
-const char *arch_ext[] = {".tgz", ".tar.gz", ".zip", ".rar", ".xz", ".ar"};
+const char *arch_ext[] = {".tgz", ".tar.gz", ".zip", ".rar", ".xz", ".ar", ".txz", ".zst", ".tzst", ".bz2", ".tbz2", ".tar"};
 
 const char *sorting_str[] = {"Files will be sorted alphabetically now.",
                              "Files will be sorted by size now.",
                              "Files will be sorted by last access now.",
                              "Files will be sorted by type now."};
 
+const char *found_sorting_str[] = {"Results will be sorted alphabetically now.",
+                                   "Results will be sorted by size now.",
+                                   "Results will be sorted by last modified now."};
+
 const char bookmarks_add_quest[] = "Adding current file to bookmarks. Proceed? Y/n:> ";
 const char bookmarks_rm_quest[] = "Removing current file from bookmarks. Proceed? Y/n:> ";
 const char bookmarks_xdg_err[] = "You cannot remove xdg defined user dirs.";
@@ -34,14 +38,22 @@ const char *file_sel[] = {"File selected.",
                         "Every file in this directory has been unselected.",
                         "Every file in this directory has been unselected. Selected list empty."};
 const char selected_cleared[] = "List of selected files has been cleared.";
+const char *pred_sel[] = {"Select files matching predicates, eg: size>1G mtime<7d name=*.iso:> ",
+                          "Unselect files matching predicates, eg: size>1G mtime<7d name=*.iso:> "};
+const char *pred_sel_result[] = {"%d files selected.", "%d files unselected."};
 
 const char sure[] = "Are you serious? y/N:> ";
 
-const char already_searching[] = "There's already a search in progress. Wait for it.";
+const char search_running_quest[] = "There's already a search in progress. Cancel it (c) or restart it (r)? :> ";
+const char search_cancel[] = "c";
+const char search_restart[] = "r";
+const char search_cancelled[] = "Search cancelled.";
 const char search_insert_name[] = "Insert filename to be found, at least 5 chars, max 20 chars.:> ";
 const char search_archives[] = "Do you want to search in archives too? y/N:> ";
 const char lazy_search[] = "Do you want a lazy search (less precise but faster)? y/N:>";
 const char searched_string_minimum[] = "At least 5 chars...";
+const char pred_search_insert[] = "Insert predicates, eg: size>1G mtime<7d type=f name=*.iso:> ";
+const char pred_wrong_expr[] = "Wrong expression. Use name/size/mtime/type/owner/perm terms, 'or' between alternatives.";
 const char too_many_found[] = "Too many files found; try with a larger string.";
 const char no_found[] = "No files found.";
 const char *searching_mess[] = {"Searching...", "Search finished. Press f anytime from normal mode to view the results."};
@@ -52,7 +64,7 @@ const char print_ok[] = "Print job added.";
 const char print_fail[] = "No printers available.";
 #endif
 
-const char archiving_mesg[] = "Insert new file name (defaults to first entry name):> ";
+const char archiving_mesg[] = "Insert new file name, its extension sets the format (defaults to first entry name.tgz):> ";
 
 const char ask_name[] = "Insert new name:> ";
 
@@ -60,15 +72,27 @@ const char extr_question[] = "Do you really want to extract this archive? Y/n:>
 
 const char pwd_archive[] = "Current archive is encrypted. Enter a pwd:> ";
 
-const char *thread_job_mesg[] = {"Cutting...", "Pasting...", "Removing...", "Archiving...", "Extracting..."};
-const char *thread_str[] = {"Every file has been cut.", "Every file has been pasted.", "File/dir removed.", "Archive is ready.", "Succesfully extracted."};
-const char *thread_fail_str[] = {"Could not cut", "Could not paste.", "Could not remove every file.", "Could not archive.", "Could not extract every file."};
+const char check_quest[] = "Test selected archives (t) or count their members and size (s)? :> ";
+const char check_test[] = "t";
+const char check_size[] = "s";
+const char test_result[] = "%d archives tested, no errors: %lu members, %s.";
+const char size_result[] = "%d archives: %lu members, %s uncompressed.";
+const char dedup_result[] = "Archive is ready: %lu of %lu chunks were new, %s stored.";
+
+const char *thread_job_mesg[] = {"Cutting...", "Pasting...", "Removing...", "Archiving...", "Extracting...", "Updating archive...",
+                                 "Testing archives...", "Counting archives..."};
+const char *thread_str[] = {"Every file has been cut.", "Every file has been pasted.", "File/dir removed.", "Archive is ready.", "Succesfully extracted.", "Archive updated.",
+                            "Archives tested.", "Archives counted."};
+const char *thread_fail_str[] = {"Could not cut", "Could not paste.", "Could not remove every file.", "Could not archive.", "Could not extract every file.", "Could not update archive.",
+                                 "Some archives have errors. Check log.", "Could not read every archive. Check log."};
 const char *short_msg[] = {"File created.", "Dir created.", "File renamed."};
 
 const char selected_mess[] = "There are selected files.";
 
 const char thread_running[] = "There's already an active job. This job will be queued.";
 const char quit_with_running_thread[] = "Queued jobs still running. Waiting...";
+const char cancel_jobs_quest[] = "There are queued jobs. Cancel them instead of waiting for them? y/N:> ";
+const char job_cancelled[] = "Job cancelled.";
 
 const char pkg_quest[] = "Do you really want to install this package? y/N:> ";
 const char install_th_wait[] = "Waiting for package installation to finish...";
@@ -93,34 +117,52 @@ const char search_mode_str[] = "%d files found searching %s:";
 
 const char selected_mode_str[] = "Selected files:";
 
+const char fuzzy_mode_str[] = "Fuzzy finder: %s (%d/%d)";
+const char fuzzy_already_active[] = "Fuzzy finder is already active in other tab.";
+
+const char du_mode_str[] = "Disk usage: %s, %s (%d/%d dirs summed)";
+const char du_already_active[] = "Disk usage analyzer is already active in other tab.";
+
+const char filter_mode_str[] = "Filter: %s (%d/%d)";
+
+const char arch_reading[] = "Reading archive...";
+const char arch_member_err[] = "Could not extract file from archive.";
+const char arch_members_only[] = "Selected archive members can only be extracted.";
+const char not_updatable[] = "Current file is not an archive that can be updated.";
+
 const char ac_online[] = "On AC";
 const char power_fail[] = "No power supply info available.";
 
 const char win_too_small[] = "Window too small. Enlarge it.";
 
-const int HELPER_HEIGHT[] = {16, 10, 9, 9, 9, 9};
+const char preview_no_space[] = "Preview takes second tab's place: close it first.";
+const char preview_loading[] = "Loading...";
+const char preview_dir_str[] = "%d dirs, %d files";
+
+const int HELPER_HEIGHT[] = {17, 10, 8, 9, 9, 9, 9, 7, 8, 8};
 const char helper_title[] = "Press 'L' to trigger helper";
 
 const char helper_string[][16][150] =
 {
     {
         {"Remember: every shortcut in ncursesFM is case insensitive."},
-        {"%ENTER%surf between folders or to open files."},
+        {"%ENTER%surf between folders or to open files. Archives are browsed like folders."},
         {"It will eventually (un)mount your ISO files or install your distro downloaded packages."},
         {"%,%enable fast browse mode: it lets you jump between files by just typing their name."},
-        {"%PG_UP/DOWN%jump straight to first/last file.%I%check files fullname."},
+        {"%/%enable filter mode: only files whose name matches what you type will be shown."},
+        {"%PG_UP/DOWN%jump straight to first/last file.%I%check files fullname.%Y%preview current file."},
         {"%H%trigger the showing of hidden files.%S%see files stats."},
         {"%TAB%change sorting function: alphabetically (default), by size, by last modified or by type."},
-        {"%SPACE%select files. Once more to remove the file from selected files."},
-        {"%O%rename current file/dir.%N/D%create new file/dir.%F%search for a file."},
+        {"%SPACE%select files. Once more to remove the file from selected files.%+/-%(un)select files matching predicates."},
+        {"%O%rename current file/dir.%N/D%create new file/dir.%F%search for a file.%Q%search by metadata."},
 #ifdef LIBCUPS_PRESENT
-        {"%V/X%paste/cut.%B%compress.%R%remove.%Z%extract.%P%print."},
+        {"%V/X%paste/cut.%B%compress.%A%add to current archive.%R%remove.%Z%extract.%C%test/count archives.%P%print."},
 #else
-        {"%V/X%paste/cut.%B%compress.%R%remove.%Z%extract."},
+        {"%V/X%paste/cut.%B%compress.%A%add to current archive.%R%remove.%Z%extract.%C%test/count archives."},
 #endif
         {"%T%create second tab.%W%close second tab.%ARROW KEYS%switch between tabs."},
         {"%G%switch to bookmarks mode.%E%add/remove current file to bookmarks."},
-        {"%M%switch to device mode.%K%switch to selected mode."},
+        {"%M%switch to device mode.%K%switch to selected mode.%J%switch to fuzzy finder mode.%U%analyze disk usage."},
         {"%ESC%quit."}
     }, {
         {"Remember: every shortcut in ncursesFM is case insensitive."},
@@ -131,6 +173,13 @@ const char helper_string[][16][150] =
         {"%PG_UP/DOWN%jump straight to first/last file."},
         {"%TAB%change sorting function: alphabetically (default), by size, by last modified or by type."},
         {"%ESC%leave fast browse mode."}
+    }, {
+        {"Just start typing: only files whose name contains your string will be shown."},
+        {"Use *, ? or [...] to match a glob instead.%BACKSPACE%remove last char."},
+        {"%ENTER%surf between folders or to open files.%ARROW KEYS%switch between tabs."},
+        {"%SPACE%select files. Once more to remove the file from selected files."},
+        {"%PG_UP/DOWN%jump straight to first/last file.%TAB%change sorting function."},
+        {"%ESC%leave filter mode, restoring full listing."}
     }, {
         {"Remember: every shortcut in ncursesFM is case insensitive."},
         {"%S%see files stats.%I%check files fullname."},
@@ -145,6 +194,7 @@ const char helper_string[][16][150] =
         {"%PG_UP/DOWN%jump straight to first/last file."},
         {"%T%create second tab.%W%close second tab.%ARROW KEYS%switch between tabs."},
         {"%ENTER%move to the folder/file selected."},
+        {"%TAB%sort results alphabetically, by size or by last modified."},
         {"%ESC%leave search mode."}
     }, {
         {"Remember: every shortcut in ncursesFM is case insensitive."},
@@ -162,5 +212,24 @@ const char helper_string[][16][150] =
         {"%R%remove current file selection.%DEL%remove all selected files."},
         {"%ENTER%move to the folder/file selected."},
         {"%ESC%leave selected mode."}
+    }, {
+        {"Just start typing: files below current dir will be ranked by how well they match your string."},
+        {"An uppercase char makes the match case sensitive.%BACKSPACE%remove last char."},
+        {"%PG_UP/DOWN%jump straight to first/last result.%ARROW KEYS%switch between tabs."},
+        {"%ENTER%move to the folder/file selected."},
+        {"%ESC%leave fuzzy finder mode."}
+    }, {
+        {"Remember: every shortcut in ncursesFM is case insensitive."},
+        {"%ENTER%surf between archive's folders, or extract a file to open it."},
+        {"%BACKSPACE%go to parent folder.%S%see files stats.%I%check files fullname."},
+        {"%SPACE%select files/folders.%Z%extract selected ones next to the archive."},
+        {"%PG_UP/DOWN%jump straight to first/last file.%ARROW KEYS%switch between tabs."},
+        {"%ESC%leave archive mode."}
+    }, {
+        {"Entries are sorted by size, updated while their trees are summed ('+' marks them)."},
+        {"%ENTER%analyze selected folder, or move to selected file."},
+        {"%BACKSPACE%analyze parent folder.%I%check files fullname."},
+        {"%PG_UP/DOWN%jump straight to first/last entry.%ARROW KEYS%switch between tabs."},
+        {"%ESC%leave disk usage mode."}
     }
 };
@@ -0,0 +1,167 @@
+#include "../inc/strmap.h"
+
+static int grow(struct strmap *m, size_t num);
+
+struct strmap_node {
+    struct strmap_node *next;
+    void *value;
+    uint32_t hash;
+    char key[];
+};
+
+/*
+ * Chained hash table from strings to pointers.
+ * Keys are copied; values are owned by caller until strmap_free.
+ * Buckets are doubled whenever there are more keys than buckets.
+ */
+struct strmap {
+    struct strmap_node **buckets;
+    size_t num_buckets;
+    size_t num_keys;
+};
+
+/*
+ * Returns NULL if map could not be allocated.
+ */
+struct strmap *strmap_new(size_t size_hint) {
+    struct strmap *m;
+    size_t n = 64;
+    
+    while (n < size_hint) {
+        n *= 2;
+    }
+    if (!(m = calloc(1, sizeof(struct strmap)))) {
+        return NULL;
+    }
+    if (!(m->buckets = calloc(n, sizeof(struct strmap_node *)))) {
+        free(m);
+        return NULL;
+    }
+    m->num_buckets = n;
+    return m;
+}
+
+/*
+ * FNV-1a
+ */
+uint32_t strmap_hash(const char *key) {
+    uint32_t h = 2166136261u;
+    
+    for (; *key; key++) {
+        h = (h ^ (unsigned char)*key) * 16777619u;
+    }
+    return h;
+}
+
+void *strmap_get(const struct strmap *m, const char *key) {
+    uint32_t h = strmap_hash(key);
+    
+    for (struct strmap_node *n = m->buckets[h & (m->num_buckets - 1)]; n; n = n->next) {
+        if (n->hash == h && !strcmp(n->key, key)) {
+            return n->value;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Adds key, or replaces its value if already present (old value is not freed).
+ * Returns -1 if memory could not be allocated.
+ */
+int strmap_put(struct strmap *m, const char *key, void *value) {
+    uint32_t h = strmap_hash(key);
+    size_t len = strlen(key) + 1;
+    struct strmap_node *n, **b = &m->buckets[h & (m->num_buckets - 1)];
+    
+    for (n = *b; n; n = n->next) {
+        if (n->hash == h && !strcmp(n->key, key)) {
+            n->value = value;
+            return 0;
+        }
+    }
+    if (!(n = malloc(sizeof(struct strmap_node) + len))) {
+        return -1;
+    }
+    memcpy(n->key, key, len);
+    n->value = value;
+    n->hash = h;
+    n->next = *b;
+    *b = n;
+    m->num_keys++;
+    if (m->num_keys > m->num_buckets) {
+        // a failed grow only makes chains longer
+        grow(m, 2 * m->num_buckets);
+    }
+    return 0;
+}
+
+/*
+ * Removes key, returning its value (NULL if key was not there).
+ */
+void *strmap_del(struct strmap *m, const char *key) {
+    uint32_t h = strmap_hash(key);
+    
+    for (struct strmap_node *n, **p = &m->buckets[h & (m->num_buckets - 1)]; (n = *p); p = &n->next) {
+        if (n->hash == h && !strcmp(n->key, key)) {
+            void *value = n->value;
+            
+            *p = n->next;
+            free(n);
+            m->num_keys--;
+            return value;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Makes room for num_keys keys at once, so that adding them won't rehash the map.
+ */
+int strmap_reserve(struct strmap *m, size_t num_keys) {
+    size_t num = m->num_buckets;
+    
+    while (num < num_keys) {
+        num *= 2;
+    }
+    return num == m->num_buckets ? 0 : grow(m, num);
+}
+
+static int grow(struct strmap *m, size_t num) {
+    struct strmap_node **buckets = calloc(num, sizeof(struct strmap_node *));
+    
+    if (!buckets) {
+        return -1;
+    }
+    for (size_t i = 0; i < m->num_buckets; i++) {
+        struct strmap_node *n = m->buckets[i], *next;
+        
+        for (; n; n = next) {
+            next = n->next;
+            n->next = buckets[n->hash & (num - 1)];
+            buckets[n->hash & (num - 1)] = n;
+        }
+    }
+    free(m->buckets);
+    m->buckets = buckets;
+    m->num_buckets = num;
+    return 0;
+}
+
+/*
+ * Frees the map; free_value (if not NULL) is called on each value.
+ */
+void strmap_free(struct strmap *m, void (*free_value)(void *)) {
+    for (size_t i = 0; i < m->num_buckets; i++) {
+        struct strmap_node *n = m->buckets[i], *next;
+        
+        for (; n; n = next) {
+            next = n->next;
+            if (free_value) {
+                free_value(n->value);
+            }
+            free(n);
+        }
+    }
+    free(m->buckets);
+    free(m);
+}
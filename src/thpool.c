@@ -0,0 +1,174 @@
+#include "../inc/thpool.h"
+
+static void *thpool_worker(void *x);
+
+/*
+ * Single job queued in a thread pool.
+ */
+struct thpool_job {
+    void (*f)(void *);
+    void *arg;
+    struct thpool_job *next;
+};
+
+/*
+ * Fixed size pool of worker threads consuming a fifo of jobs.
+ * pending counts jobs that were queued but not yet completed,
+ * so that thpool_wait() can know when every job has been processed.
+ */
+struct thpool {
+    pthread_t *threads;
+    int num_threads;
+    struct thpool_job *head, *tail;
+    int pending;
+    int leaving;
+    pthread_mutex_t lck;
+    pthread_cond_t work_cond;
+    pthread_cond_t idle_cond;
+};
+
+/*
+ * Creates a pool of num_threads workers (or one worker for each online cpu if num_threads <= 0).
+ * Returns NULL if it could not allocate the pool.
+ */
+struct thpool *thpool_new(int num_threads) {
+    struct thpool *pool;
+    
+    if (num_threads <= 0) {
+        num_threads = thpool_default_size();
+    }
+    if (!(pool = calloc(1, sizeof(struct thpool)))) {
+        return NULL;
+    }
+    if (!(pool->threads = calloc(num_threads, sizeof(pthread_t)))) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lck, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, thpool_worker, pool) != 0) {
+            break;
+        }
+        pool->num_threads++;
+    }
+    if (!pool->num_threads) {
+        thpool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/*
+ * Appends a job to the pool queue and wakes up a worker.
+ * Returns -1 if job could not be allocated.
+ */
+int thpool_add(struct thpool *pool, void (*f)(void *), void *arg) {
+    struct thpool_job *job;
+    
+    if (!(job = malloc(sizeof(struct thpool_job)))) {
+        return -1;
+    }
+    job->f = f;
+    job->arg = arg;
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lck);
+    if (pool->tail) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pool->pending++;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lck);
+    return 0;
+}
+
+/*
+ * Blocks until every queued job has been completed.
+ */
+void thpool_wait(struct thpool *pool) {
+    pthread_mutex_lock(&pool->lck);
+    while (pool->pending) {
+        pthread_cond_wait(&pool->idle_cond, &pool->lck);
+    }
+    pthread_mutex_unlock(&pool->lck);
+}
+
+/*
+ * Same as thpool_wait, but gives up after ms milliseconds.
+ * Returns 1 if every queued job has been completed, 0 on timeout.
+ */
+int thpool_timedwait(struct thpool *pool, int ms) {
+    struct timespec ts;
+    int idle;
+    
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&pool->lck);
+    while (pool->pending && pthread_cond_timedwait(&pool->idle_cond, &pool->lck, &ts) == 0);
+    idle = !pool->pending;
+    pthread_mutex_unlock(&pool->lck);
+    return idle;
+}
+
+/*
+ * Waits for queued jobs to be completed, then joins every worker and frees the pool.
+ */
+void thpool_free(struct thpool *pool) {
+    thpool_wait(pool);
+    pthread_mutex_lock(&pool->lck);
+    pool->leaving = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lck);
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lck);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool->threads);
+    free(pool);
+}
+
+int thpool_default_size(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    return n > 0 ? n : 1;
+}
+
+static void *thpool_worker(void *x) {
+    struct thpool *pool = (struct thpool *)x;
+    struct thpool_job *job;
+    
+    pthread_mutex_lock(&pool->lck);
+    while (1) {
+        while (!pool->head && !pool->leaving) {
+            pthread_cond_wait(&pool->work_cond, &pool->lck);
+        }
+        if (!pool->head) {
+            break;
+        }
+        job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lck);
+        job->f(job->arg);
+        free(job);
+        pthread_mutex_lock(&pool->lck);
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->idle_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lck);
+    return NULL;
+}
@@ -2,6 +2,8 @@
 
 static void info_win_init(void);
 static void generate_list(int win);
+static int listing_cacheable(int win);
+static void prefetch_dir(int win, const char *path);
 static int sizesort(const struct dirent **d1, const struct dirent **d2);
 static int last_mod_sort(const struct dirent **d1, const struct dirent **d2);
 static int typesort(const struct dirent **d1, const struct dirent **d2);
@@ -19,6 +21,11 @@ static void trigger_show_additional_win(int height, WINDOW **win, void (*f)(void
 static void create_additional_win(int height, WINDOW **win, void (*f)(void));
 static void remove_additional_win(int height, WINDOW **win, int resizing);
 static void show_stat(int init, int end, int win);
+static void update_tot_size(int win);
+static int entry_size(const char *path, off_t *size);
+static int dir_size(const char *path, const struct stat *sb, off_t *size);
+static void update_entry_size(int win, const char *name, uint32_t mask);
+static void refresh_tot_size(int win);
 static void erase_stat(void);
 static void info_print(const char *str, int i);
 static void fix_input_cursor_pos(void);
@@ -28,9 +35,19 @@ static void archiver_cb_func(void);
 static void sig_handler(int fd);
 static void info_refresh(int fd);
 static void inotify_refresh(int win);
+static void du_refresh(int fd);
+static void type_refresh(int fd);
+static void preview_refresh(int fd);
+static void fuzzy_refresh(int fd);
+static void arch_browse_refresh(int fd);
+static int num_panes(void);
+static void resize_preview(void);
+static void draw_preview(void);
 static int print_additional_wins(int helper_height, int resizing);
 static void resize_fm_win(void);
-static void check_selected(const char *str, int win, int line);
+static void sync_rows(int win);
+static unsigned char get_row(int win, int i);
+static void forget_selection(int win);
 static int check_sysinfo_where(int where, int len);
 static void fullname_print(void);
 static void update_fullname_win(void);
@@ -43,7 +60,49 @@ struct info_msg {
     uint8_t line;
 };
 
-static WINDOW *helper_win, *info_win, *fullname_win;
+/*
+ * Render data of each row of a tab's listing, one byte per row in tab_entry() order:
+ * its color pair (0 until the row is drawn for the first time; temporary while file type
+ * is being classified, see colored_folders()) and whether it is selected (once known).
+ * Rows are only computed when drawn, so that a redraw only costs
+ * as many rows as are visible, whatever the size of the listing.
+ * Reset when listing changes (see sync_rows()); selection is kept in sync by mark_row().
+ */
+#define ROW_COLOR 0x0F
+#define ROW_SELECTED 0x10
+#define ROW_SEL_KNOWN 0x20
+#define ROW_TYPE_PENDING 0x40
+
+struct row_cache {
+    unsigned char *rows;
+    int num;
+    const void *src;
+    const int *view;
+};
+
+/*
+ * Size of each file of a tab's cwd, by path, kept in sync with inotify events
+ * (see update_entry_size()), so that total size of a listing is summed without
+ * a stat for every file each time the listing changes.
+ * gen marks entries summed in total: only their changes are applied to it.
+ * dir entries are summed again each time, as their size comes from du.
+ */
+struct size_entry {
+    off_t size;
+    unsigned long gen;
+    int dir;
+};
+
+struct size_cache {
+    struct strmap *map;
+    char dir[PATH_MAX + 1];
+    off_t total;
+    unsigned long gen;
+};
+
+static struct row_cache rows[MAX_TABS];
+static struct size_cache sizes[MAX_TABS];
+static WINDOW *helper_win, *info_win, *fullname_win, *preview_win;
 static int dim, hidden, fullname_win_height, input_mode, input_cursor_pos;
 size_t input_len;
 static int (*const sorting_func[])(const struct dirent **d1, const struct dirent **d2) = {
@@ -62,6 +121,11 @@ void screen_init(void) {
     init_pair(3, COLOR_GREEN, -1);
     init_pair(4, COLOR_YELLOW, -1);
     init_pair(5, COLOR_RED, -1);
+    // file types (see colored_folders()); archives share red
+    init_pair(6, COLOR_MAGENTA, -1);
+    init_pair(7, COLORS >= 256 ? 170 : COLOR_MAGENTA, -1);
+    init_pair(8, COLORS >= 256 ? 108 : COLOR_WHITE, -1);
+    init_pair(9, COLORS >= 256 ? 180 : COLOR_WHITE, -1);
     noecho();
     curs_set(0);
     mouseinterval(0);
@@ -110,6 +174,9 @@ void screen_end(void) {
         if (fullname_win) {
             delwin(fullname_win);
         }
+        if (preview_win) {
+            delwin(preview_win);
+        }
         delwin(stdscr);
         endwin();
     }
@@ -118,30 +185,63 @@ void screen_end(void) {
 /*
  * Creates a list of strings from current win path's files and print them to screen (list_everything)
  * If program cannot allocate memory, it will leave.
+ * With dir cache, listing is taken from it when still valid; then parent dir is prefetched.
  */
 static void generate_list(int win) {
     struct dirent **files;
     
     hidden = ps[win].show_hidden;
-    ps[win].number_of_files = scandir(ps[win].my_cwd, &files, is_hidden, sorting_func[ps[win].sorting_index]);
     free(ps[win].nl);
-    if (!(ps[win].nl = calloc(ps[win].number_of_files, PATH_MAX))) {
-        quit = MEM_ERR_QUIT;
-        ERROR("could not malloc. Leaving.");
+    ps[win].nl = NULL;
+    rows[win].num = -1;
+    if (!listing_cacheable(win) || (ps[win].number_of_files = dircache_list(ps[win].my_cwd,
+        sorting_func[ps[win].sorting_index], hidden, &ps[win].nl)) == -1) {
+        ps[win].number_of_files = scandir(ps[win].my_cwd, &files, is_hidden, sorting_func[ps[win].sorting_index]);
+        if (!(ps[win].nl = calloc(ps[win].number_of_files, PATH_MAX))) {
+            quit = MEM_ERR_QUIT;
+            ERROR("could not malloc. Leaving.");
+        }
+        for (int i = 0; i < ps[win].number_of_files; i++) {
+            if (!quit) {
+                snprintf(ps[win].nl[i], PATH_MAX, "%s/%s", ps[win].my_cwd, files[i]->d_name);
+            }
+            free(files[i]);
+        }
+        free(files);
     }
     str_ptr[win] = ps[win].nl;
-    for (int i = 0; i < ps[win].number_of_files; i++) {
-        if (!quit) {
-            snprintf(ps[win].nl[i], PATH_MAX, "%s/%s", ps[win].my_cwd, files[i]->d_name);
-        }
-        free(files[i]);
+    if (!quit && strcmp(ps[win].my_cwd, "/")) {
+        prefetch_dir(win, "..");
+    }
+    if (!quit && ps[win].mode == filter_) {
+        update_filter(win);
     }
-    free(files);
     if (!quit) {
         reset_win(win);
     }
 }
 
+/*
+ * Only listings sorted by name or type are cached: they only change when dir's entries do.
+ */
+static int listing_cacheable(int win) {
+    int (*cmp)(const struct dirent **, const struct dirent **) = sorting_func[ps[win].sorting_index];
+    
+    return config.dir_cache_size > 0 && config.dir_cache_mb > 0 && (cmp == alphasort || cmp == typesort);
+}
+
+/*
+ * Prefetches listing of dir name, inside win's cwd, if win's listings are cached.
+ */
+static void prefetch_dir(int win, const char *name) {
+    char path[PATH_MAX + 1];
+    
+    if (ps[win].mode == normal && listing_cacheable(win)) {
+        snprintf(path, sizeof(path), "%s/%s", ps[win].my_cwd, name);
+        dircache_prefetch(path, sorting_func[ps[win].sorting_index]);
+    }
+}
+
 /*
  * Callback function to scandir: list files by size.
  */
@@ -194,6 +294,7 @@ void reset_win(int win) {
     ps[win].mywin.delta = 0;
     ps[win].curr_pos = 0;
     memset(ps[win].mywin.tot_size, 0, strlen(ps[win].mywin.tot_size));
+    rows[win].num = -1;
     list_everything(win, 0, dim - 2);
 }
 
@@ -205,20 +306,27 @@ void reset_win(int win) {
  */
 static void list_everything(int win, int old_dim, int end) {
     char *str;
+    unsigned char row;
     
+    sync_rows(win);
     wattron(ps[win].mywin.fm, A_BOLD);
     for (int i = old_dim; (i < ps[win].number_of_files) && (i  < old_dim + end); i++) {
         wmove(ps[win].mywin.fm, i + 1 - ps[win].mywin.delta, 1);
         wclrtoeol(ps[win].mywin.fm);
-        if (ps[win].mode > fast_browse_) {
-            str = str_ptr[win][i];
+        row = get_row(win, i);
+        if (ps[win].mode == du_) {
+            str = du_label(i);
+        } else if (ps[win].mode > filter_ && ps[win].mode != archive_) {
+            str = tab_entry(win, i);
         } else {
-            check_selected(str_ptr[win][i], win, i);
-            str = strrchr(str_ptr[win][i], '/') + 1;
+            if (row & ROW_SELECTED) {
+                mvwprintw(ps[win].mywin.fm, 1 + i - ps[win].mywin.delta, SEL_COL, "*");
+            }
+            str = strrchr(tab_entry(win, i), '/') + 1;
         }
-        wattron(ps[win].mywin.fm, COLOR_PAIR(colored_folders(*(str_ptr[win] + i))));
+        wattron(ps[win].mywin.fm, COLOR_PAIR(row & ROW_COLOR));
         mvwprintw(ps[win].mywin.fm, 1 + i - ps[win].mywin.delta, 4, "%.*s", ps[win].mywin.width - 5, str);
-        wattroff(ps[win].mywin.fm, COLOR_PAIR(colored_folders(*(str_ptr[win] + i))));
+        wattroff(ps[win].mywin.fm, COLOR_PAIR(row & ROW_COLOR));
     }
     wattroff(ps[win].mywin.fm, A_BOLD);
     if (ps[win].mywin.stat_active) {
@@ -236,6 +344,14 @@ static void print_arrow(int win) {
     if (fullname_win && win == active) {
         update_fullname_win();
     }
+    if (preview_win && win == active) {
+        draw_preview();
+    }
+    // current dir will probably be entered next
+    if (ps[win].mode == normal && ps[win].number_of_files > 0 && (get_row(win, ps[win].curr_pos) & ROW_COLOR) == 1 &&
+        strcmp(strrchr(tab_entry(win, ps[win].curr_pos), '/') + 1, "..")) {
+        prefetch_dir(win, strrchr(tab_entry(win, ps[win].curr_pos), '/') + 1);
+    }
 }
 
 static void check_active(int win) {
@@ -282,8 +398,8 @@ static int is_hidden(const struct dirent *current_file) {
  * Then calls initialize_tab_cwd().
  */
 void new_tab(int win) {
-    ps[win].mywin.width = COLS / cont + win * (COLS % cont);
-    ps[win].mywin.fm = newwin(dim, ps[win].mywin.width, 0, (COLS * win) / cont);
+    ps[win].mywin.width = COLS / num_panes() + win * (COLS % num_panes());
+    ps[win].mywin.fm = newwin(dim, ps[win].mywin.width, 0, (COLS * win) / num_panes());
     keypad(ps[win].mywin.fm, TRUE);
     scrollok(ps[win].mywin.fm, TRUE);
     idlok(ps[win].mywin.fm, TRUE);
@@ -296,9 +412,9 @@ void new_tab(int win) {
  */
 void resize_tab(int win, int resizing) {
     wclear(ps[win].mywin.fm);
-    ps[win].mywin.width = COLS / cont + win * (COLS % cont);
+    ps[win].mywin.width = COLS / num_panes() + win * (COLS % num_panes());
     wresize(ps[win].mywin.fm, dim, ps[win].mywin.width);
-    mvwin(ps[win].mywin.fm, 0, (COLS * win) / cont);
+    mvwin(ps[win].mywin.fm, 0, (COLS * win) / num_panes());
     if (resizing) {
         if (ps[win].curr_pos > dim - 3) {
             ps[win].mywin.delta = ps[win].curr_pos - (dim - 3);
@@ -342,8 +458,23 @@ void delete_tab(int win) {
     memset(ps[win].my_cwd, 0, sizeof(ps[win].my_cwd));
     memset(ps[win].mywin.tot_size, 0, strlen(ps[win].mywin.tot_size));
     ps[win].mywin.stat_active = 0;
+    cancel_archive_job(win);
+    if (ps[win].mode == filter_) {
+        free_filter(win);
+    } else if (ps[win].mode == archive_) {
+        free_archive_browse(win);
+    } else if (ps[win].mode == du_) {
+        ps[win].view = NULL;
+        free_du_analyzer();
+    }
     ps[win].mode = normal;
     free(ps[win].nl);
+    free(rows[win].rows);
+    memset(&rows[win], 0, sizeof(struct row_cache));
+    if (sizes[win].map) {
+        strmap_free(sizes[win].map, free);
+    }
+    memset(&sizes[win], 0, sizeof(struct size_cache));
     inotify_rm_watch(ps[win].inot.fd, ps[win].inot.wd);
     ps[win].nl = NULL;
 }
@@ -410,9 +541,13 @@ static void scroll_helper_func(int x, int direction, int win) {
  * Follows ls color scheme to color files/folders.
  * In search mode, it highlights paths inside archives in yellow.
  * In device mode, everything is printed in yellow.
+ * With config.type_colors, other regular files are colored by type: while it is being
+ * classified, ROW_TYPE_PENDING is returned too, and the row is colored again once known.
  */
 static int colored_folders(const char *name) {
+    const int type_colors[] = {4, 6, 5, 7, 8, 9};
     struct stat file_stat;
+    int type;
 
     if (lstat(name, &file_stat) == 0) {
         if (S_ISDIR(file_stat.st_mode)) {
@@ -424,6 +559,10 @@ static int colored_folders(const char *name) {
         if ((S_ISREG(file_stat.st_mode)) && (file_stat.st_mode & S_IXUSR)) {
             return 3;
         }
+        if (config.type_colors && S_ISREG(file_stat.st_mode)) {
+            type = file_type(name, &file_stat);
+            return type == -1 ? 4 | ROW_TYPE_PENDING : type_colors[type];
+        }
     } 
     return 4;
 }
@@ -458,6 +597,7 @@ static void create_additional_win(int height, WINDOW **win, void (*f)(void)) {
             print_border_and_title(i);
         }
     }
+    resize_preview();
     *win = newwin(height, COLS, dim, 0);
     wclear(*win);
     f();
@@ -480,6 +620,9 @@ static void remove_additional_win(int height, WINDOW **win, int resizing) {
             list_everything(i, dim - 2 - height + ps[i].mywin.delta, height);
         }
     }
+    if (!resizing) {
+        resize_preview();
+    }
 }
 
 void trigger_show_helper_message(void) {
@@ -548,63 +691,185 @@ static void helper_print(void) {
  * Prints size and perms for each of the files of the win between init and init + end.
  * Plus, calculates full folder size if ps[win].mywin.tot_size is empty (it is emptied in generate_list,
  * so it will be empty only when a full redraw of the win is needed).
+ * With config.dir_sizes, dirs show the size of their tree ("..." until du computed it).
  */
 static void show_stat(int init, int end, int win) {
-    int check = strlen(ps[win].mywin.tot_size);
     const int perm_bit[9] = {S_IRUSR, S_IWUSR, S_IXUSR, S_IRGRP, S_IWGRP, S_IXGRP, S_IROTH, S_IWOTH, S_IXOTH};
     const char perm_sign[3] = {'r', 'w', 'x'};
     char str[100] = {0};
-    float total_size = 0;
     struct stat file_stat;
+    off_t size;
     const int perm_col = ps[win].mywin.width - PERM_LENGTH;
     const int size_col = ps[win].mywin.width - STAT_LENGTH;
     int col;
     
-    if (ps[win].mode <= fast_browse_) {
-        check %= check - 1; // "check" should be 0 or 1 (strlen(tot_size) will never be 1, so i can safely divide for check - 1)
-    } else {
-        check = 1;  // if we're in special mode, we don't need printing total size.
+    // if we're in special mode, we don't need printing total size.
+    if (ps[win].mode <= filter_ && !strlen(ps[win].mywin.tot_size)) {
+        update_tot_size(win);
     }
-    for (int i = check * init; i < ps[win].number_of_files; i++) {
-        if (stat(str_ptr[win][i], &file_stat) == -1 && ps[win].mode != device_) {
+    for (int i = init; i < ps[win].number_of_files && i < init + end; i++) {
+        // archive members are not on disk: their headers are used instead
+        if ((ps[win].mode == archive_ ? archive_row_stat(win, i, &file_stat) : stat(tab_entry(win, i), &file_stat)) == -1 &&
+            ps[win].mode != device_) {
             continue;
         }
-        if (!check) {
-            total_size += file_stat.st_size;
-        }
-        if ((i >= init) && (i < init + end)) {
-            if (ps[win].mode == device_) {
-                show_devices_stat(i, win, str);
-                col = ps[win].mywin.width - strlen(str) - 1;
-                if (col < 0) {
-                    col = 4;
-                }
-            } else {
-                col = size_col;
-                change_unit(file_stat.st_size, str);
+        if (ps[win].mode == device_) {
+            show_devices_stat(i, win, str);
+            col = ps[win].mywin.width - strlen(str) - 1;
+            if (col < 0) {
+                col = 4;
             }
-            // if show_devices_stat returned a non-empty string
-            // or we are not in device_mode
-            if (strlen(str)) {
-                wmove(ps[win].mywin.fm, i + 1 - ps[win].mywin.delta, col);
-                wclrtoeol(ps[win].mywin.fm);
-                mvwprintw(ps[win].mywin.fm, i + 1 - ps[win].mywin.delta, col, "%.*s", ps[win].mywin.width - 5, str);
+        } else {
+            col = size_col;
+            switch (ps[win].mode == archive_ ? 0 : dir_size(tab_entry(win, i), &file_stat, &size)) {
+            case 0:
+                change_unit(file_stat.st_size, str);
+                break;
+            case 1:
+                change_unit(size, str);
+                break;
+            default:
+                strcpy(str, "...");
+                break;
             }
-            if (ps[win].mode != device_) {
-                for (int j = 0; j < 9; j++) {
-                    mvwprintw(ps[win].mywin.fm, i + 1 - ps[win].mywin.delta, perm_col + j, 
-                              (file_stat.st_mode & perm_bit[j]) ? "%c" : "-", perm_sign[j % 3]);
-                }
+        }
+        // if show_devices_stat returned a non-empty string
+        // or we are not in device_mode
+        if (strlen(str)) {
+            wmove(ps[win].mywin.fm, i + 1 - ps[win].mywin.delta, col);
+            wclrtoeol(ps[win].mywin.fm);
+            mvwprintw(ps[win].mywin.fm, i + 1 - ps[win].mywin.delta, col, "%.*s", ps[win].mywin.width - 5, str);
+        }
+        if (ps[win].mode != device_) {
+            for (int j = 0; j < 9; j++) {
+                mvwprintw(ps[win].mywin.fm, i + 1 - ps[win].mywin.delta, perm_col + j, 
+                          (file_stat.st_mode & perm_bit[j]) ? "%c" : "-", perm_sign[j % 3]);
             }
-            if ((i == init + end - 1) && (check)) {
-                break;
+        }
+    }
+}
+
+/*
+ * Total size of win's listing, summed once per listing (tot_size is emptied whenever it changes).
+ * Only files missing from sizes cache are stat'd: cache is kept while cwd does not change.
+ */
+static void update_tot_size(int win) {
+    struct size_cache *c = &sizes[win];
+    struct size_entry *e;
+    off_t size;
+    int dir;
+    
+    if (!c->map || strcmp(c->dir, ps[win].my_cwd)) {
+        if (c->map) {
+            strmap_free(c->map, free);
+        }
+        c->map = strmap_new(ps[win].number_of_files);
+        strncpy(c->dir, ps[win].my_cwd, PATH_MAX);
+    }
+    c->gen++;
+    c->total = 0;
+    for (int i = 0; i < ps[win].number_of_files; i++) {
+        const char *path = tab_entry(win, i);
+        
+        e = c->map ? strmap_get(c->map, path) : NULL;
+        if (e && !e->dir) {
+            e->gen = c->gen;
+            c->total += e->size;
+            continue;
+        }
+        if ((dir = entry_size(path, &size)) == -1) {
+            continue;
+        }
+        c->total += size;
+        if (!e && c->map && (e = malloc(sizeof(struct size_entry))) && strmap_put(c->map, path, e) == -1) {
+            free(e);
+            e = NULL;
+        }
+        if (e) {
+            *e = (struct size_entry) {size, c->gen, dir};
+        }
+    }
+    refresh_tot_size(win);
+}
+
+/*
+ * Writes in size the size of path: for dirs, with config.dir_sizes, the size of its tree when known.
+ * Returns -1 if path cannot be stat'd, 1 if it is a dir, 0 otherwise.
+ */
+static int entry_size(const char *path, off_t *size) {
+    struct stat file_stat;
+    
+    if (stat(path, &file_stat) == -1) {
+        return -1;
+    }
+    if (dir_size(path, &file_stat, size) != 1) {
+        *size = file_stat.st_size;
+    }
+    return !!S_ISDIR(file_stat.st_mode);
+}
+
+/*
+ * With config.dir_sizes, writes in size the size of tree of dir path (sb is its stat) and returns 1,
+ * or returns -1 if du is still computing it. Returns 0 for files, and for "..",
+ * whose tree is not walked.
+ */
+static int dir_size(const char *path, const struct stat *sb, off_t *size) {
+    if (!config.dir_sizes || !S_ISDIR(sb->st_mode) || !strcmp(strrchr(path, '/') + 1, "..")) {
+        return 0;
+    }
+    return du_size(path, sb, size) == 0 ? 1 : -1;
+}
+
+/*
+ * Applies an inotify event on file name of win's cwd to sizes cache: a modified file is stat'd again,
+ * and total size changed by the difference, if it was summed in it.
+ * Other events only drop the file: they change the listing, so total is summed again anyway.
+ * Dirs above cwd changed their size too: they are summed again by du (see du_invalidate()),
+ * and the other tab is refreshed if it is showing one of them.
+ */
+static void update_entry_size(int win, const char *name, uint32_t mask) {
+    struct size_cache *c = &sizes[win];
+    char path[PATH_MAX + 1] = {0};
+    struct size_entry *e;
+    off_t size;
+    
+    if (config.dir_sizes) {
+        du_invalidate(ps[win].my_cwd);
+        for (int i = 0; i < cont; i++) {
+            size_t len = strlen(ps[i].my_cwd);
+            
+            if (i != win && ps[i].mode <= filter_ && ps[i].mywin.stat_active &&
+                !strncmp(ps[i].my_cwd, ps[win].my_cwd, len) &&
+                (ps[win].my_cwd[len] == '/' || !strcmp(ps[i].my_cwd, "/"))) {
+                memset(ps[i].mywin.tot_size, 0, strlen(ps[i].mywin.tot_size));
+                show_stat(ps[i].mywin.delta, dim - 2, i);
+                print_border_and_title(i);
             }
         }
     }
-    if (!check) {
-        change_unit(total_size, str);
-        sprintf(ps[win].mywin.tot_size, "Total size: %s", str);
+    if (!c->map || strcmp(c->dir, ps[win].my_cwd)) {
+        return;
+    }
+    snprintf(path, PATH_MAX, "%s/%s", ps[win].my_cwd, name);
+    if (!(e = strmap_get(c->map, path))) {
+        return;
     }
+    if (!(mask & (IN_MODIFY | IN_ATTRIB)) || e->dir || entry_size(path, &size) != 0) {
+        free(strmap_del(c->map, path));
+        return;
+    }
+    if (e->gen == c->gen && strlen(ps[win].mywin.tot_size)) {
+        c->total += size - e->size;
+        refresh_tot_size(win);
+    }
+    e->size = size;
+}
+
+static void refresh_tot_size(int win) {
+    char str[20] = {0};
+    
+    change_unit(sizes[win].total, str);
+    sprintf(ps[win].mywin.tot_size, "Total size: %s", str);
 }
 
 /*
@@ -634,32 +899,51 @@ static void erase_stat(void) {
  * Clears i line to the end, then prints str string.
  * Then performs some checks about some "sticky messages"
  * (eg: "Pasting..." while a thread is pasting a file)
+ * If str is NULL, only sticky message is refreshed.
  */
 static void info_print(const char *str, int i) {
-    char st[100] = {0};
-
-    wmove(info_win, i, 1);
-    wclrtoeol(info_win);
-    mvwprintw(info_win, i, 1, info_win_str[i]);
-    if (strlen(str) > 0) {
-        wattron(info_win, A_BOLD | COLOR_PAIR(i + 3));
-        wprintw(info_win, "%.*s", COLS - strlen(info_win_str[i]) - 1, str);
-        wattroff(info_win, A_BOLD | COLOR_PAIR(i + 3));
+    static int sticky_len;
+    char st[200] = {0};
+
+    if (str) {
+        wmove(info_win, i, 1);
+        wclrtoeol(info_win);
+        mvwprintw(info_win, i, 1, info_win_str[i]);
+        if (strlen(str) > 0) {
+            wattron(info_win, A_BOLD | COLOR_PAIR(i + 3));
+            wprintw(info_win, "%.*s", COLS - strlen(info_win_str[i]) - 1, str);
+            wattroff(info_win, A_BOLD | COLOR_PAIR(i + 3));
+        }
     }
     
     switch (i) {
     case INFO_LINE:
-        if (selected) {
+        if (num_selected) {
             strncpy(st, _(selected_mess), sizeof(st) - 1);
         }
         if (thread_h) {
             sprintf(st + strlen(st), "[%d/%d] %s", thread_h->num, num_of_jobs, _(thread_job_mesg[thread_h->type]));
+            if (thread_h->type == TEST_TH || thread_h->type == SIZE_TH) {
+                get_check_progress(st + strlen(st), sizeof(st) - strlen(st));
+            }
         }
         mvwprintw(info_win, INFO_LINE, COLS - strlen(st), st);
         break;
     case ERR_LINE:
-        if (sv.searching) {
-            mvwprintw(info_win, ERR_LINE, COLS - strlen(_(searching_mess[sv.searching - 1])), _(searching_mess[sv.searching - 1]));
+        if (str) {
+            sticky_len = 0;
+        }
+        if (sv.searching == SEARCHING) {
+            get_search_progress(st, sizeof(st));
+        } else if (sv.searching) {
+            strncpy(st, _(searching_mess[sv.searching - 1]), sizeof(st) - 1);
+        }
+        // pad with spaces to cover a previous, longer, sticky message
+        if (strlen(st) > sticky_len) {
+            sticky_len = strlen(st) < COLS ? strlen(st) : COLS;
+        }
+        if (sticky_len) {
+            mvwprintw(info_win, ERR_LINE, COLS - sticky_len, "%*.*s", sticky_len, sticky_len, st);
         }
         break;
     }
@@ -672,6 +956,7 @@ static void info_print(const char *str, int i) {
  * or strlen(str) bytes (it depends upon which value is smaller).
  * we need malloc because window can be resized (ie: COLS is not a constant)
  * then writes on the pipe the address of the heap-allocated struct info_msg.
+ * A NULL str only refreshes line's sticky message.
  */
 void print_info(const char *str, int line) {
     if (info_win) {
@@ -681,8 +966,8 @@ void print_info(const char *str, int line) {
         if (!(info = malloc(sizeof(struct info_msg)))) {
             goto error;
         }
-        info->msg = strndup(str, sizeof(char) * (COLS - len));
-        if (!info->msg) {
+        info->msg = str ? strndup(str, sizeof(char) * (COLS - len)) : NULL;
+        if (str && !info->msg) {
             free(info);
             goto error;
         }
@@ -732,6 +1017,7 @@ void ask_user(const char *str, char *input, int d) {
     print_info(str, ASK_LINE);
     curs_set(1);
     input_mode = 1;
+    latency_discard();
 #if ARCHIVE_VERSION_NUMBER >= 3002000
     // avoid getting other ask_user calls from archiver_cb_func
     // while already asking another question.
@@ -951,6 +1237,26 @@ wint_t main_poll(WINDOW *win) {
                     /* we received a bus event */
                         devices_bus_process();
                         break;
+                    case DU_IX:
+                    /* background thread computed some dir sizes */
+                        du_refresh(main_p[i].fd);
+                        break;
+                    case TYPE_IX:
+                    /* background thread classified some files */
+                        type_refresh(main_p[i].fd);
+                        break;
+                    case PREVIEW_IX:
+                    /* background thread produced a preview */
+                        preview_refresh(main_p[i].fd);
+                        break;
+                    case FUZZY_IX:
+                    /* fuzzy finder walked some more candidates */
+                        fuzzy_refresh(main_p[i].fd);
+                        break;
+                    case ARCH_BROWSE_IX:
+                    /* background thread read an archive or extracted a member */
+                        arch_browse_refresh(main_p[i].fd);
+                        break;
                     }
                     r--;
                 }
@@ -1028,6 +1334,14 @@ static void inotify_refresh(int win) {
     len = read(ps[win].inot.fd, buffer, BUF_LEN);
     while (i < len) {
         struct inotify_event *event = (struct inotify_event *)&buffer[i];
+        /* sizes cache holds hidden files too */
+        if (event->len) {
+            update_entry_size(win, event->name, event->mask);
+        }
+        /* cached listings hold hidden files too */
+        if (event->len && (event->mask & (IN_CREATE | IN_DELETE | IN_MOVE))) {
+            dircache_invalidate(ps[win].my_cwd);
+        }
         /* ignore events for hidden files if ps[win].show_hidden is false */
         if ((event->len) && ((event->name[0] != '.') || (ps[win].show_hidden))) {
             if ((event->mask & IN_CREATE) || (event->mask & IN_DELETE) || event->mask & IN_MOVE) {
@@ -1035,7 +1349,6 @@ static void inotify_refresh(int win) {
                 tab_refresh(win);
             } else if (event->mask & IN_MODIFY || event->mask & IN_ATTRIB) {
                 if (ps[win].mywin.stat_active) {
-                    memset(ps[win].mywin.tot_size, 0, strlen(ps[win].mywin.tot_size));
                     show_stat(ps[win].mywin.delta, dim - 2, win);
                     print_border_and_title(win);
                 }
@@ -1045,12 +1358,74 @@ static void inotify_refresh(int win) {
     }
 }
 
+/*
+ * Some dir sizes were computed: stats of tabs showing dirs are printed again,
+ * total size included, and disk usage tab is updated.
+ */
+static void du_refresh(int fd) {
+    uint64_t u;
+    
+    read(fd, &u, sizeof(uint64_t));
+    for (int win = 0; win < cont; win++) {
+        if (ps[win].mode <= filter_ && ps[win].mywin.stat_active) {
+            memset(ps[win].mywin.tot_size, 0, strlen(ps[win].mywin.tot_size));
+            show_stat(ps[win].mywin.delta, dim - 2, win);
+            print_border_and_title(win);
+        } else if (ps[win].mode == du_) {
+            refresh_du_analyzer();
+        }
+    }
+}
+
+/*
+ * Rows still being classified are the only ones colored again, here and not
+ * on cursor moves: visible ones are drawn again, other ones once they are drawn.
+ */
+static void type_refresh(int fd) {
+    uint64_t u;
+    
+    read(fd, &u, sizeof(uint64_t));
+    for (int win = 0; win < cont; win++) {
+        if (ps[win].mode != archive_ && ps[win].mode != du_) {
+            for (int i = 0; i < rows[win].num; i++) {
+                if (rows[win].rows[i] & ROW_TYPE_PENDING) {
+                    rows[win].rows[i] &= ~(ROW_COLOR | ROW_TYPE_PENDING);
+                }
+            }
+            list_everything(win, ps[win].mywin.delta, dim - 2);
+        }
+    }
+}
+
+static void preview_refresh(int fd) {
+    uint64_t u;
+    
+    read(fd, &u, sizeof(uint64_t));
+    if (preview_win) {
+        draw_preview();
+    }
+}
+
+static void fuzzy_refresh(int fd) {
+    uint64_t u;
+    
+    read(fd, &u, sizeof(uint64_t));
+    refresh_fuzzy_finder();
+}
+
+static void arch_browse_refresh(int fd) {
+    uint64_t u;
+    
+    read(fd, &u, sizeof(uint64_t));
+    archive_jobs_done();
+}
+
 /*
  * Refreshes win UI if win is not in special_mode
  * (searching, bookmarks or device mode)
  */
 void tab_refresh(int win) {
-     if (ps[win].mode <= fast_browse_) {
+     if (ps[win].mode <= filter_) {
         generate_list(win);
         if (strlen(ps[win].old_file)) {
             move_cursor_to_file(0, ps[win].old_file, win);
@@ -1093,19 +1468,22 @@ void update_special_mode(int num,  char (*str)[PATH_MAX + 1], int mode) {
  * Used when switching to special_mode.
  */
 void show_special_tab(int num, char (*str)[PATH_MAX + 1], const char *title, int mode) {
+    if (mode > filter_) {
+        // current file must be saved before the listing is replaced
+        save_old_pos(active);
+    }
     ps[active].mode = mode;
     ps[active].number_of_files = num;
-    if (mode != fast_browse_) {
+    if (mode > filter_) {
         str_ptr[active] = str;
         strncpy(ps[active].title, title, PATH_MAX);
-        save_old_pos(active);
         print_additional_wins(HELPER_HEIGHT[normal], 0);
         reset_win(active);
         // rm inotify watch for this special mode tab as it is not needed while in special mode.
         // when leaving, change_dir will re-add this.
         inotify_rm_watch(ps[active].inot.fd, ps[active].inot.wd);
     } else {
-        // we're entering fast browse mode. We don't need to clear anything.
+        // we're entering fast browse or filter mode. We don't need to clear anything.
         // if we're entering special mode, we were in normal mode
         if (!print_additional_wins(HELPER_HEIGHT[normal], 0)) {
             // if no additional wins are present,
@@ -1123,13 +1501,15 @@ void leave_special_mode(const char *str,int win) {
     int old_mode = ps[win].mode;
     
     ps[win].mode = normal;
-    if (old_mode != fast_browse_) {
+    if (old_mode > filter_) {
+        // a special mode's view (eg: disk usage mode's sorting) belongs to its listing
+        ps[win].view = NULL;
         change_dir(str, win);
     }
     if (win == active) {
-        // if we were in fast browse mode and there where no additional wins
+        // if we were in fast browse/filter mode and there where no additional wins
         // force a borders and arrow redraw
-        if (!print_additional_wins(HELPER_HEIGHT[old_mode], 0) && old_mode == fast_browse_) {
+        if (!print_additional_wins(HELPER_HEIGHT[old_mode], 0) && old_mode <= filter_) {
             print_border_and_title(active);
             print_arrow(active);
         }
@@ -1185,6 +1565,7 @@ static void resize_fm_win(void) {
     for (int i = 0; i < cont; i++) {
       resize_tab(i, 1);
     }
+    resize_preview();
 }
 
 void change_sort(void) {
@@ -1196,31 +1577,116 @@ void change_sort(void) {
 
 /*
  * Called in manage_space_press() (fm_functions.c)
- * It checks for each fm win, if they're on the same cwd, then checks
- * if the file to be highlighted is visible inside "win" -> useful only if win is not the active one.
- * Then prints c char before current filename and refreshes win.
+ * Marks str with c in win, if it is one of win's visible rows: only those are searched.
+ * Otherwise, win's selection marks are looked up again when drawn.
  */
 void highlight_selected(const char *str, const char c, int win) {
-    if (ps[win].mode <= fast_browse_) {
-        int line = is_present(str, ps[win].nl, ps[win].number_of_files, -1, 0);
-        if (line != -1 && (line - ps[win].mywin.delta >= 0) && (line - ps[win].mywin.delta < dim - 2)) {
-            wattron(ps[win].mywin.fm, A_BOLD);
-            mvwprintw(ps[win].mywin.fm, 1 + line - ps[win].mywin.delta, SEL_COL, "%c", c);
-            wattroff(ps[win].mywin.fm, A_BOLD);
-            wrefresh(ps[win].mywin.fm);
+    if (ps[win].mode <= filter_ || ps[win].mode == archive_) {
+        for (int i = ps[win].mywin.delta; i < ps[win].number_of_files && i - ps[win].mywin.delta < dim - 2; i++) {
+            if (!strcmp(tab_entry(win, i), str)) {
+                mark_row(win, i, c);
+                return;
+            }
+        }
+        forget_selection(win);
+    }
+}
+
+/*
+ * Marks row line of win as selected (c == '*') or not (c == ' '),
+ * printing c before it if it is visible.
+ */
+void mark_row(int win, int line, const char c) {
+    if (rows[win].num == ps[win].number_of_files && line < rows[win].num) {
+        rows[win].rows[line] &= ~ROW_SELECTED;
+        rows[win].rows[line] |= ROW_SEL_KNOWN | (c == '*' ? ROW_SELECTED : 0);
+    }
+    if ((line - ps[win].mywin.delta >= 0) && (line - ps[win].mywin.delta < dim - 2)) {
+        wattron(ps[win].mywin.fm, A_BOLD);
+        mvwprintw(ps[win].mywin.fm, 1 + line - ps[win].mywin.delta, SEL_COL, "%c", c);
+        wattroff(ps[win].mywin.fm, A_BOLD);
+        wrefresh(ps[win].mywin.fm);
+    }
+}
+
+/*
+ * Prints marks of win's visible rows again, looking them up in selected files.
+ * Used after a change to many selected files.
+ */
+void refresh_selected_marks(int win) {
+    if (ps[win].mode <= filter_ || ps[win].mode == archive_) {
+        forget_selection(win);
+        sync_rows(win);
+        wattron(ps[win].mywin.fm, A_BOLD);
+        for (int i = ps[win].mywin.delta; i < ps[win].number_of_files && i - ps[win].mywin.delta < dim - 2; i++) {
+            mvwprintw(ps[win].mywin.fm, 1 + i - ps[win].mywin.delta, SEL_COL, "%c", get_row(win, i) & ROW_SELECTED ? '*' : ' ');
+        }
+        wattroff(ps[win].mywin.fm, A_BOLD);
+        wrefresh(ps[win].mywin.fm);
+    }
+}
+
+/*
+ * Row cache is reset when win's listing changes; rows already computed are kept
+ * if listing only grew (eg: new search results).
+ * If it cannot be allocated, get_row() computes rows every time.
+ */
+static void sync_rows(int win) {
+    struct row_cache *c = &rows[win];
+    int num = ps[win].number_of_files;
+    unsigned char *tmp;
+    
+    if (c->num >= 0 && c->src == str_ptr[win] && c->view == ps[win].view && num >= c->num) {
+        if (num == c->num) {
+            return;
+        }
+        if ((tmp = realloc(c->rows, num))) {
+            memset(tmp + c->num, 0, num - c->num);
+            c->rows = tmp;
+            c->num = num;
+            return;
         }
     }
+    free(c->rows);
+    c->rows = calloc(num > 0 ? num : 1, 1);
+    c->num = c->rows ? num : -1;
+    c->src = str_ptr[win];
+    c->view = ps[win].view;
 }
 
-static void check_selected(const char *str, int win, int line) {
-    int i = is_present(str, selected, num_selected, -1, 0);
-    if (i != -1) {
-        mvwprintw(ps[win].mywin.fm, 1 + line - ps[win].mywin.delta, SEL_COL, "*");
+/*
+ * Returns render data of row i of win, computing what it misses:
+ * color (one lstat) and selection mark (one lookup in selected files).
+ * A row still being classified keeps its temporary color until type_refresh().
+ */
+static unsigned char get_row(int win, int i) {
+    int cached = rows[win].num == ps[win].number_of_files;
+    unsigned char r = cached ? rows[win].rows[i] : 0;
+    
+    if (!(r & ROW_COLOR)) {
+        r |= ps[win].mode == archive_ ? archive_row_color(win, i) : colored_folders(tab_entry(win, i));
+    }
+    if (!(r & ROW_SEL_KNOWN)) {
+        r |= ROW_SEL_KNOWN | (selected_index(tab_entry(win, i)) != -1 ? ROW_SELECTED : 0);
+    }
+    if (cached) {
+        rows[win].rows[i] = r;
+    }
+    return r;
+}
+
+/*
+ * Selection marks of every row of win will be looked up again; colors are kept.
+ */
+static void forget_selection(int win) {
+    for (int i = 0; i < rows[win].num; i++) {
+        rows[win].rows[i] &= ROW_COLOR | ROW_TYPE_PENDING;
     }
 }
 
 void erase_selected_highlight(void) {
     for (int j = 0; j < cont; j++) {
+        forget_selection(j);
         for (int i = 0; (i < dim - 2) && (i < ps[j].number_of_files); i++) {
             mvwprintw(ps[j].mywin.fm, 1 + i, SEL_COL, " ");
         }
@@ -1336,19 +1802,94 @@ static int check_sysinfo_where(int where, int len) {
 }
 
 void trigger_fullname_win(void) {
-    int len = strlen(str_ptr[active][ps[active].curr_pos]);
+    int len = strlen(tab_entry(active, ps[active].curr_pos));
     fullname_win_height = len / COLS + 1;
     trigger_show_additional_win(fullname_win_height, &fullname_win, fullname_print);
 }
 
 static void fullname_print(void) {
+    int color = get_row(active, ps[active].curr_pos) & ROW_COLOR;
+    
     wattron(fullname_win, A_BOLD);
-    wattron(fullname_win, COLOR_PAIR(colored_folders(str_ptr[active][ps[active].curr_pos])));
-    mvwprintw(fullname_win, 0, 0, str_ptr[active][ps[active].curr_pos]);
-    wattroff(fullname_win, COLOR_PAIR(colored_folders(str_ptr[active][ps[active].curr_pos])));
+    wattron(fullname_win, COLOR_PAIR(color));
+    mvwprintw(fullname_win, 0, 0, tab_entry(active, ps[active].curr_pos));
+    wattroff(fullname_win, COLOR_PAIR(color));
 }
 
 static void update_fullname_win(void) {
     remove_additional_win(fullname_win_height, &fullname_win, 0);
     trigger_fullname_win();
 }
+
+/*
+ * Preview pane takes second tab's place: it can only be shown with a single tab.
+ */
+void trigger_preview(void) {
+    if (preview_win) {
+        close_preview();
+    } else if (cont == MAX_TABS) {
+        print_info(_(preview_no_space), ERR_LINE);
+    } else {
+        preview_win = newwin(dim, COLS - COLS / 2, 0, COLS / 2);
+        resize_tab(0, 0);
+        resize_preview();
+    }
+}
+
+void close_preview(void) {
+    if (preview_win) {
+        werase(preview_win);
+        wrefresh(preview_win);
+        delwin(preview_win);
+        preview_win = NULL;
+        resize_tab(0, 0);
+    }
+}
+
+static int num_panes(void) {
+    return cont + (preview_win != NULL);
+}
+
+/*
+ * Preview pane is right of first tab, as high as tabs.
+ */
+static void resize_preview(void) {
+    if (preview_win) {
+        wresize(preview_win, dim, COLS - ps[0].mywin.width);
+        mvwin(preview_win, 0, ps[0].mywin.width);
+        draw_preview();
+    }
+}
+
+/*
+ * Shows preview of active tab's current file: while it is produced in background,
+ * a placeholder is shown (see preview_refresh()).
+ */
+static void draw_preview(void) {
+    int width = getmaxx(preview_win), y = 1;
+    char *text = NULL, *line, *end;
+    const char *path = NULL;
+    
+    werase(preview_win);
+    if (ps[active].number_of_files > 0 && ps[active].mode != archive_ && ps[active].mode != device_) {
+        path = tab_entry(active, ps[active].curr_pos);
+    }
+    if (path && !(text = get_preview(path))) {
+        mvwprintw(preview_win, 1, 1, "%.*s", width - 2, _(preview_loading));
+    }
+    for (line = text; line && *line && y < dim - 1; line = end + 1, y++) {
+        end = strchrnul(line, '\n');
+        mvwprintw(preview_win, y, 1, "%.*s", (int)(end - line) < width - 2 ? (int)(end - line) : width - 2, line);
+        if (!*end) {
+            break;
+        }
+    }
+    free(text);
+    wattron(preview_win, A_BOLD);
+    wborder(preview_win, 0, 0, 0, 0, 0, 0, 0, 0);
+    if (path) {
+        mvwprintw(preview_win, 0, 1, "%.*s", width - 2, strrchr(path, '/') ? strrchr(path, '/') + 1 : path);
+    }
+    wattroff(preview_win, A_BOLD);
+    wrefresh(preview_win);
+}
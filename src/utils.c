@@ -34,39 +34,13 @@ int is_ext(const char *filename, const char *ext[], int size) {
     return 0;
 }
 
-int get_mimetype(const char *path, const char *test) {
-    int ret = 0;
-    const char *mimetype;
-    magic_t magic;
-    
-    if ((magic = magic_open(MAGIC_MIME_TYPE)) == NULL) {
-        ERROR("An error occurred while loading libmagic database.");
-        return ret;
-    }
-    if (magic_load(magic, NULL) == -1) {
-        ERROR("An error occurred while loading libmagic database.");
-        goto end;
-    }
-    if ((mimetype = magic_file(magic, path)) == NULL) {
-        ERROR("An error occurred while loading libmagic database.");
-        goto end;
-    }
-    if (strstr(mimetype, test)) {
-        ret = 1;
-    }
-    
-end:
-    magic_close(magic);
-    return ret;
-}
-
 int move_cursor_to_file(int start_idx, const char *filename, int win) {
     int len;
     char fullpath[PATH_MAX + 1] = {0};
     
     snprintf(fullpath, PATH_MAX, "%s/%s", ps[win].my_cwd, filename);
     len = strlen(fullpath);
-    int i = is_present(fullpath, ps[win].nl, ps[win].number_of_files, len, start_idx);
+    int i = find_row(fullpath, win, len, start_idx);
     if (i != -1) {
         if (i != ps[win].curr_pos) {
             void (*f)(int, int);
@@ -89,7 +63,7 @@ int move_cursor_to_file(int start_idx, const char *filename, int win) {
 void save_old_pos(int win) {
     char *str;
     
-    str = strrchr(ps[win].nl[ps[win].curr_pos], '/') + 1;
+    str = strrchr(tab_entry(win, ps[win].curr_pos), '/') + 1;
     strncpy(ps[win].old_file, str, NAME_MAX);
 }
 
@@ -109,6 +83,51 @@ int is_present(const char *name, char (*str)[PATH_MAX + 1], int num, int len, in
     return -1;
 }
 
+/*
+ * Same as is_present, but looks for name between the rows shown by win.
+ * Returns the row index.
+ */
+int find_row(const char *name, int win, int len, int start_idx) {
+    int cmp;
+    
+    for (int i = start_idx; i < ps[win].number_of_files; i++) {
+        if (len != -1) {
+            cmp = strncmp(tab_entry(win, i), name, len);
+        } else {
+            cmp = strcmp(tab_entry(win, i), name);
+        }
+        if (!cmp) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Returns the i-th row shown by win: while a filter is active,
+ * rows are mapped to listing's entries through its view.
+ */
+char *tab_entry(int win, int i) {
+    if (ps[win].view) {
+        return str_ptr[win][ps[win].view[i]];
+    }
+    return str_ptr[win][i];
+}
+
+/*
+ * Returns the size of an I/O buffer to read a file of given size: small files
+ * are read at once, big ones in IO_BUF_MAX chunks. Always a multiple of page size.
+ */
+size_t io_block_size(off_t size) {
+    if (size <= IO_BUF_MIN) {
+        return IO_BUF_MIN;
+    }
+    if (size >= IO_BUF_MAX) {
+        return IO_BUF_MAX;
+    }
+    return (size + IO_BUF_ALIGN - 1) & ~(off_t)(IO_BUF_ALIGN - 1);
+}
+
 /*
  * Helper function used in show_stat: received a size,
  * it changes the unit from Kb to Mb to Gb if size > 1024(previous unit)
@@ -127,13 +146,105 @@ void change_unit(float size, char *str) {
 void leave_mode_helper(struct stat s) {
     char str[PATH_MAX + 1] = {0};
     
-    strncpy(str, str_ptr[active][ps[active].curr_pos], PATH_MAX);
+    strncpy(str, tab_entry(active, ps[active].curr_pos), PATH_MAX);
     if (!S_ISDIR(s.st_mode)) {
-        strncpy(ps[active].old_file, strrchr(str_ptr[active][ps[active].curr_pos], '/') + 1, NAME_MAX);
-        int len = strlen(str_ptr[active][ps[active].curr_pos]) - strlen(ps[active].old_file);
+        strncpy(ps[active].old_file, strrchr(tab_entry(active, ps[active].curr_pos), '/') + 1, NAME_MAX);
+        int len = strlen(tab_entry(active, ps[active].curr_pos)) - strlen(ps[active].old_file);
         str[len] = '\0';
     } else {
         memset(ps[active].old_file, 0, strlen(ps[active].old_file));
     }
     leave_special_mode(str, active);
 }
+
+/*
+ * Reads exactly len bytes at off: a short file is an error.
+ */
+int read_all(int fd, void *buf, size_t len, off_t off) {
+    size_t done = 0;
+    
+    while (done < len) {
+        ssize_t n = pread(fd, (char *)buf + done, len - done, off + done);
+        
+        if (n == 0 || (n == -1 && errno != EINTR)) {
+            return -1;
+        }
+        if (n > 0) {
+            done += n;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes the whole buffer, retrying on short writes.
+ */
+int write_all(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+    
+    while (done < len) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+        
+        if (n == -1 && errno != EINTR) {
+            return -1;
+        }
+        if (n > 0) {
+            done += n;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Appends len bytes to b, growing it as needed.
+ */
+int buf_add(struct byte_buf *b, const void *data, size_t len) {
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        unsigned char *tmp;
+        
+        while (cap < b->len + len) {
+            cap *= 2;
+        }
+        if (!(tmp = realloc(b->data, cap))) {
+            return -1;
+        }
+        b->data = tmp;
+        b->cap = cap;
+    }
+    if (len) {
+        memcpy(b->data + b->len, data, len);
+        b->len += len;
+    }
+    return 0;
+}
+
+/*
+ * Little endian fields of on-disk records (eg: zip headers)
+ */
+uint16_t get16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+uint32_t get32(const unsigned char *p) {
+    return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+uint64_t get64(const unsigned char *p) {
+    return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+void put16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+void put32(unsigned char *p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+void put64(unsigned char *p, uint64_t v) {
+    put32(p, v & 0xFFFFFFFF);
+    put32(p + 4, v >> 32);
+}
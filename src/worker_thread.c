@@ -9,6 +9,7 @@ static thread_job_list *current_th; // current_th: ptr to latest elem in thread_
 static struct thread_mesg thread_m;
 static pthread_mutex_t job_lck;
 static int inhibit_fd;
+static char result[200]; // copy of running job's result, as job is freed before it is shown
 
 /*
  * Initializes mutex
@@ -44,6 +45,8 @@ static thread_job_list *add_job(thread_job_list *h, int type, int (*f)(void)) {
         strncpy(h->full_path, ps[active].my_cwd, PATH_MAX);
         h->num_selected = num_selected;
         h->type = type;
+        h->result[0] = '\0';
+        atomic_init(&h->cancel, 0);
         h->num = num_of_jobs;
         current_th = h;
     }
@@ -87,12 +90,24 @@ void init_thread(int type, int (* const f)(void)) {
     }
 }
 
+/*
+ * Asks every queued job, running one included, to stop as soon as possible.
+ */
+void cancel_jobs(void) {
+    pthread_mutex_lock(&job_lck);
+    for (thread_job_list *tmp = thread_h; tmp; tmp = tmp->next) {
+        atomic_store(&tmp->cancel, 1);
+    }
+    pthread_mutex_unlock(&job_lck);
+}
+
 /*
  * Fixes some needed current_th variables.
  */
 static int init_thread_helper(void) {
     if (current_th->type == ARCHIVER_TH) {
         char name[NAME_MAX + 1] = {0};
+        const char *ext;
         int num = 1, len;;
         
         ask_user(_(archiving_mesg), name, NAME_MAX);
@@ -102,21 +117,30 @@ static int init_thread_helper(void) {
             return -1;
         }
         if (!strlen(name)) {
-            strncpy(name, strrchr(selected[0], '/') + 1, NAME_MAX);
+            strncpy(name, strrchr(selected_file(0), '/') + 1, NAME_MAX);
+        }
+        /* archive format is chosen by its extension: if none was given, use default one */
+        if ((ext = get_archive_ext(name))) {
+            len = strlen(name) - strlen(ext);
+        } else {
+            ext = DEFAULT_ARCHIVE_EXT;
+            len = strlen(name);
+            strncat(name, ext, NAME_MAX - len);
         }
         /* avoid overwriting a compressed file in path if it has the same name of the archive being created there */
-        len = strlen(name);
-        strcat(name, ".tgz");
         while (access(name, F_OK) == 0) {
-            sprintf(name + len, "%d.tgz", num);
+            snprintf(name + len, NAME_MAX + 1 - len, "%d%s", num, ext);
             num++;
         }
         len = strlen(current_th->full_path);
         snprintf(current_th->full_path + len, PATH_MAX - 1, "/%s", name);
+    } else if (current_th->type == UPDATE_TH) {
+        /* archive to be updated is current file */
+        strncpy(current_th->full_path, tab_entry(active, ps[active].curr_pos), PATH_MAX);
+    }
+    if (!(current_th->selected_files = detach_selected())) {
+        current_th->num_selected = 0;
     }
-    current_th->selected_files = selected;
-    selected = NULL;
-    num_selected = 0;
     erase_selected_highlight();
     return 0;
 }
@@ -128,11 +152,21 @@ static int init_thread_helper(void) {
  */
 static void *execute_thread(void *x) {
     if (thread_h) {
-        if (thread_h->f() == -1) {
+        // a job cancelled while queued is not even started
+        if (!atomic_load(&thread_h->cancel) && thread_h->f() == -1 && !atomic_load(&thread_h->cancel)) {
             thread_m.str = thread_fail_str[thread_h->type];
             ERROR(thread_fail_str[thread_h->type]);
             thread_m.line = ERR_LINE;
             print_info("", INFO_LINE);  // remove previous INFO_LINE message
+        } else if (atomic_load(&thread_h->cancel)) {
+            thread_m.str = job_cancelled;
+            INFO(job_cancelled);
+            thread_m.line = INFO_LINE;
+        } else if (strlen(thread_h->result)) {
+            strncpy(result, thread_h->result, sizeof(result) - 1);
+            thread_m.str = result;
+            INFO(result);
+            thread_m.line = INFO_LINE;
         } else {
             thread_m.str = thread_str[thread_h->type];
             INFO(thread_str[thread_h->type]);